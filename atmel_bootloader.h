@@ -172,6 +172,9 @@ static inline uint32_t bootloader_size()
 static inline void run_bootloader()
 {
 	TIMSK0 = 0;
+	/* the clocks of all blocks run, as after a reset */
+	PRR0 = 0;
+	PRR1 = 0;
 	/* compute the address of the beginning of the bootloader section and
 	 * convert to word address */
 	uint32_t bladdr = (FLASHEND - bootloader_size()) / 2 + 1;
@@ -0,0 +1,121 @@
+#include "capture.h"
+#include "pmw3366.h"
+#include "sched.h"
+#include "usb_mouse.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#define CAPTURE_FOREVER 0xffff
+// a host that does not take a packet in that many frames has stopped
+// reading, like the 50 of the PJRC usb_serial
+#define SEND_TIMEOUT_FRAMES 50
+
+// frames still to capture, CAPTURE_FOREVER until stopped
+static volatile uint16_t frames_left = 0;
+static volatile bool active = false;
+static uint8_t frame_count = 0;
+
+void capture_start(const uint16_t frames)
+{
+	frames_left = frames ? frames : CAPTURE_FOREVER;
+}
+
+void capture_stop(void)
+{
+	frames_left = 0;
+}
+
+bool capture_active(void)
+{
+	return active;
+}
+
+static bool cut_off(void)
+{
+	return !frames_left || !usb_configured();
+}
+
+// one packet, as soon as the endpoint has a free bank; false if the
+// capture was stopped meanwhile, or is stopped here as the host does not
+// read it
+static bool send(const uint8_t *data, uint8_t len)
+{
+	const uint8_t from = UDFNUML;
+	for (;;) {
+		if (cut_off())
+			return false;
+		if ((uint8_t)(UDFNUML - from) >= SEND_TIMEOUT_FRAMES) {
+			capture_stop();
+			return false;
+		}
+		// UENUM is shared with the interrupts
+		cli();
+		UENUM = CAPTURE_ENDPOINT;
+		if (UEINTX & (1<<RWAL))
+			break;
+		sei();
+		sched_idle();
+	}
+	while (len--)
+		UEDATX = *data++;
+	UEINTX = 0x3a;
+	sei();
+	return true;
+}
+
+static void frame(void)
+{
+	static uint8_t packet[CAPTURE_SIZE];
+	struct capture_header *header = (struct capture_header *)packet;
+	header->magic = CAPTURE_MAGIC;
+	header->frame = frame_count++;
+	header->width = CAPTURE_WIDTH;
+	header->reserved = 0;
+	uint8_t squal;
+	uint16_t shutter;
+	pmw3366_capture_start(&squal, &shutter);
+	header->squal = squal;
+	header->shutter = shutter;
+
+	uint8_t n = sizeof(*header);
+	for (uint16_t i = 0; i < CAPTURE_PIXELS; i++) {
+		packet[n++] = pmw3366_capture_pixel();
+		if (n == CAPTURE_SIZE) {
+			if (!send(packet, n))
+				break;
+			n = 0;
+		}
+	}
+	// the short packet ends the transfer, CAPTURE_PIXELS is no multiple
+	// of CAPTURE_SIZE
+	if (!cut_off() && send(packet, n))
+		return;
+	// the packet not yet taken is dropped, a zero length one ends the
+	// transfer short instead; the next capture starts with a new one
+	cli();
+	UERST = (1 << CAPTURE_ENDPOINT);
+	UERST = 0;
+	UENUM = CAPTURE_ENDPOINT;
+	UEINTX = 0x3a;
+	sei();
+}
+
+void capture_task(void)
+{
+	while (frames_left) {
+		active = true;
+		frame();
+		pmw3366_capture_end();
+		active = false;
+		cli();
+		if (frames_left != CAPTURE_FOREVER && frames_left)
+			--frames_left;
+		sei();
+		if (!usb_configured())
+			frames_left = 0;
+		const uint8_t from = UDFNUML;
+		while (frames_left && (uint8_t)(UDFNUML - from) < CAPTURE_TRACK_MS)
+			sched_idle();
+	}
+}
@@ -0,0 +1,72 @@
+#ifndef _CAPTURE_H_INCLUDED_
+#define _CAPTURE_H_INCLUDED_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Frame capture: raw pixel frames of the sensor, streamed to the host for
+ * diagnosing the surface and the lens.
+ *
+ * The host starts and stops it with vendor requests to CAPTURE_INTERFACE
+ * and reads the frames from the bulk IN endpoint CAPTURE_ENDPOINT. Each
+ * frame is one transfer: a struct capture_header followed by the
+ * CAPTURE_PIXELS pixels, row by row, in 64 byte packets; the last one is
+ * short. A frame cut off by CAPTURE_STOP is not finished, nor is one the
+ * host stops reading: a packet not taken within 50 frames ends the capture.
+ *
+ * Capturing stops the sensor tracking, which needs the SROM again after
+ * it. Each frame therefore takes a sensor restart (~150ms), between frames
+ * the mouse tracks for CAPTURE_TRACK_MS. The buttons work throughout.
+ * tools/capture saves the frames as images.
+ */
+
+#define CAPTURE_INTERFACE	1
+#define CAPTURE_ENDPOINT	1
+#define CAPTURE_SIZE		64
+
+// vendor requests, bmRequestType 0x41
+#define CAPTURE_START		1	// wValue frames, 0 until CAPTURE_STOP
+#define CAPTURE_STOP		2
+
+#define CAPTURE_WIDTH		36
+#define CAPTURE_PIXELS		(CAPTURE_WIDTH * CAPTURE_WIDTH)
+#define CAPTURE_MAGIC		0xfc
+
+// tracking between the frames, also lets SQUAL settle for the next one
+#define CAPTURE_TRACK_MS	20
+
+struct capture_header {
+	uint8_t magic;		// CAPTURE_MAGIC
+	uint8_t frame;		// counts the frames since power-on
+	uint8_t squal;		// surface quality right before the frame
+	uint8_t width;		// CAPTURE_WIDTH, the frame is square
+	uint16_t shutter;	// exposure time, little endian
+	uint16_t reserved;
+} __attribute__((packed));
+
+/**
+ * Handles CAPTURE_START and CAPTURE_STOP, from the USB interrupt.
+ *
+ * @param frames number of frames to capture, 0 for all until
+ *        capture_stop; replaces what is left of an earlier request
+ */
+void capture_start(uint16_t frames);
+
+/**
+ * Stops the capture, a frame being read is cut off.
+ */
+void capture_stop(void);
+
+/**
+ * Runs the requested frames, blocking, from main(). The slots go on and
+ * must leave the sensor alone while capture_active.
+ */
+void capture_task(void);
+
+/**
+ * @return true while the sensor is taken by the capture
+ */
+bool capture_active(void);
+
+#endif /* _CAPTURE_H_INCLUDED_ */
@@ -1,357 +1,504 @@
 #include <avr/io.h>
-#include <avr/pgmspace.h>
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
 #include "usb_mouse.h"
-#if SROM_VERSION == 3
-#   include "srom_3360_0x03.h"
-#elif SROM_VERSION == 5
-#   include "srom_3360_0x05.h"
-#else
-#   error bad srom version
-#endif
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "mouse.h"
 #include "buttons.h"
-
-#define delay_us(t) __builtin_avr_delay_cycles((t) * F_CPU/1000000)
-#define delay_ms(t) __builtin_avr_delay_cycles((t) * F_CPU/1000)
-
-
-#define PORT_SPI PORTB
-#define DDR_SPI	DDRB
-
-#define DD_SS	6 // aka NCS
-#define DD_SCK	1
-#define DD_MOSI	2
-#define DD_MISO	3
-
-#define SS_LOW	(PORT_SPI &= ~(1<<DD_SS))
-#define SS_HIGH	(PORT_SPI |= (1<<DD_SS))
+#include "sched.h"
+#include "spi.h"
+#include "pmw3366.h"
+#include "sample.h"
+#include "power.h"
+#include "capture.h"
+#include "stream.h"
+#include "trace.h"
 
 union motion_data {
 	int16_t all;
 	struct { uint8_t lo, hi; };
 };
 
+#ifdef SPI_USART
+// PD2/PD3, the top contacts, are RXD1/TXD1 of the sensor transport: only
+// the bottom contacts are read, see slot_task
+#define BUTTON_PINS (_BV(PD1) | _BV(PD0))
+#else
+#define BUTTON_PINS (_BV(PD3) | _BV(PD2) | _BV(PD1) | _BV(PD0))
+#endif
+
 static void pins_init(void)
 {
 	DDRC |= _BV(PC2);
 	PORTC |= _BV(PC2);
 	/* initialize buttons inputs */
-	DDRD &= ~(_BV(PD3) | _BV(PD2) | _BV(PD1) | _BV(PD0));
-	PORTD |= _BV(PD3) | _BV(PD2) | _BV(PD1) | _BV(PD0);
+	DDRD &= ~BUTTON_PINS;
+	PORTD |= BUTTON_PINS;
 	EICRA = 0b01010101; // generate interrupt request on any edge of D0/D1/D2/D3
 	EIMSK = 0; // but don't enable any actual interrupts
 	EIFR = 0b00001111; // clear EIFR
-#ifdef DEBUG_PINS
-	DDRB |= _BV(PB5);
-	PORTB &= ~_BV(PB5);
-	DDRC |= _BV(PC6);
-	PORTC &= ~_BV(PC6);
+}
+
+// The clocks of the timers and the serial blocks stay stopped until the
+// module that uses one starts it, so that the unused ones do not draw
+// current in the idle sleep between the slots. The analog comparator is
+// not used at all.
+static void power_reduction_init(void)
+{
+	ACSR = (1<<ACD);
+	PRR0 = (1<<PRTIM0) | (1<<PRTIM1) | (1<<PRSPI);
+	PRR1 = (1<<PRUSART1);
+}
+
+// previous state to compare against for debouncing
+static uint8_t btn_prev = 0x00;
+// binary OR of all button states since the last bank of the mouse endpoint
+// was filled
+static uint8_t btn_usb = 0x00;
+// button state of the last bank
+static uint8_t btn_usb_prev = 0x00;
+// motion accumulated since the last bank was filled, wider than a report:
+// at CPI_MAX a host that is behind by a few ms would wrap an int16
+static int32_t x, y;
+// frames since the last report of the endpoint, for the idle rate
+static uint16_t idle_frames;
+#ifdef MOUSE_TIMESTAMP
+// weight of the motion in each slot since the last report, the largest
+// if it covers more than one frame, in the 2 bit fields of the report
+static uint8_t slot_weights[SCHED_SLOTS / 4];
+// the lowest bit of the field of a slot in its byte: a multiplication
+// instead of a shift by a variable count, which is a loop
+static const uint8_t slot_weight_unit[4] = {1, 1 << 2, 1 << 4, 1 << 6};
+
+static inline uint8_t slot_weight(const int16_t dx, const int16_t dy)
+{
+	const uint16_t m = (uint16_t)(dx < 0 ? -dx : dx)
+		+ (uint16_t)(dy < 0 ? -dy : dy);
+	return !m ? 0 : m < 4 ? 1 : m < 16 ? 2 : 3;
+}
+#endif
+
+static uint32_t time_ticks = 0;
+// the sensor side of the current slot, or the previous one until the
+// burst is done
+static struct sample sample = {.squal = 128};
+
+// handed from slot_task to the end of the burst
+static struct pmw3366_burst burst;
+static bool overwrite_delta;
+static int16_t out_dx, out_dy;
+static uint8_t btn_dbncd;
+static uint8_t slot_index;
+static bool slot_burst;
+// the buttons changed or the sensor moved in the slot
+static bool slot_active;
+#ifdef PMW3366_BURST_EXTENDED
+// the motion of the whole burst, for the slot after it
+static int16_t carry_dx, carry_dy;
+// the slot of the whole burst: slot 0 is late from the SOF and opens the
+// stream bank, a middle one has the room for the 5 more bytes. The power
+// profiles that skip it read SQUAL again from the first motion on
+#define FULL_SLOT 4
+#else
+#define FULL_SLOT 0
+#endif
+
+static void report_prepare(void);
+static void slot_stream(int16_t dx, int16_t dy);
+static void slot_finish(void);
+
+// the buttons and the mouse logic of a slot, in the gap of its burst
+static void slot_inputs(const uint8_t slot)
+{
+	// high = not in contact, low = in contact
+	// PIND 0 EIFR 0: low, no edges -> is low
+	// PIND 0 EIFR 1: low, edge -> is low
+	// PIND 1 EIFR 0: high, no edges -> always high during last 125us
+	// PIND 1 EIFR 1: high, edge -> low at some point in the last 125us
+	const uint8_t btn_raw = PIND & (~EIFR); // 1 means high
+	EIFR = 0b00001111; // clear EIFR
+#ifdef SPI_USART
+	// without the top contacts, a button is released when the bottom
+	// one opens
+	struct input inputs[2] = {
+		{.T = !!(btn_raw & _BV(PD0)), .B = !(btn_raw & _BV(PD0))},
+		{.T = !!(btn_raw & _BV(PD1)), .B = !(btn_raw & _BV(PD1))}
+	};
+#else
+	struct input inputs[2] = {
+		{.T = !(btn_raw & _BV(PD2)), .B = !(btn_raw & _BV(PD0))},
+		{.T = !(btn_raw & _BV(PD3)), .B = !(btn_raw & _BV(PD1))}
+	};
+#endif
+	BUTTONS_task(1, inputs);
+	bool b1 = BUTTONS_get(0), b2 = BUTTONS_get(1);
+	overwrite_delta = mouse_step(time_ticks++, b1, b2,
+			sample_tracking(&sample), &b1, &b2, &out_dx, &out_dy);
+	btn_dbncd = b1 | (b2 << 1);
+	btn_usb |= btn_dbncd;
+	slot_active = btn_dbncd != btn_prev;
+	btn_prev = btn_dbncd;
+	if (slot == SCHED_SLOTS - 1)
+		report_prepare();
+
+	// into the register shadow, written in place of a later burst. Once
+	// per frame, in the gap of slot 1: slot 0 is late from the SOF and
+	// reads the whole burst, the others have the room
+	if (slot == 1) {
+		int16_t cpi;
+		bool as;
+		int8_t lod;
+		mouse_get_params(&cpi, &as, &lod);
+		pmw3366_set_cpi(cpi);
+		pmw3366_set_mode(as, lod);
+	}
+	TRACE_MARK(TRACE_INPUT);
+}
+
+void slot_task(uint8_t slot)
+{
+	TRACE_MARK(TRACE_SLOT);
+	slot_index = slot;
+
+	// the burst runs from the SPI interrupt while the inputs are done,
+	// the slot goes on in pmw3366_burst_done. Without motion only the
+	// Motion byte is read, with it up to the deltas, once per frame the
+	// whole burst, for SQUAL. The activity of the slot before goes back
+	// to the full rate from this slot on, see power.h
+	const bool sampling = power_sample(slot,
+			(EIFR & BUTTON_PINS) || slot_active) && !capture_active();
+	const bool bursting = sampling && pmw3366_burst_start(&burst,
+			slot == FULL_SLOT);
+	if (bursting)
+		sched_slot_defer();
+	slot_burst = bursting;
+	TRACE_MARK(TRACE_BURST_CMD);
+	power_slot_done(slot_active);
+
+	slot_inputs(slot);
+
+	if (bursting) {
+#ifdef PMW3366_BURST_EXTENDED
+		// the 5 more bytes of the whole burst leave no room after it:
+		// the slot is streamed before, its motion goes with the next one
+		if (slot == FULL_SLOT)
+			slot_stream(0, 0);
+#endif
+		// the inputs take most of the wait for the data, the rest is
+		// waited out: a USB interrupt between the burst and the end of
+		// the slot would take the room the slot has left
+		pmw3366_burst_wait(true);
+	} else {
+		// the power profile skips this slot, a sensor register write
+		// goes out or is settling, or the sensor takes a frame for the
+		// capture; the motion comes with the next burst
+		sample.dx = 0;
+		sample.dy = 0;
+		slot_finish();
+	}
+}
+
+void pmw3366_burst_done(void)
+{
+	TRACE_MARK(TRACE_BURST_READ);
+	sample_from_burst(&sample, &burst);
+#ifdef PMW3366_BURST_EXTENDED
+	if (slot_index == FULL_SLOT) {
+		carry_dx = overwrite_delta ? out_dx : sample.dx;
+		carry_dy = overwrite_delta ? out_dy : sample.dy;
+		slot_active |= sample.dx || sample.dy;
+		sched_slot_done();
+		return;
+	}
 #endif
+	slot_finish();
+	sched_slot_done();
 }
 
+// the accumulator saturates instead of wrapping, which takes minutes of
+// motion at CPI_MAX that the host does not take
+#define MOTION_MAX (INT32_MAX - INT16_MAX)
 
-static void spi_init(void)
+static inline int32_t motion_add(const int32_t acc, const int16_t d)
 {
-	DDR_SPI |= (1<<DD_MOSI) | (1<<DD_SCK) | (1<<DD_SS); // outputs
-	DDRB |= (1<<0); PORTB |= (1<<0); // set the hardware SS pin to low to enable SPI
-	// MISO pullup input is already done in hardware
-	// enable spi, master mode, mode 3, clock rate = fck/4 = 2MHz
-	SPCR = (1<<SPE) | (1<<MSTR) | (1<<CPOL) | (1<<CPHA);
+	// cannot overflow, |acc| <= MOTION_MAX
+	const int32_t sum = acc + d;
+	if (sum > MOTION_MAX)
+		return MOTION_MAX;
+	if (sum < -MOTION_MAX)
+		return -MOTION_MAX;
+	return sum;
 }
 
-static inline void spi_send(const uint8_t b)
+// the part of the motion that fits the logical range of a report, the
+// rest waits for the next
+static inline int16_t report_clamp(const int32_t v)
 {
-	SPDR = b;
-	while (!(SPSR & (1<<SPIF)));
+	if (v > MOUSE_XY_MAX)
+		return MOUSE_XY_MAX;
+	if (v < -MOUSE_XY_MAX)
+		return -MOUSE_XY_MAX;
+	return v;
 }
 
-static inline uint8_t spi_recv(void)
+// A byte of a report, into the buffer of a GET_REPORT or, without one,
+// straight into the bank of the endpoint. Inlined with report_take into
+// both callers, where the test folds away: slot 7 saves the copy.
+static inline uint8_t *report_put(uint8_t *report, const uint8_t byte)
+{
+	if (!report) {
+		UEDATX = byte;
+		return report;
+	}
+	*report = byte;
+	return report + 1;
+}
+
+#ifdef MOUSE_TIMESTAMP
+// the frame of the next report, read by the caller of report_take
+static uint8_t frame_lo, frame_hi;
+#endif
+
+// Packs what came since the last report into a mouse report and takes it
+// from the accumulated state
+static inline void report_take(uint8_t *report)
 {
-	spi_send(0x00);
-	return SPDR;
+	union motion_data dx, dy;
+	dx.all = report_clamp(x);
+	dy.all = report_clamp(y);
+	// the layout of mouse_hid_report_desc, see MOUSE_XY_BITS
+	report = report_put(report, btn_usb);
+#if MOUSE_XY_BITS == 12
+	report = report_put(report, dx.lo);
+	report = report_put(report, (dx.hi & 0x0f) | (dy.lo << 4));
+	report = report_put(report, (dy.lo >> 4) | (dy.hi << 4));
+#else
+	report = report_put(report, dx.lo);
+	report = report_put(report, dx.hi);
+	report = report_put(report, dy.lo);
+	report = report_put(report, dy.hi);
+	report = report_put(report, 0);
+#endif
+#ifdef MOUSE_TIMESTAMP
+	report = report_put(report, frame_lo);
+	report = report_put(report, frame_hi);
+	report = report_put(report, slot_weights[0]);
+	report_put(report, slot_weights[1]);
+	slot_weights[0] = 0;
+	slot_weights[1] = 0;
+#endif
+	btn_usb_prev = btn_usb;
+	btn_usb = 0x00;
+	x -= dx.all;
+	y -= dy.all;
 }
 
-static inline void spi_write(const uint8_t addr, const uint8_t data)
+// GET_REPORT: the USB interrupt does not nest with the slots, so the host
+// gets each count either here or from the endpoint
+void usb_mouse_get_report(uint8_t *report)
 {
-	spi_send(addr | 0x80);
-	spi_send(data);
-	delay_us(180); // maximum of t_SWW, t_SWR
+	// the buttons held now, also right after a latch that started the
+	// next frame over
+	btn_usb |= btn_dbncd;
+#ifdef MOUSE_TIMESTAMP
+	// the frame can change between the two reads, rarely, which the host
+	// sees as a jump
+	frame_lo = UDFNUML;
+	frame_hi = UDFNUMH;
+#endif
+	report_take(report);
 }
 
-static inline uint8_t spi_read(const uint8_t addr)
+// what report_latch decides without the motion of the last slot, in the
+// gap of its burst
+static bool report_due;
+
+static void report_prepare(void)
 {
-	spi_send(addr);
-	delay_us(160); // t_SRAD
-	uint8_t data = spi_recv();
-	delay_us(20);
-	return data;
+	if (idle_frames < UINT16_MAX)
+		++idle_frames;
+	// only transmit if there's something worth transmitting, or the
+	// idle rate of the host is due
+	const uint16_t idle = usb_mouse_idle_frames();
+	report_due = btn_usb != btn_usb_prev || (idle && idle_frames >= idle);
+#ifdef MOUSE_TIMESTAMP
+	// the frame of the slots in the report: the end of the last slot may
+	// be after the SOF of the next frame, its gap is not
+	frame_lo = UDFNUML;
+	frame_hi = UDFNUMH;
+#endif
 }
 
-static void pmw3366_init(const uint8_t dpi)
+// Fills a bank of the mouse endpoint with what came since the last one.
+// The endpoint is double banked and a filled bank belongs to the host
+// until it is sent: the banks are never killed and rewritten, which could
+// race with the IN token. One bank waits for the poll while the other is
+// free for the next latch; if the host is behind and both wait, the motion
+// stays here until a later latch. Latching once per frame, in the last
+// slot, still gives the poll everything up to that slot.
+static void report_latch(void)
 {
-	const uint8_t *psrom = srom;
-
-	SS_HIGH;
-	delay_ms(3);
-
-	// shutdown first
-	SS_LOW;
-	spi_write(0x3b, 0xb6);
-	SS_HIGH;
-	delay_ms(300);
-
-	// drop and raise ncs to reset spi port
-	SS_LOW;
-	delay_us(40);
-	SS_HIGH;
-	delay_us(40);
-
-	// power up reset
-	SS_LOW;
-	spi_write(0x3a, 0x5a);
-	SS_HIGH;
-	delay_ms(50);
-
-	// read from 0x02 to 0x06
-	SS_LOW;
-	spi_read(0x02);
-	spi_read(0x03);
-	spi_read(0x04);
-	spi_read(0x05);
-	spi_read(0x06);
-
-	spi_write(0x10, 0x00);
-	spi_write(0x22, 0x00);
-
-	// srom download
-	spi_write(0x13, 0x1d);
-	SS_HIGH;
-	delay_ms(10);
-	SS_LOW;
-	spi_write(0x13, 0x18);
-
-	spi_send(0x62 | 0x80);
-	for (uint16_t i = 0; i < SROM_LENGTH; i++) {
-		delay_us(16);
-		spi_send(pgm_read_byte(psrom++));
+	if (!report_due && !x && !y) {
+		// the buttons of the next frame start over, or a release
+		// without motion would never be sent
+		btn_usb = 0x00;
+		return;
 	}
-	delay_us(18);
-	SS_HIGH;
-	delay_us(200);
-
-	// check srom id
-	SS_LOW;
-
-	// configuration/settings
-	spi_write(0x10, 0x00); // 0x20 (g502 default) enables rest mode after ~10s of inactivity
-	spi_write(0x14, 0xff); // how long to wait before going to rest mode. 0xff is max (~10 seconds)
-	spi_write(0x17, 0xff);
-	spi_write(0x18, 0x00);
-	spi_write(0x19, 0x00);
-	spi_write(0x1b, 0x00);
-	spi_write(0x1c, 0x00);
-
-	spi_write(0x2c, 0x0a);
-	spi_write(0x2b, 0x10);
-
-	// configuration/settings
-	spi_write(0x0f, dpi); // 2000 dpi
-	spi_write(0x42, 0x00); // no angle snapping
-	spi_write(0x0d, 0x60); // invert x,y
-	SS_HIGH;
+	UENUM = MOUSE_ENDPOINT;
+	if (!(UEINTX & (1<<RWAL)))
+		return;
+	report_take(NULL);
+	UEINTX = 0x3a;
+	TRACE_MARK(TRACE_REPORT);
+	idle_frames = 0;
+}
+
+// the sample of the slot into the stream, which ends the slot
+static void slot_stream(const int16_t dx, const int16_t dy)
+{
+	stream_slot(slot_index, dx, dy, sample.squal, btn_dbncd
+		| STREAM_SLOT | (slot_burst ? STREAM_BURST : 0));
+	TRACE_SLOT_DONE();
 }
 
-#define CPI_VAL(cpi) ((cpi) / 100 - 1)
+#ifdef PMW3366_BURST_EXTENDED
+// the motion of the whole burst into the slot after it, see slot_task
+static void motion_carry(union motion_data *_x, union motion_data *_y)
+{
+	_x->all += carry_dx;
+	_y->all += carry_dy;
+	carry_dx = 0;
+	carry_dy = 0;
+}
+#endif
 
-void pmw3366_set_cpi(int16_t cpi)
+static void slot_finish(void)
 {
-	static int16_t last_cpi = 0;
-	if (cpi != last_cpi) {
-		SS_LOW;
-		spi_write(0x0f, CPI_VAL(cpi));
-		SS_HIGH;
-		last_cpi = cpi;
+	union motion_data _x, _y;
+	_x.all = sample.dx;
+	_y.all = sample.dy;
+
+	if (overwrite_delta) {
+		_x.all = out_dx;
+		_y.all = out_dy;
 	}
+#ifdef PMW3366_BURST_EXTENDED
+	motion_carry(&_x, &_y);
+#endif
+
+	x = motion_add(x, _x.all);
+	y = motion_add(y, _y.all);
+	slot_active |= sample.dx || sample.dy;
+#ifdef MOUSE_TIMESTAMP
+	const uint8_t unit = slot_weight_unit[slot_index & 3];
+	const uint8_t w = slot_weight(_x.all, _y.all) * unit;
+	uint8_t *const weights = &slot_weights[slot_index >> 2];
+	if (w > (*weights & 3 * unit))
+		*weights = (*weights & ~(3 * unit)) | w;
+#endif
+	// the last slot before the poll, which comes early in the frame; the
+	// report goes first, the end of the slot is close to the SOF there
+	if (slot_index == SCHED_SLOTS - 1)
+		report_latch();
+
+	slot_stream(sample.dx, sample.dy);
+}
+
+// a press closes the bottom contact of a button, which wakes the cpu from
+// the power-down of a suspend
+static volatile bool button_woke = false;
+
+ISR(INT0_vect)
+{
+	button_woke = true;
+}
+
+ISR(INT1_vect)
+{
+	button_woke = true;
 }
-void pmw3366_set_mode(bool as, int8_t lod)
+
+// USB suspend: the slots stop, the sensor rests and the cpu sleeps in
+// power-down until the host resumes the bus. If the host allows it, a
+// button press wakes the host first. The sensor is in run mode again
+// before the first SOF, which starts the slots.
+static void suspend_task(void)
 {
-	static int8_t last_as = -1;
-	static int8_t last_lod = 0;
-	if ((int8_t)as == last_as && lod == last_lod)
+	if (!usb_suspended())
 		return;
-	SS_LOW;
-	if ((int8_t)as != last_as) {
-		spi_write(0x42, as ? (1 << 7) : 0);
-		last_as = (int8_t)as;
-	}
-	if (lod != last_lod) {
-		spi_write(0x63, lod);
-		last_lod = lod;
+	// a remote wakeup needs 5ms of idle bus, 3ms of it before SUSPI
+	const uint16_t suspended_at = TCNT1;
+	sched_stop();
+	pmw3366_suspend();
+	while ((uint16_t)(TCNT1 - suspended_at) < 2 * (F_CPU / 1000))
+		;
+
+	button_woke = false;
+	EIFR = 0b00000011;
+	EIMSK = 0b00000011;
+	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+	for (;;) {
+		cli();
+		if (!usb_suspended())
+			break;
+		// the USB clock runs from the remote wakeup on, the host
+		// resumes the bus within a few ms
+		if (button_woke && usb_remote_wakeup())
+			set_sleep_mode(SLEEP_MODE_IDLE);
+		button_woke = false;
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
 	}
-	SS_HIGH;
+	EIMSK = 0;
+	sei();
+
+	pmw3366_resume();
+	sched_init();
 }
 
 int main(void)
 {
-	union motion_data x, y;
-
 	// set clock prescaler for 8MHz
 	CLKPR = 0x80;
 	CLKPR = 0x01;
 
+	power_reduction_init();
 	pins_init();
+	mouse_init();
 
-	// previous state to compare against for debouncing
-	uint8_t btn_prev = 0x00;
-	// binary OR of all button states since previous usb transmission
-	uint8_t btn_usb = 0x00;
-	// previously transmitted button state
-	uint8_t btn_usb_prev = 0x00;
+	// enumeration is interrupt driven and goes on during the sensor init,
+	// which sleeps through its waits on timer1 deadlines
+	usb_init();
+	sched_timebase_init();
 
 	spi_init();
 	const uint8_t dpi = ((PIND & (1<<6)) >> 6) | ((PIND & (1<<4)) >> 3);
 	const uint8_t dpis[] = {CPI_VAL(1500), CPI_VAL(500), CPI_VAL(600), CPI_VAL(700)};
-	pmw3366_init(dpis[dpi]);
+	power_init(mouse_power_profile());
+	pmw3366_init(dpis[dpi], mouse_srom_version());
 
-	usb_init();
 	while (!usb_configured())
-		;
-
-	// begin burst mode
-	SS_LOW;
-	spi_write(0x50, 0x00);
-	SS_HIGH;
+		sched_idle();
 
-	// set up timer0 to set OCF0A in TIFR0 every 125us
-	TCCR0A = 0x02; // CTC
-	TCCR0B = 0x02; // prescaler 1/8 = 1us period
-	OCR0A = 124; // = 125 - 1
+	pmw3366_burst_mode();
 
 	BUTTONS_set_debounce_delay(160);
+	TRACE_INIT();
 
-	uint32_t time_ticks = 0;
-
-	uint8_t prev_squal = 128;
+	// from here on all work is done in slot_task, driven by the SOF and
+	// timer0 interrupts, but for the frame capture, the eeprom writes of
+	// the settings, the suspend and the trace bookkeeping
+	sched_init();
 	while (1) {
-		for (uint8_t i = 0; i < 8; i++) {
-			if (i == 0) {
-				// sync to usb frames (1ms)
-				UDINT &= ~(1<<SOFI);
-				while(!(UDINT & (1<<SOFI)));
-				// reset prescaler phase, not really necessary
-				GTCCR |= (1<<PSRSYNC);
-				TCNT0 = 0;
-			} else {
-				// sync to 125us intervals using timer0
-				while (!(TIFR0 & (1<<OCF0A)));
-			}
-#ifdef DEBUG_PINS
-			PORTB |= _BV(PB5);
-			PORTB &= ~_BV(PB5);
-#endif
-
-			TIFR0 |= (1<<OCF0A); // 0CF0A is cleared by writing 1
-
-			const uint8_t intr_state = SREG;
-			cli();
-
-			union motion_data _x, _y;
-
-			SS_LOW;
-			spi_send(0x50);
-
-			/* instead of delay..., this should take more than 35ms */
-			bool overwrite_delta;
-			// high = not in contact, low = in contact
-			// PIND 0 EIFR 0: low, no edges -> is low
-			// PIND 0 EIFR 1: low, edge -> is low
-			// PIND 1 EIFR 0: high, no edges -> always high during last 125us
-			// PIND 1 EIFR 1: high, edge -> low at some point in the last 125us
-			const uint8_t btn_raw = PIND & (~EIFR); // 1 means high
-			EIFR = 0b00001111; // clear EIFR
-			struct input inputs[2] = {
-				{.T = !(btn_raw & _BV(PD2)), .B = !(btn_raw & _BV(PD0))},
-				{.T = !(btn_raw & _BV(PD3)), .B = !(btn_raw & _BV(PD1))}
-			};
-			BUTTONS_task(1, inputs);
-			bool b1 = BUTTONS_get(0), b2 = BUTTONS_get(1);
-			int16_t out_dx, out_dy;
-			overwrite_delta = mouse_step(time_ticks, b1, b2, prev_squal >= 16,
-					&b1, &b2, &out_dx, &out_dy);
-
-#ifdef DEBUG_PINS
-			PORTC |= _BV(PC6);
-			PORTC &= ~_BV(PC6);
-#endif
-
-			spi_send(0x00); // motion, not used
-			spi_send(0x00); // observation, not used
-			_x.lo = spi_recv();
-			_x.hi = spi_recv();
-			_y.lo = spi_recv();
-			_y.hi = spi_recv();
-			prev_squal = spi_recv();
-			SS_HIGH;
-
-#ifdef DEBUG_PINS
-			PORTC |= _BV(PC6);
-			PORTC &= ~_BV(PC6);
-#endif
-
-			if (overwrite_delta) {
-				_x.all = out_dx;
-				_y.all = out_dy;
-			}
-
-			int16_t cpi;
-			bool as;
-			int8_t lod;
-			mouse_get_params(&cpi, &as, &lod);
-			pmw3366_set_cpi(cpi);
-			pmw3366_set_mode(as, lod);
-			const uint8_t btn_dbncd = b1 | (b2 << 1);
-
-			if ((btn_dbncd != btn_prev) || _x.all || _y.all) {
-				UENUM = MOUSE_ENDPOINT;
-				if (UESTA0X & (1<<NBUSYBK0)) { // untransmitted data still in bank
-					UEINTX |= (1<<RXOUTI); // kill bank; RXOUTI == KILLBK
-					while (UEINTX & (1<<RXOUTI));
-				} else {
-					// transmission's finished, or the data that should be in the
-					// bank is exactly the same as what was previously transmitted
-					// so that there was nothing worth transmitting before.
-					btn_usb_prev = btn_usb;
-					btn_usb = 0x00;
-					x.all = 0;
-					y.all = 0;
-				}
-				btn_usb |= btn_dbncd;
-				x.all += _x.all;
-				y.all += _y.all;
-				// only transmit if there's something worth transmitting
-				if ((btn_usb != btn_usb_prev)|| x.all || y.all) {
-#ifdef DEBUG_PINS
-					PORTC |= _BV(PC6);
-					PORTC &= ~_BV(PC6);
-#endif
-					UEDATX = btn_usb;
-					UEDATX = x.lo;
-					UEDATX = x.hi;
-					UEDATX = y.lo;
-					UEDATX = y.hi;
-					UEDATX = 0;
-					UEINTX = 0x3a;
-				}
-			}
-
-			btn_prev = btn_dbncd;
-			++time_ticks;
-
-			SREG = intr_state;
-		}
+		TRACE_TASK();
+		capture_task();
+		mouse_task();
+		suspend_task();
+		sched_idle();
 	}
 }
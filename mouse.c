@@ -44,6 +44,20 @@ enum state {
 #    define run_bootloader() {DBG("RUN BOOTLOADER\n"); exit(0);}
 #    define store_config(cpi, as, lod) DBG("STORING CONFIG cpi=%i, as=%i, lod=%i\n", (int)(cpi), (int)(as), (int)lod)
 #    define load_config(cpi, as, lod) { *(cpi) = CPI_DEFAULT; *(as) = 0; *(lod) = 2; DBG("LOADING CONFIG cpi=%i, as=%i, lod=%i\n", *cpi, *as, *lod); }
+#    define store_boot_config(srom, power) DBG("STORING BOOT CONFIG srom=%i, power=%i\n", (int)(srom), (int)(power))
+#    define cli()
+#    define sei()
+static uint8_t boot_srom_version, boot_power_profile;
+
+uint8_t mouse_srom_version(void)
+{
+    return boot_srom_version = 0xff; // no sensor here
+}
+
+uint8_t mouse_power_profile(void)
+{
+    return boot_power_profile = 0xff;
+}
 const char *stname(enum state s)
 {
     switch (s) {
@@ -63,7 +77,13 @@ const char *stname(enum state s)
 }
 #else
 #    include "avr/eeprom.h"
-#    include "atmel_bootloader.h"
+#    include "avr/interrupt.h"
+#    include "power.h"
+#    ifdef SIM
+#        include "sim.h" // run_bootloader
+#    else
+#        include "atmel_bootloader.h"
+#    endif
 #    define DBG(...)
 #    define assert(x)
 #    define stname(...)
@@ -71,16 +91,25 @@ const char *stname(enum state s)
 static uint16_t EEMEM cpi_ee = CPI_DEFAULT;
 static uint8_t  EEMEM as_ee = 0;
 static uint8_t  EEMEM lod_ee = 2;
+static uint8_t  EEMEM srom_ee = SROM_VERSION;
+static uint8_t  EEMEM power_ee = POWER_PROFILE;
 
-void store_config(int16_t cpi, bool as, int8_t lod)
+// waits for the previous write with the interrupts on, then keeps them off
+// from loading EEAR and EEDR to the write strobe
+static void store_byte(uint8_t *p, uint8_t value)
 {
-    eeprom_write_word(&cpi_ee, (uint16_t)cpi);
-    eeprom_busy_wait();
-
-    eeprom_write_byte(&as_ee, (uint8_t)as);
     eeprom_busy_wait();
+    cli();
+    eeprom_write_byte(p, value);
+    sei();
+}
 
-    eeprom_write_byte(&lod_ee, (uint8_t)lod);
+void store_config(int16_t cpi, bool as, int8_t lod)
+{
+    store_byte((uint8_t *)&cpi_ee, (uint16_t)cpi & 0xff);
+    store_byte((uint8_t *)&cpi_ee + 1, (uint16_t)cpi >> 8);
+    store_byte(&as_ee, (uint8_t)as);
+    store_byte(&lod_ee, (uint8_t)lod);
     eeprom_busy_wait();
 }
 
@@ -90,12 +119,50 @@ void load_config(int16_t *cpi, bool *as, int8_t *lod)
     *as  = (bool)eeprom_read_byte(&as_ee);
     *lod = (int8_t)eeprom_read_byte(&lod_ee);
 }
+
+void store_boot_config(uint8_t srom_version, uint8_t power_profile)
+{
+    store_byte(&srom_ee, srom_version);
+    store_byte(&power_ee, power_profile);
+    eeprom_busy_wait();
+}
+
+// the eeprom config read at power-on, or what is about to be stored
+static uint8_t boot_srom_version, boot_power_profile;
+
+// an erased eeprom reads 0xff, which pmw3366_init and power_init replace
+// with the defaults; those are what the settings report then
+uint8_t mouse_srom_version(void)
+{
+    uint8_t v = eeprom_read_byte(&srom_ee);
+    if (v != 3 && v != 5)
+        v = SROM_VERSION;
+    return boot_srom_version = v;
+}
+
+uint8_t mouse_power_profile(void)
+{
+    uint8_t p = eeprom_read_byte(&power_ee);
+    if (p >= POWER_PROFILES)
+        p = POWER_PROFILE;
+    return boot_power_profile = p;
+}
 #endif
 
 static int16_t config_cpi;
 static bool config_as;
 static int8_t config_lod;
 
+// mouse_init loads them at power-on
+static bool config_loaded = false;
+
+// changes for mouse_task to store; the eeprom is only written from there
+#define STORE_PARAMS 1
+#define STORE_BOOT_PARAMS 2
+// then run the bootloader
+#define STORE_RUN_BOOTLOADER 4
+static volatile uint8_t store_pending = 0;
+
 static bool mode_changed(int32_t time, bool left, bool right, bool tracking)
 {
     enum state {
@@ -291,23 +358,22 @@ bool mouse_step(int32_t time, bool left, bool right, bool tracking,
     case POWERON:
         *out_left = *out_right = false;
         if (boot_press_time == -1) {
-            load_config(&config_cpi, &config_as, &config_lod);
             if (left && right) {
                 config_as = false;
                 config_lod = 2;
-                store_config(config_cpi, config_as, config_lod);
+                store_pending |= STORE_PARAMS;
                 boot_press_time = time;
                 ANIMATE(ANIM_SQUARE_INV, ANIMATION_LENGTH_SQUARE, ANIMATION_DURATION_SQUARE, 1, TICKS_FROM_US(1000000), POWERON);
                 state = ANIM_WAIT;
             } else if (left) {
                 config_as = true;
-                store_config(config_cpi, config_as, config_lod);
+                store_pending |= STORE_PARAMS;
                 boot_press_time = time;
                 ANIMATE(ANIM_SQUARE, ANIMATION_LENGTH_SQUARE, ANIMATION_DURATION_SQUARE, 1, TICKS_FROM_US(1000000), POWERON);
                 state = ANIM_WAIT;
             } else if (right) {
                 config_lod = 3;
-                store_config(config_cpi, config_as, config_lod);
+                store_pending |= STORE_PARAMS;
                 boot_press_time = time;
                 ANIMATE(ANIM_SQUARE, ANIMATION_LENGTH_SQUARE, ANIMATION_DURATION_SQUARE, 1, TICKS_FROM_US(1000000), POWERON);
                 state = ANIM_WAIT;
@@ -320,9 +386,7 @@ bool mouse_step(int32_t time, bool left, bool right, bool tracking,
                 config_lod = LOD_DEFAULT;
                 config_as = AS_DEFAULT;
                 config_cpi = CPI_DEFAULT;
-                store_config(config_cpi, config_as, config_lod);
-                DBG("Running bootloader\n");
-                run_bootloader();
+                store_pending |= STORE_PARAMS | STORE_RUN_BOOTLOADER;
             } else if (!left && !right) {
                 state = IDLE;
             }
@@ -338,7 +402,7 @@ bool mouse_step(int32_t time, bool left, bool right, bool tracking,
     case CPI:
         *out_left = *out_right = false;
         if (mode_changed(time, left, right, tracking)) {
-            store_config(config_cpi, config_as, config_lod);
+            store_pending |= STORE_PARAMS;
             ANIMATE(ANIM_SPIKE_RIGHT, ANIMATION_LENGTH_SPIKE_SHORT, ANIMATION_DURATION_SPIKE_INDICATION, config_cpi / 1000, ANIMATION_DURATION_SPIKE_INDICATION,
                     SHOW_CPI_HUNDREDS);
             next_next_state = IDLE;
@@ -487,3 +551,59 @@ void mouse_get_params(int16_t *out_cpi, bool *out_as, int8_t *out_lod)
     *out_as = config_as;
     *out_lod = config_lod;
 }
+
+bool mouse_set_params(int16_t cpi, bool as, int8_t lod)
+{
+    if (!config_loaded || cpi < CPI_MIN || cpi > CPI_MAX || cpi % CPI_SMALL_STEP
+        || lod < 2 || lod > 3)
+        return false;
+    config_cpi = cpi;
+    config_as = as;
+    config_lod = lod;
+    store_pending |= STORE_PARAMS;
+    return true;
+}
+
+void mouse_get_boot_params(uint8_t *out_srom_version, uint8_t *out_power_profile)
+{
+    *out_srom_version = boot_srom_version;
+    *out_power_profile = boot_power_profile;
+}
+
+void mouse_set_boot_params(uint8_t srom_version, uint8_t power_profile)
+{
+    boot_srom_version = srom_version;
+    boot_power_profile = power_profile;
+    store_pending |= STORE_BOOT_PARAMS;
+}
+
+void mouse_init(void)
+{
+    load_config(&config_cpi, &config_as, &config_lod);
+    config_loaded = true;
+}
+
+void mouse_task(void)
+{
+    if (!store_pending)
+        return;
+    // a copy, the interrupts may set the next change meanwhile
+    cli();
+    const uint8_t pending = store_pending;
+    store_pending = 0;
+    const int16_t cpi = config_cpi;
+    const bool as = config_as;
+    const int8_t lod = config_lod;
+    const uint8_t srom_version = boot_srom_version;
+    const uint8_t power_profile = boot_power_profile;
+    sei();
+
+    if (pending & STORE_PARAMS)
+        store_config(cpi, as, lod);
+    if (pending & STORE_BOOT_PARAMS)
+        store_boot_config(srom_version, power_profile);
+    if (pending & STORE_RUN_BOOTLOADER) {
+        DBG("Running bootloader\n");
+        run_bootloader();
+    }
+}
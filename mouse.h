@@ -5,6 +5,12 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+/**
+ * Loads the configuration from the eeprom. Call from main() at power-on,
+ * before the slots and the USB interrupts call into the mouse logic.
+ */
+void mouse_init(void);
+
 /**
  * Performs one step of mouse logic.
  *
@@ -27,4 +33,47 @@ bool mouse_step(int32_t time, bool left, bool right, bool tracking,
                 bool *out_left, bool *out_right, int16_t *out_dx, int16_t *out_dy);
 void mouse_get_params(int16_t *out_cpi, bool *out_as, int8_t *out_lod);
 
+/**
+ * Sets the configuration, as the button UI does, and has mouse_task store
+ * it. Call from interrupt context.
+ *
+ * @return false if a value is out of range or the configuration has not
+ *         been loaded yet by mouse_init, nothing is changed then
+ */
+bool mouse_set_params(int16_t cpi, bool as, int8_t lod);
+
+/**
+ * @param out_srom_version pointer to store the SROM version of the eeprom
+ *        config
+ * @param out_power_profile pointer to store the power profile of the
+ *        eeprom config
+ */
+void mouse_get_boot_params(uint8_t *out_srom_version, uint8_t *out_power_profile);
+
+/**
+ * Sets what mouse_srom_version and mouse_power_profile return from the
+ * next power-on, and has mouse_task store it. Call from interrupt context.
+ */
+void mouse_set_boot_params(uint8_t srom_version, uint8_t power_profile);
+
+/**
+ * Stores the configuration changes of the button UI in mouse_step, of
+ * mouse_set_params and of mouse_set_boot_params in the eeprom, then runs
+ * the bootloader if the button UI asked for it. The only eeprom writer;
+ * call from main(), interrupts enabled.
+ */
+void mouse_task(void);
+
+/**
+ * @return SROM version of the eeprom config, for pmw3366_init; read once
+ *         at power-on; SROM_VERSION if the eeprom holds none
+ */
+uint8_t mouse_srom_version(void);
+
+/**
+ * @return power profile of the eeprom config, for power_init; read once
+ *         at power-on; POWER_PROFILE if the eeprom holds none
+ */
+uint8_t mouse_power_profile(void);
+
 #endif
@@ -0,0 +1,399 @@
+#include "pmw3366.h"
+#include "spi.h"
+#include "sched.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <stddef.h>
+// both images ship, pmw3366_init picks one; SROM_VERSION is the default
+#include "srom_3360_0x03.h"
+#include "srom_3360_0x05.h"
+#if SROM_VERSION != 3 && SROM_VERSION != 5
+#   error bad srom version
+#endif
+
+#define delay_us(t) __builtin_avr_delay_cycles((t) * F_CPU/1000000)
+
+// motion burst: address to first data byte
+#define T_SRAD_MOTBR_US 35
+// write to the next write or read
+#define T_SWW_US 180
+// between the pixels of the raw data burst
+#define T_RAW_US 20
+
+static inline void spi_write(const uint8_t addr, const uint8_t data)
+{
+	spi_send(addr | 0x80);
+	spi_send(data);
+	delay_us(180); // maximum of t_SWW, t_SWR
+}
+
+static inline uint8_t spi_read(const uint8_t addr)
+{
+	spi_send(addr);
+	delay_us(160); // t_SRAD
+	uint8_t data = spi_recv();
+	delay_us(20);
+	return data;
+}
+
+static volatile bool deadline_passed;
+
+ISR(TIMER1_COMPC_vect)
+{
+	TIMSK1 &= ~(1<<OCIE1C);
+	deadline_passed = true;
+}
+
+// sleeps until ms milliseconds have passed, in timer1 deadlines of 1ms; the
+// interrupts, USB enumeration among them, are served meanwhile
+static void sleep_ms(uint16_t ms)
+{
+	for (; ms; --ms) {
+		deadline_passed = false;
+		OCR1C = TCNT1 + F_CPU / 1000;
+		TIFR1 = (1<<OCF1C);
+		TIMSK1 |= (1<<OCIE1C);
+		cli();
+		while (!deadline_passed) {
+			sleep_enable();
+			sei();
+			sleep_cpu();
+			sleep_disable();
+			cli();
+		}
+		sei();
+	}
+}
+
+// configuration registers owned by the firmware, in the order they are
+// written
+enum shadow_reg {
+	CONFIG2,		// 0x20 (g502 default) enables rest mode after ~10s of inactivity
+	RUN_DOWNSHIFT,		// how long to wait before going to rest mode. 0xff is max (~10 seconds)
+	REST1_DOWNSHIFT,
+	REST2_RATE_LOWER,
+	REST2_RATE_UPPER,
+	REST3_RATE_LOWER,
+	REST3_RATE_UPPER,
+	RAW_DATA_THRESHOLD,
+	MIN_SQ_RUN,
+	CONFIG1,		// resolution
+	ANGLE_SNAP,
+	CONTROL,		// 0x60 inverts x,y
+	LIFT_CONFIG,
+	SHADOW_SIZE
+};
+
+static const uint8_t shadow_addr[SHADOW_SIZE] = {
+	0x10, 0x14, 0x17, 0x18, 0x19, 0x1b, 0x1c, 0x2c, 0x2b, 0x0f, 0x42, 0x0d,
+	0x63
+};
+
+// what the registers are or are about to be, CONFIG1 is set by
+// pmw3366_init and LIFT_CONFIG is left at its reset value
+static uint8_t shadow[SHADOW_SIZE] = {
+	0x00, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0x0a, 0x10, 0x00, 0x00, 0x60,
+	0x00
+};
+#ifdef __cplusplus
+static_assert(SHADOW_SIZE == PMW3366_CONFIG_SIZE, "PMW3366_CONFIG_SIZE");
+#else
+_Static_assert(SHADOW_SIZE == PMW3366_CONFIG_SIZE, "PMW3366_CONFIG_SIZE");
+#endif
+// registers whose shadow has not been written yet, bit per shadow_reg
+static uint16_t shadow_dirty = 0;
+// written by pmw3366_init, all but LIFT_CONFIG
+#define SHADOW_INIT ((1 << LIFT_CONFIG) - 1)
+
+// t_SWW/t_SWR of the last runtime write, OCF1C is set once it has passed
+static bool write_settling = false;
+
+static void shadow_set(const uint8_t r, const uint8_t value)
+{
+	if (shadow[r] != value) {
+		shadow[r] = value;
+		shadow_dirty |= 1 << r;
+	}
+}
+
+// all dirty registers with the spi_write delays, NCS low
+static void shadow_flush(void)
+{
+	for (uint8_t r = 0; r < SHADOW_SIZE; r++)
+		if (shadow_dirty & (1 << r))
+			spi_write(shadow_addr[r], shadow[r]);
+	shadow_dirty = 0;
+}
+
+static const uint8_t *srom_image(uint8_t version)
+{
+	if (version != 3 && version != 5)
+		version = SROM_VERSION;
+	return version == 3 ? srom_0x03 : srom_0x05;
+}
+
+// the image picked by pmw3366_init, for the restart after a frame capture
+static const uint8_t *srom;
+// SROM_ID after the download, 0 if it did not take
+static uint8_t srom_id = 0;
+
+// reset, SROM download and the dirty registers of the shadow
+static void power_up(void)
+{
+	const uint8_t *psrom = srom;
+
+	SS_HIGH;
+	sleep_ms(3);
+
+	// shutdown first, in case the sensor kept running through a reset of
+	// the mcu. the power up reset below is the next write, so t_SWW is
+	// all the wait that is needed
+	SS_LOW;
+	spi_write(0x3b, 0xb6);
+	SS_HIGH;
+
+	// drop and raise ncs to reset spi port
+	SS_LOW;
+	delay_us(40);
+	SS_HIGH;
+	delay_us(40);
+
+	// power up reset
+	SS_LOW;
+	spi_write(0x3a, 0x5a);
+	SS_HIGH;
+	sleep_ms(50);
+
+	// read from 0x02 to 0x06
+	SS_LOW;
+	spi_read(0x02);
+	spi_read(0x03);
+	spi_read(0x04);
+	spi_read(0x05);
+	spi_read(0x06);
+
+	spi_write(0x10, 0x00);
+	spi_write(0x22, 0x00);
+
+	// srom download
+	spi_write(0x13, 0x1d);
+	SS_HIGH;
+	sleep_ms(10);
+	SS_LOW;
+	spi_write(0x13, 0x18);
+
+	spi_send(0x62 | 0x80);
+	// queued, so that with a transmit buffer the byte time overlaps the
+	// wait for the next one
+	for (uint16_t i = 0; i < SROM_LENGTH; i++) {
+		delay_us(16);
+		spi_queue(pgm_read_byte(psrom++));
+	}
+	spi_flush();
+	delay_us(18);
+	SS_HIGH;
+	delay_us(200);
+
+	// check srom id
+	SS_LOW;
+	srom_id = spi_read(0x2a);
+
+	// configuration/settings
+	shadow_flush();
+	SS_HIGH;
+}
+
+void pmw3366_init(const uint8_t cpi_val, const uint8_t srom_version)
+{
+	srom = srom_image(srom_version);
+	// the reset leaves all of them at their defaults
+	shadow[CONFIG1] = cpi_val;
+	shadow_dirty = SHADOW_INIT;
+	power_up();
+}
+
+uint8_t pmw3366_srom_id(void)
+{
+	return srom_id;
+}
+
+static bool write_settled(void)
+{
+	if (write_settling && (TIFR1 & (1<<OCF1C)))
+		write_settling = false;
+	return !write_settling;
+}
+
+// the first dirty register, in place of a burst
+static void write_next(void)
+{
+	if (!shadow_dirty)
+		return;
+	uint8_t r = 0;
+	while (!(shadow_dirty & (1 << r)))
+		++r;
+	// NCS stays low, a write needs it for 35us after the data byte and
+	// the next burst is on the same select
+	SS_LOW;
+	spi_send(shadow_addr[r] | 0x80);
+	spi_send(shadow[r]);
+	OCR1C = TCNT1 + T_SWW_US * (F_CPU / 1000000);
+	TIFR1 = (1<<OCF1C);
+	write_settling = true;
+	shadow_dirty &= ~(1 << r);
+}
+
+void pmw3366_set_cpi(int16_t cpi)
+{
+	// CPI_VAL as a multiplication, exact below 43700 cpi: the division is
+	// a library call of a fifth of the slot. shadow_set skips the value
+	// the register already has
+	shadow_set(CONFIG1, (uint8_t)(((uint32_t)cpi * 5243) >> 19) - 1);
+}
+
+void pmw3366_set_mode(bool as, int8_t lod)
+{
+	shadow_set(ANGLE_SNAP, as ? (1 << 7) : 0);
+	shadow_set(LIFT_CONFIG, lod);
+}
+
+void pmw3366_set_rest(uint8_t run_downshift)
+{
+	if (!run_downshift) {
+		shadow_set(CONFIG2, 0x00);
+		return;
+	}
+	shadow_set(CONFIG2, 0x20); // Rest_En
+	shadow_set(RUN_DOWNSHIFT, run_downshift);
+}
+
+void pmw3366_config_save(uint8_t *config)
+{
+	for (uint8_t r = 0; r < SHADOW_SIZE; r++)
+		config[r] = shadow[r];
+}
+
+void pmw3366_config_load(const uint8_t *config)
+{
+	for (uint8_t r = 0; r < SHADOW_SIZE; r++)
+		shadow_set(r, config[r]);
+}
+
+void pmw3366_burst_mode(void)
+{
+	SS_LOW;
+	spi_write(0x50, 0x00);
+	SS_HIGH;
+}
+
+// the burst being read
+static struct pmw3366_burst *burst_current;
+
+bool pmw3366_burst_start(struct pmw3366_burst *burst, bool full)
+{
+	// the burst address counts as a read, t_SWR after a write
+	if (!write_settled())
+		return false;
+	// which would skip the burst right after the write anyway, so the
+	// write goes out instead of it
+	if (shadow_dirty) {
+		write_next();
+		return false;
+	}
+#ifdef PMW3366_BURST_UNGATED
+	full = true;
+#endif
+	burst_current = burst;
+	// SQUAL and the image statistics change slowly, a byte takes 32
+	// cycles of the slot
+	spi_burst_start(0x50, T_SRAD_MOTBR_US * (F_CPU / 1000000),
+			(uint8_t *)burst,
+			full ? sizeof(*burst) : offsetof(struct pmw3366_burst, squal),
+			full ? 0 : (1<<MOTION_MOT));
+	return true;
+}
+
+void pmw3366_burst_wait(const bool block)
+{
+	spi_burst_wait(block);
+}
+
+void pmw3366_suspend(void)
+{
+	// the last burst or write, without the slots there is no interrupt
+	// to sleep until
+	while (spi_burst_busy() || !write_settled())
+		;
+
+	// the shortest way into the rest modes; shutdown would save more,
+	// but lose the SROM
+	SS_LOW;
+	spi_write(0x10, 0x20); // Rest_En
+	spi_write(0x14, 0x01); // Run_Downshift
+	spi_write(0x17, 0x01); // Rest1_Downshift
+	SS_HIGH;
+}
+
+void pmw3366_resume(void)
+{
+	SS_LOW;
+	// run mode right away, the rest modes of the shadow start over from it
+	spi_write(0x10, 0x00);
+	shadow_dirty |= (1 << CONFIG2) | (1 << RUN_DOWNSHIFT)
+		| (1 << REST1_DOWNSHIFT);
+	shadow_flush();
+	SS_HIGH;
+	pmw3366_burst_mode();
+}
+
+void pmw3366_capture_start(uint8_t *squal, uint16_t *shutter)
+{
+	// the slots leave the sensor alone from now on
+	while (spi_burst_busy() || !write_settled())
+		sched_idle();
+
+	SS_LOW;
+	*squal = spi_read(0x07);
+	*shutter = spi_read(0x0c) << 8;
+	*shutter |= spi_read(0x0b);
+	// without rest modes, the shadow has them back with the restart
+	spi_write(0x10, 0x00);
+	spi_write(0x12, 0x83);
+	spi_write(0x12, 0xc5);
+	SS_HIGH;
+	sleep_ms(20);
+
+	SS_LOW;
+	spi_send(0x64);
+	delay_us(160); // t_SRAD
+}
+
+uint8_t pmw3366_capture_pixel(void)
+{
+	const uint8_t pixel = spi_recv();
+	delay_us(T_RAW_US);
+	return pixel;
+}
+
+void pmw3366_capture_end(void)
+{
+	SS_HIGH;
+	// the frame capture leaves the sensor without its SROM
+	shadow_dirty = (1 << SHADOW_SIZE) - 1;
+	power_up();
+	pmw3366_burst_mode();
+}
+
+void spi_burst_done(uint8_t len)
+{
+	// without MOT the deltas are 0, the rest is left from the last full
+	// burst
+	if (len == 1) {
+		burst_current->dx = 0;
+		burst_current->dy = 0;
+	}
+	pmw3366_burst_done();
+}
@@ -0,0 +1,177 @@
+#ifndef _PMW3366_H_INCLUDED_
+#define _PMW3366_H_INCLUDED_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CPI_VAL(cpi) ((cpi) / 100 - 1)
+
+// Motion register bits
+#define MOTION_MOT		7 // motion since the last report
+#define MOTION_LIFT_STAT	3 // lifted off the surface
+
+// the motion burst as it comes off the wire, little endian like the avr.
+// With PMW3366_BURST_EXTENDED it goes on with the image statistics, which
+// are 5 more bytes at 32 cycles each.
+struct pmw3366_burst {
+	uint8_t motion;
+	uint8_t observation;
+	int16_t dx;
+	int16_t dy;
+	uint8_t squal;
+#ifdef PMW3366_BURST_EXTENDED
+	uint8_t raw_data_sum;
+	uint8_t max_raw_data;
+	uint8_t min_raw_data;
+	uint8_t shutter_upper; // big endian on the wire
+	uint8_t shutter_lower;
+#endif
+} __attribute__((packed));
+
+/**
+ * Resets the sensor, uploads the SROM and configures it. Blocking, takes
+ * about 150ms, most of it the SROM upload. Sleeps through the datasheet
+ * waits with interrupts enabled, so call it after usb_init to have the
+ * enumeration done meanwhile. timer1 must be running, see
+ * sched_timebase_init.
+ *
+ * @param cpi_val value of the resolution register, see CPI_VAL
+ * @param srom_version SROM image to upload, 3 or 5; any other value
+ *        (an erased eeprom) uploads SROM_VERSION
+ */
+void pmw3366_init(const uint8_t cpi_val, const uint8_t srom_version);
+
+/**
+ * @return SROM_ID as read back after the last SROM download, the version of
+ *         the running image; 0 if the download failed
+ */
+uint8_t pmw3366_srom_id(void);
+
+/**
+ * Sets the resolution in the register shadow. Changed registers are
+ * written one at a time, each in place of a burst, and the burst that
+ * follows a write is skipped for t_SWR (see pmw3366_burst_start).
+ */
+void pmw3366_set_cpi(int16_t cpi);
+
+/**
+ * Sets angle snapping and lift off distance in the register shadow, like
+ * pmw3366_set_cpi.
+ */
+void pmw3366_set_mode(bool as, int8_t lod);
+
+/**
+ * Sets the rest modes in the register shadow, like pmw3366_set_cpi.
+ *
+ * @param run_downshift still time before the sensor goes from run to rest
+ *        mode, 0xff is ~10s; 0 keeps it in run mode
+ */
+void pmw3366_set_rest(uint8_t run_downshift);
+
+/* size of the shadow of the configuration registers, checked in pmw3366.c */
+#define PMW3366_CONFIG_SIZE 13
+
+/**
+ * Copies the shadow of the configuration registers the firmware owns, the
+ * values they have or are about to get.
+ *
+ * @param config PMW3366_CONFIG_SIZE bytes
+ */
+void pmw3366_config_save(uint8_t *config);
+
+/**
+ * Sets the shadow of the configuration registers from a copy made by
+ * pmw3366_config_save; the registers that change are written like those of
+ * pmw3366_set_cpi. Call from slot context (interrupts disabled), like
+ * pmw3366_set_cpi.
+ *
+ * @param config PMW3366_CONFIG_SIZE bytes
+ */
+void pmw3366_config_load(const uint8_t *config);
+
+/**
+ * Enables motion burst reads, call after pmw3366_init and after reading
+ * any register other than Motion_Burst.
+ */
+void pmw3366_burst_mode(void);
+
+/**
+ * Starts a motion burst read, which runs from the SPI interrupt. Returns
+ * right away, the data is in burst once pmw3366_burst_done() is called.
+ *
+ * Unless full, the burst stops after dy, or after the Motion byte if it has
+ * no MOT: dx and dy are then set to 0. The fields not read keep what the
+ * last burst that went on left in them. PMW3366_BURST_UNGATED makes every
+ * burst full.
+ *
+ * Does nothing and returns false while a register write is still within
+ * t_SWR (180us, less than two slots), and writes the next changed register
+ * of the shadow instead of the burst; the sensor keeps the motion for the
+ * next burst.
+ *
+ * @param burst receives the burst, must stay valid until it is done
+ * @param full read the whole burst even without motion
+ * @return true if the burst was started
+ */
+bool pmw3366_burst_start(struct pmw3366_burst *burst, bool full);
+
+/**
+ * Reads the burst started last right away, if its data is due within about
+ * the cycles of the SPI interrupt that would read it otherwise (see
+ * spi_burst_wait). pmw3366_burst_done() is then called before it returns.
+ * Call from the context that started the burst, once the work during its
+ * wait is done.
+ *
+ * @param block read it from here in any case, without letting another
+ *        interrupt in before it is done
+ */
+void pmw3366_burst_wait(bool block);
+
+/**
+ * Puts the sensor to rest for a USB suspend, down to Rest2 within ~100ms.
+ * Unlike shutdown this keeps the SROM, so that it tracks again
+ * right after pmw3366_resume. Blocking, call from main() with the slots
+ * stopped, see sched_stop.
+ */
+void pmw3366_suspend(void);
+
+/**
+ * Back to run mode after pmw3366_suspend, with the rest modes of the
+ * register shadow; a burst read right after it has the motion. Blocking
+ * for a few register writes; call before the slots start again.
+ */
+void pmw3366_resume(void);
+
+/**
+ * Starts a frame capture (see capture.h): waits for the burst and the
+ * register write in progress, reads SQUAL and Shutter, then has the sensor
+ * take a frame, which takes 20ms. The motion burst stops working until
+ * pmw3366_capture_end, pmw3366_burst_start must not be called. Blocking,
+ * call from main().
+ *
+ * @param squal receives SQUAL before the capture
+ * @param shutter receives Shutter before the capture
+ */
+void pmw3366_capture_start(uint8_t *squal, uint16_t *shutter);
+
+/**
+ * @return next pixel of the frame, 36x36 in all, row by row
+ */
+uint8_t pmw3366_capture_pixel(void);
+
+/**
+ * Ends a frame capture, also one that was cut off, and gets the sensor to
+ * track again: reset, SROM and the configuration of the register shadow,
+ * like pmw3366_init, then burst mode. Blocking, ~150ms.
+ */
+void pmw3366_capture_end(void);
+
+/**
+ * End of a motion burst read, implemented by the application.
+ *
+ * Called from interrupt context (interrupts disabled), NCS is high again.
+ * Register changes made in it go out in place of the next burst.
+ */
+void pmw3366_burst_done(void);
+
+#endif /* _PMW3366_H_INCLUDED_ */
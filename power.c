@@ -0,0 +1,74 @@
+#include "power.h"
+#include "pmw3366.h"
+
+#define SLOTS_FROM_MS(ms) ((ms) * 8)
+
+struct profile {
+	// still time before each halving of the burst rate, 0 for never
+	uint16_t downshift[3];
+	// Run_Downshift of the sensor, 0 leaves rest modes off
+	uint8_t run_downshift;
+};
+
+static const struct profile profiles[POWER_PROFILES] = {
+	[POWER_FULL] = {
+		.downshift = {0, 0, 0},
+		.run_downshift = 0,
+	},
+	[POWER_BALANCED] = {
+		.downshift = {SLOTS_FROM_MS(100), SLOTS_FROM_MS(500), SLOTS_FROM_MS(2000)},
+		.run_downshift = 0xff, // ~10s
+	},
+	[POWER_SAVER] = {
+		.downshift = {SLOTS_FROM_MS(20), SLOTS_FROM_MS(100), SLOTS_FROM_MS(500)},
+		.run_downshift = 0x19, // ~1s
+	},
+};
+
+static const struct profile *profile = &profiles[POWER_PROFILE];
+
+// slots since the last activity, saturating
+static uint16_t still = 0;
+// the burst rate is 8 kHz >> shift
+static uint8_t shift = 0;
+
+void power_init(uint8_t p)
+{
+	if (p >= POWER_PROFILES)
+		p = POWER_PROFILE;
+	profile = &profiles[p];
+	pmw3366_set_rest(profile->run_downshift);
+}
+
+uint8_t power_current(void)
+{
+	return profile - profiles;
+}
+
+bool power_sample(const uint8_t slot, const bool edge)
+{
+	if (edge) {
+		still = 0;
+		shift = 0;
+	}
+	return !(slot & ((1 << shift) - 1));
+}
+
+void power_slot_done(const bool active)
+{
+	if (active) {
+		still = 0;
+		shift = 0;
+		return;
+	}
+	if (still < UINT16_MAX)
+		++still;
+	if (shift < 3 && profile->downshift[shift]
+			&& still >= profile->downshift[shift])
+		++shift;
+}
+
+uint8_t power_rate_shift(void)
+{
+	return shift;
+}
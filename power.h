@@ -0,0 +1,63 @@
+#ifndef _POWER_H_INCLUDED_
+#define _POWER_H_INCLUDED_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Power profiles: how often the sensor is read while the mouse lies still
+ * and whether the sensor may go to its rest modes.
+ *
+ * The adaptive profiles halve the burst rate from 8 kHz down to 1 kHz in
+ * steps after the mouse has been still for a while. Motion seen in a burst
+ * goes back to 8 kHz from the next slot on, an edge on any button contact
+ * from the very slot it is seen in. Buttons are read every slot in all
+ * profiles. sim/power.cpp measures wake latency, snap-back and duty cycle
+ * of each.
+ */
+enum power_profile {
+	POWER_FULL,	// 8 kHz, sensor rest modes off
+	POWER_BALANCED,	// 4/2/1 kHz after 100ms/500ms/2s, sensor rest after ~10s
+	POWER_SAVER,	// 4/2/1 kHz after 20/100/500ms, sensor rest after ~1s
+	POWER_PROFILES
+};
+
+// of the default eeprom config, and for unknown values
+#ifndef POWER_PROFILE
+#define POWER_PROFILE POWER_FULL
+#endif
+
+/**
+ * Selects the profile and sets up the sensor rest modes for it. Call
+ * before pmw3366_init.
+ *
+ * @param profile enum power_profile, others select POWER_PROFILE
+ */
+void power_init(uint8_t profile);
+
+/**
+ * @return the selected profile, enum power_profile
+ */
+uint8_t power_current(void);
+
+/**
+ * @param slot index of the slot within the frame
+ * @param edge a button contact changed since the last slot, or the slot
+ * before was active, see power_slot_done
+ * @return true if the slot reads the sensor
+ */
+bool power_sample(uint8_t slot, bool edge);
+
+/**
+ * End of a slot.
+ *
+ * @param active the slot saw motion or a change of the buttons
+ */
+void power_slot_done(bool active);
+
+/**
+ * @return log2 of 8 kHz over the current burst rate, 0..3
+ */
+uint8_t power_rate_shift(void);
+
+#endif /* _POWER_H_INCLUDED_ */
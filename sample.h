@@ -0,0 +1,51 @@
+#ifndef _SAMPLE_H_INCLUDED_
+#define _SAMPLE_H_INCLUDED_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pmw3366.h"
+
+/*
+ * What the sensor said in one slot. The fields past dx/dy are those of the
+ * extended burst, see PMW3366_BURST_EXTENDED. Slots without a burst (see
+ * pmw3366_burst_start) have no motion and keep the rest of the previous
+ * sample.
+ */
+struct sample {
+	uint8_t motion;		// Motion register, see MOTION_*
+	uint8_t squal;		// surface quality
+	int16_t dx;
+	int16_t dy;
+#ifdef PMW3366_BURST_EXTENDED
+	uint8_t raw_data_sum;	// average pixel value, scaled
+	uint8_t max_raw_data;
+	uint8_t min_raw_data;
+	uint16_t shutter;	// exposure time, goes up on dark surfaces
+#endif
+};
+
+static inline void sample_from_burst(struct sample *s,
+		const struct pmw3366_burst *b)
+{
+	s->motion = b->motion;
+	s->squal = b->squal;
+	s->dx = b->dx;
+	s->dy = b->dy;
+#ifdef PMW3366_BURST_EXTENDED
+	s->raw_data_sum = b->raw_data_sum;
+	s->max_raw_data = b->max_raw_data;
+	s->min_raw_data = b->min_raw_data;
+	s->shutter = (uint16_t)b->shutter_upper << 8 | b->shutter_lower;
+#endif
+}
+
+/**
+ * @return true if the sensor is on a surface it can track
+ */
+static inline bool sample_tracking(const struct sample *s)
+{
+	return s->squal >= 16 && !(s->motion & (1<<MOTION_LIFT_STAT));
+}
+
+#endif /* _SAMPLE_H_INCLUDED_ */
@@ -0,0 +1,328 @@
+#include "sched.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <stdbool.h>
+
+volatile uint16_t sched_overruns = 0;
+
+// index of the slot dispatched last; SCHED_SLOTS until the first SOF
+static uint8_t slot = SCHED_SLOTS;
+
+// the work of the current slot goes on after slot_task returned
+static volatile bool slot_deferred = false;
+// in slot_task, which may also end a deferred slot itself
+static bool slot_in_task = false;
+
+// filtered SOF to SOF period in 1/16 cycles of timer1
+static uint32_t sof_period16 = 16UL * (F_CPU / 1000);
+// timer1 at the previous SOF
+static uint16_t sof_prev;
+static bool sof_seen = false;
+
+uint32_t sched_sof_period(void)
+{
+	return sof_period16;
+}
+
+// a SOF interrupt later than predicted by more than the drift of a frame
+// was held up by another interrupt, or by slot 7 running over; up to most
+// of a slot, beyond that the SOF itself was lost or late
+#define SOF_DRIFT 16
+#define SOF_HELD_MAX 800
+
+// measures the SOF period against timer1 to track the crystal drift
+// between host and device; returns the timer1 stamp of this SOF, and in
+// held how much later than that its interrupt came
+static uint16_t sof_stamp(uint16_t *held)
+{
+	const uint16_t now = TCNT1;
+	const uint16_t expected = (sof_period16 + 8) >> 4;
+	const int16_t error = (uint16_t)(now - sof_prev) - expected;
+	*held = 0;
+	// ignore missed SOFs and the very first one
+	if (sof_seen && error > -(int16_t)(expected / 64)
+			&& error < SOF_HELD_MAX) {
+		// the SOF came within the drift, the interrupt only later: a
+		// late stamp would put the slots late, and with them slot 7
+		// over the next SOF again
+		if (error > SOF_DRIFT)
+			*held = error - SOF_DRIFT;
+		sof_period16 += error - (int16_t)*held;
+	}
+	sof_prev = now - *held;
+	sof_seen = true;
+	return sof_prev;
+}
+
+// cycles from the SOF to the start of sched_sof: interrupt response,
+// USB_GEN_vect prologue and the UDINT check
+#define SOF_LATENCY 24
+
+#ifndef LATE_LATCH_US
+
+static void slot_end(void)
+{
+	// OCF0A is cleared when the vector is taken, so if it is set again
+	// the next slot was due before this one finished
+	if (TIFR0 & (1<<OCF0A))
+		++sched_overruns;
+}
+
+static inline void dispatch(const uint8_t s)
+{
+	// the index follows the clock even if the slot is lost, or a lost
+	// slot 0 would hold back the timer0 slots of its frame
+	slot = s;
+	if (slot_deferred) {
+		// the previous slot is still at work, this one is lost
+		++sched_overruns;
+		return;
+	}
+	slot_in_task = true;
+	slot_task(s);
+	slot_in_task = false;
+	if (!slot_deferred)
+		slot_end();
+}
+
+static void timer_init(void)
+{
+	// timer0 generates a compare match every 125us
+	PRR0 &= ~(1<<PRTIM0);
+	TCCR0A = 0x02; // CTC
+	TCCR0B = 0x02; // prescaler 1/8 = 1us period
+	OCR0A = 124; // = 125 - 1
+	TIFR0 = (1<<OCF0A);
+	TIMSK0 = (1<<OCIE0A);
+}
+
+void sched_sof(void)
+{
+	// restart timer0 so that slots 1..7 are phase locked to the frame:
+	// first, and counting from the SOF, or slot 7 would lose the latency
+	// to the next one; a tick short, so that the 8th compare match is
+	// still after the next SOF
+	GTCCR |= (1<<PSRSYNC);
+	TCNT0 = SOF_LATENCY / 8 - 1;
+	TIFR0 = (1<<OCF0A); // OCF0A is cleared by writing 1
+	// then forward by the time the interrupt was held up, 100 ticks at
+	// most, which is still short of the compare match
+	uint16_t held;
+	sof_stamp(&held);
+	if (held)
+		TCNT0 = TCNT0 + held / 8;
+	dispatch(0);
+}
+
+ISR(TIMER0_COMPA_vect)
+{
+	// the 8th compare match coincides with the next SOF, which starts
+	// slot 0 itself
+	if (slot < SCHED_SLOTS - 1)
+		dispatch(slot + 1);
+}
+
+#else /* LATE_LATCH_US */
+
+/*
+ * Late latch: instead of starting slot 0 at the SOF, all slots are shifted
+ * so that slot 7 - the last burst read and endpoint fill before the host
+ * polls at the start of the next frame - finishes LATE_LATCH_US before the
+ * next SOF. Slots are timed with timer1 compare A relative to the measured
+ * SOF and keep running on the predicted frame timing if a SOF is missed.
+ */
+
+#define LATCH_LEAD (LATE_LATCH_US * (F_CPU / 1000000))
+// never schedule a slot closer than this to the point it is scheduled from
+#define LATCH_MIN_PHASE 64
+// cycles of slot 7 after its duration is taken in slot_next: the rest of
+// slot_next, the register restore and the RETI of the interrupt
+#define LATCH_EXIT 80
+
+// timer1 at the start of the frame the next slot belongs to
+static uint16_t frame_start;
+// timer1 at the SOF of the next frame, if it came before slot 7 was done
+static uint16_t next_frame_start;
+static bool next_frame_seen = false;
+// offset of slot 0 from the SOF
+static uint16_t phase = LATCH_MIN_PHASE;
+// filtered duration of slot 7 in cycles, from the compare match to the end
+// of the work, including the interrupt response
+static uint16_t latch_work = 0;
+
+static void timer_init(void)
+{
+	// compare A is enabled by the first SOF; compare B and C belong to
+	// the SPI burst and the sensor delays
+	TIMSK1 &= ~(1<<OCIE1A);
+}
+
+static uint16_t slot_due(const uint8_t s)
+{
+	const uint16_t period = sof_period16 >> 4;
+	return frame_start + phase + (uint16_t)(((uint32_t)s * period) >> 3);
+}
+
+static void update_phase(void)
+{
+	const uint16_t period = sof_period16 >> 4;
+	// slot 7 starts at phase + 7/8 period and must end LATCH_LEAD before
+	// the next SOF at 8/8 period
+	int16_t p = (int16_t)(period >> 3) - LATCH_LEAD - LATCH_EXIT
+		- latch_work;
+	if (p < LATCH_MIN_PHASE)
+		p = LATCH_MIN_PHASE;
+	phase = p;
+}
+
+void sched_sof(void)
+{
+	uint16_t held;
+	const uint16_t now = sof_stamp(&held) - SOF_LATENCY;
+	if (slot == SCHED_SLOTS) {
+		// first SOF, start the slots
+		frame_start = now;
+		slot = 0;
+		OCR1A = slot_due(0);
+		TIFR1 = (1<<OCF1A);
+		TIMSK1 |= (1<<OCIE1A);
+	} else if (slot == 0) {
+		// waiting for slot 0 of this frame: re-anchor to the real SOF
+		frame_start = now;
+		OCR1A = slot_due(0);
+	} else {
+		// still in the slots of the previous frame
+		next_frame_start = now;
+		next_frame_seen = true;
+	}
+}
+
+// compare match of the current slot
+static uint16_t slot_start;
+
+// returns true if the next slot is already due
+static bool slot_next(void)
+{
+	const uint8_t s = slot;
+	if (s == SCHED_SLOTS - 1) {
+		const uint16_t work = TCNT1 - slot_start;
+		// follow increases at once, decreases slowly
+		if (work > latch_work)
+			latch_work = work;
+		else
+			latch_work -= (latch_work - work) >> 4;
+		update_phase();
+		if (next_frame_seen)
+			frame_start = next_frame_start;
+		else
+			frame_start += sof_period16 >> 4;
+		next_frame_seen = false;
+		slot = 0;
+	} else {
+		slot = s + 1;
+	}
+	const uint16_t due = slot_due(slot);
+	OCR1A = due;
+	return (int16_t)(due - TCNT1) <= 0;
+}
+
+static void run_slots(void)
+{
+	for (;;) {
+		slot_start = OCR1A;
+		slot_in_task = true;
+		slot_task(slot);
+		slot_in_task = false;
+		if (slot_deferred || !slot_next())
+			break;
+		// the next slot is already due, run it right away
+		++sched_overruns;
+	}
+}
+
+static void slot_end(void)
+{
+	if (!slot_next())
+		return;
+	++sched_overruns;
+	run_slots();
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+	// a SOF moved the compare match while the slot was deferred, the
+	// slot continues from slot_end
+	if (slot_deferred)
+		return;
+	run_slots();
+}
+
+#endif /* LATE_LATCH_US */
+
+void sched_slot_defer(void)
+{
+	slot_deferred = true;
+}
+
+void sched_slot_done(void)
+{
+	slot_deferred = false;
+	// else the slot ends once slot_task returns
+	if (!slot_in_task)
+		slot_end();
+}
+
+void sched_timebase_init(void)
+{
+	// timer1 runs free at the cpu clock, as timebase for the SOF period
+	PRR0 &= ~(1<<PRTIM1);
+	TCCR1A = 0x00;
+	TCCR1B = 0x01;
+}
+
+void sched_init(void)
+{
+	sched_timebase_init();
+
+	timer_init();
+
+	set_sleep_mode(SLEEP_MODE_IDLE);
+
+	// slot 0 is started by the USB start of frame; the flag of a SOF from
+	// before would start it late and the next SOF would cut the frame short
+	UDINT = ~(1<<SOFI);
+	UDIEN |= (1<<SOFE);
+}
+
+void sched_stop(void)
+{
+	// the slot at work ends first, its burst and report included
+	for (;;) {
+		cli();
+		if (!slot_deferred)
+			break;
+		sched_idle();
+	}
+	UDIEN &= ~(1<<SOFE);
+#ifdef LATE_LATCH_US
+	TIMSK1 &= ~(1<<OCIE1A);
+	next_frame_seen = false;
+#else
+	TIMSK0 = 0;
+#endif
+	slot = SCHED_SLOTS;
+	// the first SOF after the restart does not measure a period
+	sof_seen = false;
+	sei();
+}
+
+void sched_idle(void)
+{
+	cli();
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+}
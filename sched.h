@@ -0,0 +1,78 @@
+#ifndef _SCHED_H_INCLUDED_
+#define _SCHED_H_INCLUDED_
+
+#include <stdint.h>
+
+/* number of 125us slots per 1ms USB frame */
+#define SCHED_SLOTS 8
+
+/**
+ * Per-slot work, implemented by the application.
+ *
+ * Called from interrupt context (interrupts disabled) at the start of every
+ * slot: slot 0 from the USB start-of-frame interrupt, slots 1..7 from the
+ * timer0 compare match interrupt.
+ *
+ * If LATE_LATCH_US is defined, all slots are instead started by timer1 and
+ * shifted so that slot 7 finishes LATE_LATCH_US before the next SOF.
+ *
+ * @param slot index of the slot within the current USB frame
+ */
+void slot_task(uint8_t slot);
+
+/**
+ * Lets the work of the current slot go on after slot_task returns, for
+ * example in a transfer complete interrupt. Call from slot_task; the slot
+ * ends with sched_slot_done. Slots that come due before that are skipped
+ * and counted as overruns.
+ */
+void sched_slot_defer(void);
+
+/**
+ * Ends a slot deferred with sched_slot_defer. Call from interrupt context,
+ * or from slot_task itself if the work is done before it returns.
+ */
+void sched_slot_done(void);
+
+/**
+ * Starts timer1 free running at the cpu clock, the timebase of the slots,
+ * the SPI burst and the sensor deadlines. Done by sched_init; call it
+ * earlier for the deadlines of the boot.
+ */
+void sched_timebase_init(void);
+
+/**
+ * Sets up the slot timers and the start-of-frame interrupt. Slots are
+ * dispatched from the first SOF after this call. Also starts them again
+ * after sched_stop.
+ */
+void sched_init(void);
+
+/**
+ * Stops the slots, for a USB suspend: waits for the work of the slot in
+ * progress, then no slot is dispatched until sched_init. Call from main().
+ */
+void sched_stop(void);
+
+/**
+ * Start of frame handler, called from USB_GEN_vect.
+ */
+void sched_sof(void);
+
+/**
+ * @return SOF to SOF period measured against the cpu clock, filtered, in
+ *         1/16 cycles; deviates from 16 * F_CPU/1000 by the crystal drift
+ *         between host and device
+ */
+uint32_t sched_sof_period(void);
+
+/**
+ * Puts the MCU to idle sleep until the next interrupt. Call in a loop from
+ * main() after any background work.
+ */
+void sched_idle(void);
+
+/* number of slots whose work did not finish before the next slot was due */
+extern volatile uint16_t sched_overruns;
+
+#endif /* _SCHED_H_INCLUDED_ */
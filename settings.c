@@ -0,0 +1,54 @@
+#include "settings.h"
+#include "mouse.h"
+#include "pmw3366.h"
+#include "power.h"
+#include "usb_mouse.h"
+
+#include <string.h>
+
+uint8_t settings_get_report(const uint8_t id, uint8_t *report)
+{
+	if (id == SETTINGS_REPORT_CONFIG) {
+		int16_t cpi;
+		bool as;
+		int8_t lod;
+		struct settings_config c;
+		mouse_get_params(&cpi, &as, &lod);
+		mouse_get_boot_params(&c.srom_version, &c.power_profile);
+		c.report_id = id;
+		c.cpi = cpi;
+		c.angle_snap = as;
+		c.lod = lod;
+		memcpy(report, &c, sizeof(c));
+		return sizeof(c);
+	}
+	if (id == SETTINGS_REPORT_INFO) {
+		struct settings_info i;
+		i.report_id = id;
+		i.version = DEVICE_VERSION;
+		i.srom_id = pmw3366_srom_id();
+		i.power_profile = power_current();
+		memcpy(report, &i, sizeof(i));
+		return sizeof(i);
+	}
+	return 0;
+}
+
+bool settings_set_report(const uint8_t id, const uint8_t *report,
+		const uint8_t len)
+{
+	struct settings_config c;
+	if (id != SETTINGS_REPORT_CONFIG || len != sizeof(c)
+	    || report[0] != id)
+		return false;
+	memcpy(&c, report, sizeof(c));
+	if (c.angle_snap > 1
+	    || (c.srom_version != 3 && c.srom_version != 5)
+	    || c.power_profile >= POWER_PROFILES)
+		return false;
+	// checks the rest
+	if (c.cpi > INT16_MAX || !mouse_set_params(c.cpi, c.angle_snap, c.lod))
+		return false;
+	mouse_set_boot_params(c.srom_version, c.power_profile);
+	return true;
+}
@@ -0,0 +1,68 @@
+#ifndef _SETTINGS_H_INCLUDED_
+#define _SETTINGS_H_INCLUDED_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Settings: the configuration of the button UI, set and read by the host
+ * without the cursor animations, and what the firmware runs.
+ *
+ * A vendor defined HID interface, SETTINGS_INTERFACE, with feature reports
+ * only; the host needs no driver, on Linux it is a hidraw node. A
+ * SET_REPORT of SETTINGS_REPORT_CONFIG sets all fields at once, or none if
+ * one is out of range (the request stalls then). CPI, angle snapping and
+ * lift off distance take effect within a frame, the SROM version and power
+ * profile at the next power-on; all of them are stored in the eeprom. The
+ * interrupt IN endpoint is only there because HID requires one, it sends
+ * nothing. tools/m1kctl is the command line client.
+ */
+
+#define SETTINGS_INTERFACE	2
+#define SETTINGS_ENDPOINT	2
+#define SETTINGS_SIZE		8
+
+// feature report ids
+#define SETTINGS_REPORT_CONFIG	1	// get and set
+#define SETTINGS_REPORT_INFO	2	// get
+
+struct settings_config {
+	uint8_t report_id;	// SETTINGS_REPORT_CONFIG
+	uint16_t cpi;		// 100 to 12000 in steps of 100, little endian
+	uint8_t angle_snap;	// 0 or 1
+	uint8_t lod;		// lift off distance, 2 or 3 mm
+	uint8_t srom_version;	// 3 or 5, from the next power-on
+	uint8_t power_profile;	// see power.h, from the next power-on
+} __attribute__((packed));
+
+struct settings_info {
+	uint8_t report_id;	// SETTINGS_REPORT_INFO
+	uint16_t version;	// firmware version, bcdDevice
+	uint8_t srom_id;	// of the running SROM, 0 if the upload failed
+	uint8_t power_profile;	// running
+} __attribute__((packed));
+
+/* size of the largest report */
+#define SETTINGS_REPORT_SIZE	sizeof(struct settings_config)
+
+/**
+ * Handles a GET_REPORT of a feature report, from the USB interrupt.
+ *
+ * @param id report id
+ * @param report receives the report, SETTINGS_REPORT_SIZE bytes
+ * @return length of the report, 0 for an unknown id
+ */
+uint8_t settings_get_report(uint8_t id, uint8_t *report);
+
+/**
+ * Handles a SET_REPORT of a feature report, from the USB interrupt.
+ *
+ * @param id report id
+ * @param report the report, the id in its first byte
+ * @param len length of the report
+ * @return false if the report is unknown, short or has a value out of
+ *         range, nothing is changed then
+ */
+bool settings_set_report(uint8_t id, const uint8_t *report, uint8_t len);
+
+#endif /* _SETTINGS_H_INCLUDED_ */
@@ -0,0 +1,23 @@
+#ifndef SIM_AVR_EEPROM_H
+#define SIM_AVR_EEPROM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* EEMEM variables live in host memory, in a section of their own so that
+ * the emulator can get at them as a whole, see sim_eeprom_data() */
+#define EEMEM __attribute__((section("sim_eeprom"), used))
+
+bool eeprom_is_ready(void);
+void eeprom_busy_wait(void);
+uint8_t eeprom_read_byte(const uint8_t *p);
+uint16_t eeprom_read_word(const uint16_t *p);
+void eeprom_read_block(void *dst, const void *src, size_t n);
+void eeprom_write_byte(uint8_t *p, uint8_t value);
+void eeprom_write_word(uint16_t *p, uint16_t value);
+void eeprom_write_block(const void *src, void *dst, size_t n);
+void eeprom_update_byte(uint8_t *p, uint8_t value);
+void eeprom_update_word(uint16_t *p, uint16_t value);
+void eeprom_update_block(const void *src, void *dst, size_t n);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+#define sei() (SREG |= _BV(SREG_I))
+#define cli() (SREG &= (uint8_t)~_BV(SREG_I))
+
+/* vectors are plain functions called by sim_dispatch() */
+#define ISR(vector, ...) void vector(void)
+
+#endif
@@ -0,0 +1,230 @@
+/* ATmega32U2 register definitions for the host build, see sim/sim.h.
+ * Addresses are data space addresses as in <avr/iom32u2.h>. */
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include <stdint.h>
+#include "sim.h"
+
+#define _BV(bit) (1 << (bit))
+
+/* sim.cpp redefines these to get at the plain addresses */
+#ifndef SIM_REG
+#define SIM_REG(addr)	(sim_reg(addr))
+#define SIM_REG16(addr)	(sim_reg16(addr))
+#endif
+
+/* ports */
+#define PINB	SIM_REG(0x23)
+#define DDRB	SIM_REG(0x24)
+#define PORTB	SIM_REG(0x25)
+#define PINC	SIM_REG(0x26)
+#define DDRC	SIM_REG(0x27)
+#define PORTC	SIM_REG(0x28)
+#define PIND	SIM_REG(0x29)
+#define DDRD	SIM_REG(0x2A)
+#define PORTD	SIM_REG(0x2B)
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PC7 7
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+/* timers */
+#define TIFR0	SIM_REG(0x35)
+#define TOV0	0
+#define OCF0A	1
+#define OCF0B	2
+#define TIFR1	SIM_REG(0x36)
+#define TOV1	0
+#define OCF1A	1
+#define OCF1B	2
+#define OCF1C	3
+#define ICF1	5
+#define GTCCR	SIM_REG(0x43)
+#define PSRSYNC	0
+#define TSM	7
+#define TCCR0A	SIM_REG(0x44)
+#define TCCR0B	SIM_REG(0x45)
+#define TCNT0	SIM_REG(0x46)
+#define OCR0A	SIM_REG(0x47)
+#define OCR0B	SIM_REG(0x48)
+#define TIMSK0	SIM_REG(0x6E)
+#define TOIE0	0
+#define OCIE0A	1
+#define OCIE0B	2
+#define TIMSK1	SIM_REG(0x6F)
+#define TOIE1	0
+#define OCIE1A	1
+#define OCIE1B	2
+#define OCIE1C	3
+#define ICIE1	5
+#define TCCR1A	SIM_REG(0x80)
+#define TCCR1B	SIM_REG(0x81)
+#define TCCR1C	SIM_REG(0x82)
+#define TCNT1	SIM_REG16(0x84)
+#define ICR1	SIM_REG16(0x86)
+#define OCR1A	SIM_REG16(0x88)
+#define OCR1B	SIM_REG16(0x8A)
+#define OCR1C	SIM_REG16(0x8C)
+
+/* external interrupts */
+#define EIFR	SIM_REG(0x3C)
+#define EIMSK	SIM_REG(0x3D)
+#define EICRA	SIM_REG(0x69)
+#define EICRB	SIM_REG(0x6A)
+
+/* eeprom */
+#define EECR	SIM_REG(0x3F)
+#define EEDR	SIM_REG(0x40)
+
+/* spi */
+#define SPCR	SIM_REG(0x4C)
+#define SPR0	0
+#define SPR1	1
+#define CPHA	2
+#define CPOL	3
+#define MSTR	4
+#define DORD	5
+#define SPE	6
+#define SPIE	7
+#define SPSR	SIM_REG(0x4D)
+#define SPI2X	0
+#define WCOL	6
+#define SPIF	7
+#define SPDR	SIM_REG(0x4E)
+
+/* system */
+#define ACSR	SIM_REG(0x50)
+#define ACD	7
+#define SMCR	SIM_REG(0x53)
+#define SE	0
+#define SM0	1
+#define SM1	2
+#define SM2	3
+#define MCUSR	SIM_REG(0x54)
+#define MCUCR	SIM_REG(0x55)
+#define SREG	SIM_REG(0x5F)
+#define SREG_I	7
+#define WDTCSR	SIM_REG(0x60)
+#define CLKPR	SIM_REG(0x61)
+#define PRR0	SIM_REG(0x64)
+#define PRSPI	2
+#define PRTIM1	3
+#define PRTIM0	5
+#define PRR1	SIM_REG(0x65)
+#define PRUSART1 0
+#define PRUSB	7
+
+/* usart1 */
+#define UCSR1A	SIM_REG(0xC8)
+#define DOR1	3
+#define UDRE1	5
+#define TXC1	6
+#define RXC1	7
+#define UCSR1B	SIM_REG(0xC9)
+#define TXEN1	3
+#define RXEN1	4
+#define UDRIE1	5
+#define TXCIE1	6
+#define RXCIE1	7
+#define UCSR1C	SIM_REG(0xCA)
+#define UCPOL1	0
+#define UCPHA1	1
+#define UDORD1	2
+#define UMSEL10	6
+#define UMSEL11	7
+#define UBRR1	SIM_REG16(0xCC)
+#define UDR1	SIM_REG(0xCE)
+
+/* usb */
+#define PLLCSR	SIM_REG(0x49)
+#define PLOCK	0
+#define PLLE	1
+#define USBCON	SIM_REG(0xD8)
+#define FRZCLK	5
+#define USBE	7
+#define UDCON	SIM_REG(0xE0)
+#define DETACH	0
+#define RMWKUP	1
+#define UDINT	SIM_REG(0xE1)
+#define SUSPI	0
+#define SOFI	2
+#define EORSTI	3
+#define WAKEUPI	4
+#define EORSMI	5
+#define UPRSMI	6
+#define UDIEN	SIM_REG(0xE2)
+#define SUSPE	0
+#define SOFE	2
+#define EORSTE	3
+#define WAKEUPE	4
+#define EORSME	5
+#define UPRSME	6
+#define UDADDR	SIM_REG(0xE3)
+#define ADDEN	7
+#define UDFNUML	SIM_REG(0xE4)
+#define UDFNUMH	SIM_REG(0xE5)
+#define UDFNUM	SIM_REG16(0xE4)
+#define UDMFN	SIM_REG(0xE6)
+#define UEINTX	SIM_REG(0xE8)
+#define TXINI	0
+#define STALLEDI 1
+#define RXOUTI	2
+#define KILLBK	2
+#define RXSTPI	3
+#define NAKOUTI	4
+#define RWAL	5
+#define NAKINI	6
+#define FIFOCON	7
+#define UENUM	SIM_REG(0xE9)
+#define UERST	SIM_REG(0xEA)
+#define UECONX	SIM_REG(0xEB)
+#define EPEN	0
+#define RSTDT	3
+#define STALLRQC 4
+#define STALLRQ	5
+#define UECFG0X	SIM_REG(0xEC)
+#define UECFG1X	SIM_REG(0xED)
+#define UESTA0X	SIM_REG(0xEE)
+#define NBUSYBK0 0
+#define NBUSYBK1 1
+#define CFGOK	7
+#define UESTA1X	SIM_REG(0xEF)
+#define CURRBK0	0
+#define CURRBK1	1
+#define CTRLDIR	2
+#define UEIENX	SIM_REG(0xF0)
+#define TXINE	0
+#define STALLEDE 1
+#define RXOUTE	2
+#define RXSTPE	3
+#define NAKOUTE	4
+#define NAKINE	6
+#define UEDATX	SIM_REG(0xF1)
+#define UEBCLX	SIM_REG(0xF2)
+#define UEINT	SIM_REG(0xF4)
+
+/* builtins that only exist in avr-gcc */
+#define __builtin_avr_delay_cycles(n) sim_delay_cycles(n)
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef SIM_AVR_PGMSPACE_H
+#define SIM_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+#include "sim.h"
+
+/* flash is host memory, reads cost the lpm cycles */
+#define PROGMEM
+#define PSTR(s) (s)
+
+static inline uint8_t pgm_read_byte(const void *p)
+{
+	sim_delay_cycles(SIM_LPM_CYCLES);
+	return *(const uint8_t *)p;
+}
+
+static inline uint16_t pgm_read_word(const void *p)
+{
+	uint16_t v;
+	sim_delay_cycles(2 * SIM_LPM_CYCLES);
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t pgm_read_dword(const void *p)
+{
+	uint32_t v;
+	sim_delay_cycles(4 * SIM_LPM_CYCLES);
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+#define pgm_read_ptr(p) sim_pgm_read_ptr(p)
+static inline const void *sim_pgm_read_ptr(const void *p)
+{
+	const void *v;
+	sim_delay_cycles(2 * SIM_LPM_CYCLES);
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline void *memcpy_P(void *dst, const void *src, size_t n)
+{
+	sim_delay_cycles(n * SIM_LPM_CYCLES);
+	return memcpy(dst, src, n);
+}
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef SIM_AVR_SLEEP_H
+#define SIM_AVR_SLEEP_H
+
+#include <avr/io.h>
+
+#define SLEEP_MODE_IDLE		0
+#define SLEEP_MODE_PWR_DOWN	(_BV(SM1))
+#define SLEEP_MODE_PWR_SAVE	(_BV(SM0) | _BV(SM1))
+#define SLEEP_MODE_STANDBY	(_BV(SM1) | _BV(SM2))
+
+#define set_sleep_mode(mode) (SMCR = (SMCR & ~(_BV(SM0) | _BV(SM1) | _BV(SM2))) | (mode))
+#define sleep_enable() (SMCR |= _BV(SE))
+#define sleep_disable() (SMCR &= (uint8_t)~_BV(SE))
+#define sleep_cpu() sim_sleep()
+#define sleep_mode() do { sleep_enable(); sleep_cpu(); sleep_disable(); } while (0)
+
+#endif
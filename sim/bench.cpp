@@ -0,0 +1,222 @@
+/* Worst-case cycle budget of the 125us slot, on the virtual M1K.
+ *
+ * Runs the whole firmware, built with TRACE, through a script of sensor,
+ * button and USB stimulus in phases: boot with a button held (which stores
+ * the config and changes the sensor mode), tracking with clicks, entering
+ * the CPI mode and changing the CPI, leaving it (which stores the config)
+ * and tracking again.
+ *
+ * Per phase it reports the cycles of each slot, from its interrupt being
+ * taken to the reti of the interrupt that finished it (the slot may go on
+ * in other interrupts, see sched_slot_defer), the cycles spent in
+ * interrupts in that time (cpu) and the cycles of each traced stage (see
+ * trace.h), from the slot start. Slots are taken from the interrupt hook
+ * of the sim, stages from the trace ring, which is read every millisecond;
+ * stages are 16 bit timer1 stamps and wrap in slots longer than 65535
+ * cycles, the slot columns do not. Exits non-zero if any slot takes more
+ * than the budget.
+ *
+ * Cycles are those of the I/O accesses, delays and interrupt entry/exit,
+ * and the estimates of the computation between them, charged per firmware
+ * function (see cost.cpp); they are not measured on the AVR.
+ * The marks of the trace take no cycles here, so the slots are timed as
+ * built without TRACE. The compute line of each phase is the part of cpu
+ * that is such estimates, cpu less compute is what the sim times exactly.
+ *
+ * bench_ext is the same with the extended motion burst, which reads the
+ * whole burst in a slot of its own (see FULL_SLOT in main.c).
+ *
+ * usage: bench [budget_cycles]   (default 1000, one slot at 8 MHz)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#include <avr/io.h>
+#include "pmw3366.h"
+#include "sched.h"
+#include "trace.h"
+#include "test.h"
+
+#define SLOT_CYCLES (F_CPU / 8000)
+#define TRACE_SAMPLE MS(1)
+
+struct phase {
+	const char *name;
+	uint64_t start;
+};
+
+static const phase phases[] = {
+	{"boot, store config", 0},
+	{"tracking", MS(3000)},
+	{"enter cpi mode", MS(5000)},
+	{"change cpi", MS(12500)},
+	{"leave cpi mode", MS(14000)},
+	{"tracking", MS(20000)},
+};
+#define NUM_PHASES (sizeof(phases) / sizeof(phases[0]))
+#define END MS(23000)
+
+static const char *const stage_names[TRACE_STAGES] = {
+	"interval", "burst_cmd", "input", "burst_read", "report", "done"
+};
+
+struct samples {
+	std::vector<uint32_t> slot, cpu, compute;
+	std::vector<uint32_t> stage[TRACE_STAGES];
+	uint16_t overruns;
+};
+
+static samples results[NUM_PHASES];
+
+static unsigned phase_at(uint64_t t)
+{
+	unsigned p = 0;
+	while (p + 1 < NUM_PHASES && phases[p + 1].start <= t)
+		++p;
+	return p;
+}
+
+// a slot starts in the interrupt that stamps TRACE_SLOT and ends in the
+// one during which the trace counts it done
+static uint8_t slots_seen;
+static bool slot_open;
+static uint64_t slot_taken, slot_cpu, slot_compute;
+
+static void on_isr(int, uint64_t taken, uint64_t cycles)
+{
+	if (trace.magic != TRACE_MAGIC)
+		return;
+	if (!slot_open && (trace_reached & (1 << TRACE_SLOT))) {
+		slot_open = true;
+		slot_taken = taken;
+		slot_cpu = 0;
+		slot_compute = 0;
+	}
+	slot_cpu += cycles;
+	slot_compute += sim_isr_compute_cycles;
+	if (trace_slots == slots_seen)
+		return;
+	slots_seen = trace_slots;
+	const uint64_t from = slot_open ? slot_taken : taken;
+	samples &r = results[phase_at(from)];
+	r.slot.push_back(taken + cycles - from);
+	r.cpu.push_back(slot_open ? slot_cpu : cycles);
+	r.compute.push_back(slot_open ? slot_compute : sim_isr_compute_cycles);
+	slot_open = false;
+}
+
+static uint8_t ring_tail;
+
+static void sample_trace(void)
+{
+	if (trace.magic == TRACE_MAGIC) {
+		samples &r = results[phase_at(sim_now)];
+		for (; ring_tail != trace.head;
+		     ring_tail = (ring_tail + 1) & (TRACE_RING_SIZE - 1)) {
+			const trace_entry &e = trace.ring[ring_tail];
+			if (e.stage < TRACE_STAGES)
+				r.stage[e.stage].push_back(e.cycles);
+		}
+	}
+	sim_at(sim_now + TRACE_SAMPLE, sample_trace);
+}
+
+static uint16_t overruns_before;
+
+static void phase_done(unsigned p)
+{
+	results[p].overruns = sched_overruns - overruns_before;
+	overruns_before = sched_overruns;
+}
+
+static void print(const char *name, std::vector<uint32_t> &v)
+{
+	if (v.empty())
+		return;
+	std::sort(v.begin(), v.end());
+	uint64_t sum = 0;
+	for (uint32_t c : v)
+		sum += c;
+	printf("  %-11s %8zu %8.1f %8u %8u\n", name, v.size(),
+	       (double)sum / v.size(), v[(v.size() - 1) * 99 / 100], v.back());
+}
+
+static void both(bool pressed)
+{
+	sim_button(0, pressed);
+	sim_button(1, pressed);
+}
+
+static void stimulus(void)
+{
+	// held through the first slot: angle snapping on, config stored
+	sim_button(0, true);
+	sim_at(MS(800), [] { sim_button(0, false); });
+
+	sim_at(MS(3000), [] { sim_sensor_velocity(8, -3); });
+	sim_at(MS(3500), [] { sim_button(0, true); });
+	sim_at(MS(3550), [] { sim_button(0, false); });
+	sim_at(MS(4000), [] { sim_sensor_velocity(-40, 25); });
+	sim_at(MS(4200), [] { sim_button(1, true); });
+	sim_at(MS(4300), [] { sim_button(1, false); });
+
+	// lifted, then both buttons held for more than 3s
+	sim_at(MS(5000), [] { sim_sensor_velocity(0, 0); sim_sensor_lift(true); });
+	sim_at(MS(5100), [] { both(true); });
+	sim_at(MS(8500), [] { both(false); });
+	sim_at(MS(9000), [] { sim_sensor_lift(false); });
+	// after the cpi animation, right click: +100 cpi each
+	for (int i = 0; i < 3; ++i) {
+		sim_at(MS(12500 + 400 * i), [] { sim_button(1, true); });
+		sim_at(MS(12600 + 400 * i), [] { sim_button(1, false); });
+	}
+	sim_at(MS(14000), [] { sim_sensor_lift(true); });
+	sim_at(MS(14100), [] { both(true); });
+	sim_at(MS(17500), [] { both(false); });
+	sim_at(MS(18000), [] { sim_sensor_lift(false); });
+
+	sim_at(MS(20000), [] { sim_sensor_velocity(20, 10); });
+	sim_at(MS(21500), [] { sim_sensor_velocity(-5, 30); });
+
+	for (unsigned p = 0; p + 1 < NUM_PHASES; ++p)
+		sim_at(phases[p + 1].start, [p] { phase_done(p); });
+	sim_at(TRACE_SAMPLE, sample_trace);
+}
+
+int main(int argc, char **argv)
+{
+	const uint32_t budget = argc > 1 ? atoi(argv[1]) : SLOT_CYCLES;
+
+	sim_reset();
+	sim_usb_host_start(sim_usb_host_config());
+	sim_on_isr(on_isr);
+	stimulus();
+	sim_run(entry, END);
+	phase_done(NUM_PHASES - 1);
+
+	printf("slot budget %u cycles, %zu byte burst, sensor at %u cpi, "
+	       "%llu eeprom writes\n", budget, sizeof(struct pmw3366_burst),
+	       sim_sensor_cpi(),
+	       (unsigned long long)sim_eeprom_writes);
+	bool ok = true;
+	for (unsigned p = 0; p < NUM_PHASES; ++p) {
+		samples &r = results[p];
+		const uint32_t worst = r.slot.empty() ? 0
+			: *std::max_element(r.slot.begin(), r.slot.end());
+		const bool over = worst > budget;
+		printf("\n%s, %u overruns%s\n", phases[p].name, r.overruns,
+		       over ? ", OVER BUDGET" : "");
+		printf("  %-11s %8s %8s %8s %8s\n", "cycles", "count", "mean",
+		       "p99", "max");
+		print("slot", r.slot);
+		print("cpu", r.cpu);
+		for (int i = 0; i < TRACE_STAGES; ++i)
+			print(stage_names[i], r.stage[i]);
+		print("compute", r.compute);
+		ok &= !over;
+	}
+	printf("\n%s\n", ok ? "OK" : "FAIL: slot over budget");
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
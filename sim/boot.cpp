@@ -0,0 +1,47 @@
+/* Power-on to first motion report, on the virtual M1K.
+ *
+ * The mouse moves from power-on; reports when the host configured the
+ * device, when the SROM upload ended and when the first report with
+ * motion arrived. The enumeration takes as long as the host makes it (see
+ * sim_usb_host_config, about 125ms), the sensor init runs alongside it.
+ * make bench runs it. Exits non-zero if no motion is reported within a
+ * second or the firmware violates a sensor timing.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <avr/io.h>
+#include "usb_mouse.h"
+#include "test.h"
+
+static uint64_t first_motion_at;
+
+static void on_report(uint8_t ep, const uint8_t *data, uint8_t len)
+{
+	if (ep == MOUSE_ENDPOINT && !first_motion_at && len >= 5
+	    && (data[1] || data[2] || data[3] || data[4]))
+		first_motion_at = sim_now;
+}
+
+int main(void)
+{
+	sim_reset();
+	sim_usb_on_report(on_report);
+	sim_usb_host_start(sim_usb_host_config());
+	sim_sensor_velocity(5, 5);
+	sim_run(entry, MS(1000));
+
+	printf("boot: configured %.1f ms, srom done %.1f ms, "
+	       "first motion report %.1f ms\n",
+	       (double)sim_usb.configured_at / MS(1),
+	       (double)sim_sensor.srom_done_at / MS(1),
+	       (double)first_motion_at / MS(1));
+
+	const bool ok = first_motion_at && sim_sensor.srom_bytes == 4094
+		&& !sim_sensor.t_srad && !sim_sensor.t_srad_motbr
+		&& !sim_sensor.t_sww && !sim_sensor.t_swr
+		&& !sim_sensor.t_srw && !sim_sensor.t_srom;
+	if (!ok)
+		printf("FAIL: no motion reported or sensor timing\n");
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
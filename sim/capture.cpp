@@ -0,0 +1,240 @@
+/* Frame capture (see capture.h) on the virtual M1K.
+ *
+ * The mouse moves throughout. The host asks for two frames, later for
+ * frames until it stops, and stops in the middle of the third one; a
+ * button is clicked while a frame is read. Then it asks for frames again
+ * and stops reading the endpoint a few packets into the first one. Reports
+ * the time a frame takes, with the sensor restart after it, the longest
+ * gap in the motion reports and when the capture the host stopped reading
+ * ended. The motion during a frame and the restart is lost, as on the real
+ * sensor. Exits non-zero if a frame is incomplete or wrong, the stop does
+ * not end the transfer, the click is lost, the mouse does not track or
+ * loses motion after the capture, the capture the host stopped reading
+ * does not end after the timeout (see capture.h) or the firmware violates
+ * a sensor timing.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <avr/io.h>
+#include "usb_mouse.h"
+#include "capture.h"
+#include "sched.h"
+#include "test.h"
+
+#define FRAME_BYTES (sizeof(struct capture_header) + CAPTURE_PIXELS)
+
+static struct {
+	int64_t x, y;
+	uint32_t presses;
+	uint8_t buttons;
+	uint64_t last_motion, max_gap, motion_after, motion_after_timeout;
+} mouse;
+
+static struct {
+	std::vector<uint8_t> transfer;
+	std::vector<std::vector<uint8_t> > frames;
+	uint32_t cut_off;	// transfers shorter than a frame
+	uint64_t started_at, last_done_at, done_at[2];
+	bool stop_sent;
+	// the capture whose host stops reading, when it stopped, when the
+	// firmware gave up and when the capture ended
+	bool unread;
+	uint64_t paused_at, gave_up_at, ended_at;
+} cap;
+
+// the first captures, before the one the host stops reading
+static struct {
+	uint32_t cut_off, frames;
+	int64_t unreported_x, unreported_y;
+} before;
+
+static void request(uint8_t bRequest, uint16_t frames)
+{
+	sim_usb_control(0x41, bRequest, frames, CAPTURE_INTERFACE, 0, NULL,
+			[](int status, const uint8_t *, uint16_t) {
+		if (status)
+			printf("capture request failed (%d)\n", status);
+	});
+}
+
+static void on_capture(const uint8_t *data, uint8_t len)
+{
+	cap.transfer.insert(cap.transfer.end(), data, data + len);
+	// stop the continuous capture a few packets into its third frame
+	if (cap.frames.size() == 4 && cap.transfer.size() == 5 * CAPTURE_SIZE
+	    && !cap.stop_sent) {
+		request(CAPTURE_STOP, 0);
+		cap.stop_sent = true;
+	}
+	if (cap.unread && !cap.paused_at
+	    && cap.transfer.size() == 3 * CAPTURE_SIZE) {
+		sim_usb_host_pause_bulk(true);
+		cap.paused_at = sim_now;
+	}
+	if (len == CAPTURE_SIZE)
+		return;
+	if (cap.transfer.size() == FRAME_BYTES) {
+		cap.frames.push_back(cap.transfer);
+		cap.last_done_at = sim_now;
+		if (cap.frames.size() <= 2)
+			cap.done_at[cap.frames.size() - 1] = sim_now;
+	} else {
+		++cap.cut_off;
+	}
+	cap.transfer.clear();
+}
+
+static void on_report(uint8_t ep, const uint8_t *data, uint8_t len)
+{
+	if (ep == CAPTURE_ENDPOINT) {
+		on_capture(data, len);
+		return;
+	}
+	if (ep != MOUSE_ENDPOINT || len < 5)
+		return;
+	const int16_t dx = data[1] | data[2] << 8;
+	const int16_t dy = data[3] | data[4] << 8;
+	mouse.x += dx;
+	mouse.y += dy;
+	if ((data[0] & 1) && !(mouse.buttons & 1))
+		++mouse.presses;
+	mouse.buttons = data[0];
+	if (dx || dy) {
+		if (mouse.last_motion && sim_now - mouse.last_motion > mouse.max_gap)
+			mouse.max_gap = sim_now - mouse.last_motion;
+		mouse.last_motion = sim_now;
+		if (cap.last_done_at && cap.stop_sent)
+			++mouse.motion_after;
+		if (cap.ended_at)
+			++mouse.motion_after_timeout;
+	}
+}
+
+// motion the host has not seen, once the mouse lies still
+static int64_t unreported_x, unreported_y;
+
+// the capture the host stopped reading: the firmware gives up with the
+// sensor restart, and ends once it is done
+static void watch_end(void)
+{
+	static uint64_t writes;
+	if (cap.paused_at && !cap.gave_up_at && sim_sensor.writes != writes)
+		cap.gave_up_at = sim_now;
+	writes = sim_sensor.writes;
+	if (cap.paused_at && !capture_active()) {
+		cap.ended_at = sim_now;
+		return;
+	}
+	sim_at(sim_now + US(100), watch_end);
+}
+
+static bool frame_ok(const std::vector<uint8_t> &f, uint8_t n)
+{
+	struct capture_header h;
+	memcpy(&h, f.data(), sizeof(h));
+	if (h.magic != CAPTURE_MAGIC || h.frame != n || h.width != CAPTURE_WIDTH
+	    || h.squal != sim_sensor_reg(0x07) || h.shutter != 0x0020)
+		return false;
+	for (uint16_t i = 0; i < CAPTURE_PIXELS; i++)
+		if (f[sizeof(h) + i] != sim_sensor_pixel(i))
+			return false;
+	return true;
+}
+
+int main(void)
+{
+	sim_reset();
+	sim_usb_on_report(on_report);
+	sim_usb_host_start(sim_usb_host_config());
+	sim_at(MS(500), [] { sim_sensor_velocity(2, -1); });
+	sim_at(MS(1000), [] {
+		cap.started_at = sim_now;
+		request(CAPTURE_START, 2);
+	});
+	// while the second frame is read
+	sim_at(MS(1230), [] { sim_button(0, true); });
+	sim_at(MS(1260), [] { sim_button(0, false); });
+	sim_at(MS(2000), [] { request(CAPTURE_START, 0); });
+	// still for a moment after the capture, from there on all motion
+	// must arrive
+	sim_at(MS(2750), [] { sim_sensor_velocity(0, 0); });
+	sim_at(MS(2800), [] {
+		unreported_x = sim_sensor.latched_x - mouse.x;
+		unreported_y = sim_sensor.latched_y - mouse.y;
+	});
+	sim_at(MS(2850), [] { sim_sensor_velocity(-1, 3); });
+	sim_at(MS(3500), [] { sim_sensor_velocity(0, 0); });
+	sim_at(MS(3600), [] {
+		before.cut_off = cap.cut_off;
+		before.frames = sim_sensor.frames;
+		before.unreported_x = sim_sensor.latched_x - mouse.x;
+		before.unreported_y = sim_sensor.latched_y - mouse.y;
+	});
+	sim_at(MS(3700), [] {
+		cap.unread = true;
+		request(CAPTURE_START, 0);
+		watch_end();
+	});
+	sim_at(MS(4300), [] { sim_sensor_velocity(1, 1); });
+	sim_at(MS(4500), [] { sim_sensor_velocity(0, 0); });
+	sim_at(MS(4600), [] { sim_usb_host_pause_bulk(false); });
+	sim_run(entry, MS(4800));
+
+	printf("%zu frames, %u cut off; last frame done at %.1f ms\n",
+	       cap.frames.size(), cap.cut_off, (double)cap.last_done_at / MS(1));
+	printf("request to first frame %.1f ms, then a frame every %.1f ms; "
+	       "longest gap in the motion %.1f ms\n",
+	       (double)(cap.done_at[0] - cap.started_at) / MS(1),
+	       (double)(cap.done_at[1] - cap.done_at[0]) / MS(1),
+	       (double)mouse.max_gap / MS(1));
+	printf("host stopped reading: sensor restart %.1f ms later, done "
+	       "%.1f ms later\n",
+	       cap.gave_up_at ? (double)(cap.gave_up_at - cap.paused_at) / MS(1)
+	       : 0.0,
+	       cap.ended_at ? (double)(cap.ended_at - cap.paused_at) / MS(1)
+	       : 0.0);
+	printf("motion: sensor %lld,%lld host %lld,%lld\n",
+	       (long long)sim_sensor.latched_x, (long long)sim_sensor.latched_y,
+	       (long long)mouse.x, (long long)mouse.y);
+	printf("sensor timing violations: t_srad %u t_sww %u t_swr %u t_srw %u "
+	       "t_srom %u t_raw %u\n\n", sim_sensor.t_srad, sim_sensor.t_sww,
+	       sim_sensor.t_swr, sim_sensor.t_srw, sim_sensor.t_srom,
+	       sim_sensor.t_raw);
+
+	int failed = 0;
+	bool frames_ok = cap.frames.size() == 4;
+	for (size_t n = 0; frames_ok && n < cap.frames.size(); n++)
+		frames_ok = frame_ok(cap.frames[n], n);
+	failed += check(frames_ok, "frames");
+	failed += check(cap.stop_sent && before.cut_off == 1
+			&& before.frames == 4, "stop cuts the frame off");
+	failed += check(mouse.presses == 1 && !mouse.buttons,
+			"buttons during the capture");
+	failed += check(mouse.motion_after > 100, "tracking after the capture");
+	failed += check(sim_sensor.latched_x
+			&& before.unreported_x == unreported_x
+			&& before.unreported_y == unreported_y,
+			"motion after the capture");
+	// 50 frames from the packet that waited, then the first write of the
+	// restart 3 ms on; the packets taken before end short once the host
+	// reads again
+	failed += check(cap.ended_at && cap.gave_up_at
+			&& cap.gave_up_at - cap.paused_at >= MS(50)
+			&& cap.gave_up_at - cap.paused_at <= MS(60)
+			&& cap.cut_off == 2 && cap.transfer.empty()
+			&& sim_sensor.frames == 4 && !capture_active(),
+			"host stops reading");
+	failed += check(mouse.motion_after_timeout > 100,
+			"tracking after the timeout");
+	failed += check(!sim_sensor.t_srad && !sim_sensor.t_srad_motbr
+			&& !sim_sensor.t_sww && !sim_sensor.t_swr
+			&& !sim_sensor.t_srw && !sim_sensor.t_srom
+			&& !sim_sensor.t_raw, "sensor timing");
+	failed += check(!sim_sensor.burst_unarmed && !sim_sensor.wcol,
+			"sensor spi protocol");
+	failed += check(!sched_overruns, "slot overruns");
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
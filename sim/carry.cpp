@@ -0,0 +1,134 @@
+/* Motion the host is behind on, at CPI_MAX and top speed, on the virtual
+ * M1K.
+ *
+ * The host sets 12000 cpi, then the mouse moves at 250 ips while the host
+ * leaves the polls out for up to 40 ms at a time, far more than an int16
+ * holds, and skips and delays the others. The motion that does not fit a
+ * report waits for the next ones. Exits non-zero if a report is outside
+ * the logical range of the report descriptor, motion is lost, doubled or
+ * reversed, the reports do not catch up after the last pause or a slot
+ * overruns.
+ *
+ * carry_xy12 is the same with 12 bit X/Y in the mouse report, at 100 ips.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/io.h>
+#include "usb_mouse.h"
+#include "settings.h"
+#include "sched.h"
+#include "test.h"
+
+#define CPI 12000
+#if MOUSE_XY_BITS == 12
+// a report per frame carries 2047 counts, the speed that leaves room to
+// catch up
+#define SPEED 100
+#else
+#define SPEED 250 // ips, the most the sensor tracks
+#endif
+#define MOVE_FROM MS(1000)
+#define MOVE_TO MS(1600)
+#define END MS(2000)
+
+static struct {
+	int64_t x, y;
+	uint32_t reports, full, out_of_range, reversed;
+	uint64_t last_motion_at;
+	int cpi_status = -1;
+} host;
+
+static void on_report(uint8_t ep, const uint8_t *data, uint8_t len)
+{
+	if (ep != MOUSE_ENDPOINT || len != MOUSE_REPORT_SIZE)
+		return;
+#if MOUSE_XY_BITS == 12
+	// sign extended from bit 11
+	const int16_t dx = (int16_t)((data[1] | data[2] << 8) << 4) >> 4;
+	const int16_t dy = (int16_t)((data[2] >> 4 | data[3] << 4) << 4) >> 4;
+#else
+	const int16_t dx = data[1] | data[2] << 8;
+	const int16_t dy = data[3] | data[4] << 8;
+#endif
+	host.x += dx;
+	host.y += dy;
+	++host.reports;
+	if (dx < -MOUSE_XY_MAX || dy < -MOUSE_XY_MAX)
+		++host.out_of_range;
+	if (dx == MOUSE_XY_MAX || dy == -MOUSE_XY_MAX)
+		++host.full;
+	// the mouse only moves right and up
+	if (dx < 0 || dy > 0)
+		++host.reversed;
+	if (dx || dy)
+		host.last_motion_at = sim_now;
+}
+
+static void set_cpi(void)
+{
+	sim_usb_control(0xa1, 1, 0x0300 | SETTINGS_REPORT_CONFIG,
+			SETTINGS_INTERFACE, sizeof(struct settings_config), NULL,
+			[](int s, const uint8_t *data, uint16_t len) {
+		if (s || len != sizeof(struct settings_config))
+			return;
+		static struct settings_config c;
+		memcpy(&c, data, sizeof(c));
+		c.cpi = CPI;
+		sim_usb_control(0x21, 9, 0x0300 | SETTINGS_REPORT_CONFIG,
+				SETTINGS_INTERFACE, sizeof(c),
+				(const uint8_t *)&c,
+				[](int s, const uint8_t *, uint16_t) {
+			host.cpi_status = s;
+		});
+	});
+}
+
+int main(void)
+{
+	sim_reset();
+	sim_usb_on_report(on_report);
+	sim_usb_host_config config;
+	config.poll_jitter_cycles = US(900);
+	config.poll_skip_percent = 25;
+	sim_usb_host_start(config);
+
+	sim_at(MS(500), set_cpi);
+	sim_at(MOVE_FROM, [] { sim_sensor_velocity(SPEED, -SPEED * 0.7); });
+	sim_at(MOVE_TO, [] { sim_sensor_velocity(0, 0); });
+	// pauses of 5 to 40 ms, the longest at the end of the motion
+	for (unsigned i = 0; i < 8; i++) {
+		const uint64_t at = MOVE_FROM + MS(20) + i * MS(70);
+		sim_at(at, [] { sim_usb_host_pause_polls(true); });
+		sim_at(at + MS(5 * (i + 1)), [] {
+			sim_usb_host_pause_polls(false);
+		});
+	}
+	sim_run(entry, END);
+
+	printf("%u cpi, %u reports, %u full, %u out of range\n",
+	       sim_sensor_cpi(), host.reports, host.full, host.out_of_range);
+	printf("motion: sensor %lld,%lld host %lld,%lld, caught up %.1f ms "
+	       "after the motion\n\n",
+	       (long long)sim_sensor.latched_x, (long long)sim_sensor.latched_y,
+	       (long long)host.x, (long long)host.y,
+	       ((double)host.last_motion_at - MOVE_TO) / MS(1));
+
+	int failed = 0;
+	failed += check(!host.cpi_status && sim_sensor_cpi() == CPI, "cpi");
+	// a pause at 3 counts per us is more than 32767 counts
+	failed += check(host.full > 0 && !host.out_of_range, "reports clamped");
+	failed += check(!host.reversed, "never reversed");
+	failed += check(sim_sensor.latched_x > 32767 * 8
+			&& host.x == sim_sensor.latched_x
+			&& host.y == sim_sensor.latched_y
+			&& !sim_sensor.saturated, "all motion reported");
+	failed += check(host.last_motion_at < END - MS(100), "caught up");
+	failed += check(!sim_sensor.t_srad && !sim_sensor.t_srad_motbr
+			&& !sim_sensor.t_sww && !sim_sensor.t_swr
+			&& !sim_sensor.t_srw && !sim_sensor.t_srom,
+			"sensor timing");
+	failed += check(!sched_overruns, "slot overruns");
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
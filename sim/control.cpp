@@ -0,0 +1,165 @@
+/* Control requests against the sensor slots, on the virtual M1K.
+ *
+ * While the mouse moves, the host keeps endpoint 0 busy for two seconds:
+ * configuration, string and report descriptors, the feature and input
+ * reports, the idle rate and a SET_REPORT the device must refuse, back to
+ * back. Its host spreads the stages of each transfer like a busy bus
+ * does, with 200 us between the transactions. Reports the control
+ * transfers done, the longest endpoint 0 interrupt and the bursts against
+ * the slots of the time. Exits non-zero if a slot is missed or overruns, a
+ * request fails or motion is lost or counted twice.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <avr/io.h>
+#include "usb_mouse.h"
+#include "settings.h"
+#include "sched.h"
+#include "test.h"
+
+#define SLOT_CYCLES (F_CPU / 8000)
+#define FLOOD_FROM MS(1000)
+#define FLOOD_TO MS(3000)
+#define END MS(3200)
+
+static struct {
+	int64_t x, y;
+	unsigned done, failed, refused;
+} host;
+
+static void add_motion(const uint8_t *data)
+{
+	host.x += (int16_t)(data[1] | data[2] << 8);
+	host.y += (int16_t)(data[3] | data[4] << 8);
+}
+
+static void on_report(uint8_t ep, const uint8_t *data, uint8_t len)
+{
+	if (ep == MOUSE_ENDPOINT && len == MOUSE_REPORT_SIZE)
+		add_motion(data);
+}
+
+static void request(uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue,
+		uint16_t wIndex, uint16_t wLength)
+{
+	sim_usb_control(bmRequestType, bRequest, wValue, wIndex, wLength, NULL,
+			[](int s, const uint8_t *, uint16_t) {
+		if (s)
+			++host.failed;
+		else
+			++host.done;
+	});
+}
+
+static void flood(void)
+{
+	if (sim_now >= FLOOD_TO)
+		return;
+	request(0x80, 6, 0x0200, 0, 255);
+	request(0x80, 6, 0x0100, 0, 255);
+	request(0x80, 6, 0x0302, 0x0409, 255);
+	request(0x81, 6, 0x2200, MOUSE_INTERFACE, 255);
+	request(0x81, 6, 0x2200, SETTINGS_INTERFACE, 255);
+	request(0xa1, 1, 0x0300 | SETTINGS_REPORT_CONFIG, SETTINGS_INTERFACE,
+		sizeof(struct settings_config));
+	request(0xa1, 2, 0, MOUSE_INTERFACE, 1);
+	request(0x80, 0, 0, 0, 2);
+	sim_usb_control(0xa1, 1, 0x0100, MOUSE_INTERFACE, MOUSE_REPORT_SIZE,
+			NULL, [](int s, const uint8_t *data, uint16_t len) {
+		if (s || len != MOUSE_REPORT_SIZE) {
+			++host.failed;
+			return;
+		}
+		++host.done;
+		add_motion(data);
+	});
+	// out of range, the status stage stalls
+	static const struct settings_config bad = {
+		SETTINGS_REPORT_CONFIG, 50, 0, 2, SROM_VERSION, 0
+	};
+	sim_usb_control(0x21, 9, 0x0300 | SETTINGS_REPORT_CONFIG,
+			SETTINGS_INTERFACE, sizeof(bad), (const uint8_t *)&bad,
+			[](int s, const uint8_t *, uint16_t) {
+		if (s == SIM_USB_STALL)
+			++host.refused;
+		else
+			++host.failed;
+		flood();
+	});
+}
+
+static bool measuring;
+static uint64_t com_cycles, com_max, com_count;
+
+static void on_isr(int vector, uint64_t, uint64_t cycles)
+{
+	if (!measuring || vector != SIM_USB_COM)
+		return;
+	com_cycles += cycles;
+	++com_count;
+	if (cycles > com_max)
+		com_max = cycles;
+}
+
+static struct {
+	uint64_t bursts;
+	uint16_t overruns;
+} at_start, at_end;
+
+int main(void)
+{
+	sim_reset();
+	sim_usb_on_report(on_report);
+	sim_usb_host_config config;
+	config.control_gap_cycles = US(200);
+	config.control_retry_cycles = US(200);
+	sim_usb_host_start(config);
+	sim_on_isr(on_isr);
+	sim_at(MS(900), [] { sim_sensor_velocity(5, -3); });
+	sim_at(FLOOD_FROM, [] {
+		measuring = true;
+		at_start.bursts = sim_sensor.bursts;
+		at_start.overruns = sched_overruns;
+		flood();
+	});
+	sim_at(FLOOD_TO, [] {
+		measuring = false;
+		at_end.bursts = sim_sensor.bursts;
+		at_end.overruns = sched_overruns;
+		sim_sensor_velocity(0, 0);
+	});
+	sim_run(entry, END);
+
+	const uint64_t slots = (FLOOD_TO - FLOOD_FROM) / SLOT_CYCLES;
+	const uint64_t bursts = at_end.bursts - at_start.bursts;
+	printf("control: %u transfers, %u refused, %u failed in %.0f ms\n",
+	       host.done, host.refused, host.failed,
+	       (double)(FLOOD_TO - FLOOD_FROM) / MS(1));
+	printf("endpoint 0 interrupt: %llu taken, mean %.1f max %llu cycles\n",
+	       (unsigned long long)com_count,
+	       com_count ? (double)com_cycles / com_count : 0.0,
+	       (unsigned long long)com_max);
+	printf("%llu bursts in %llu slots, %u overruns\n",
+	       (unsigned long long)bursts, (unsigned long long)slots,
+	       at_end.overruns - at_start.overruns);
+	printf("motion: sensor %lld,%lld host %lld,%lld\n\n",
+	       (long long)sim_sensor.latched_x, (long long)sim_sensor.latched_y,
+	       (long long)host.x, (long long)host.y);
+
+	int failed = 0;
+	failed += check(host.done > 1000 && !host.failed && host.refused,
+			"control requests");
+	failed += check(bursts + 1 >= slots && bursts <= slots + 1,
+			"no missed slots");
+	failed += check(at_end.overruns == at_start.overruns
+			&& !sched_overruns, "slot overruns");
+	failed += check(sim_sensor.latched_x
+			&& host.x == sim_sensor.latched_x
+			&& host.y == sim_sensor.latched_y, "all motion reported");
+	failed += check(!sim_sensor.t_srad && !sim_sensor.t_srad_motbr
+			&& !sim_sensor.t_sww && !sim_sensor.t_swr
+			&& !sim_sensor.t_srw && !sim_sensor.t_srom,
+			"sensor timing");
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,215 @@
+/* Cycles of the firmware's computation, which the emulated clock otherwise
+ * does not count: only the I/O accesses, the delays and the interrupt entry
+ * and exit advance it (see sim.h).
+ *
+ * The firmware modules are built with -finstrument-functions (see the
+ * Makefile), so that every call of one of their functions comes through
+ * the hooks below. The functions of the table are charged their cycles
+ * with sim_compute, on entry and on return; the others are free. The table
+ * names each function by its source file, as static functions of different
+ * modules may share a name, and is resolved against the symbol table of
+ * the program itself. A function that is missing from a linked module
+ * aborts the program, so that a rename cannot silently leave its cycles
+ * out; unless the table names the build flag it depends on, which may have
+ * been left out.
+ *
+ * The counts are estimates, not measurements: the instructions avr-gcc -O2
+ * makes of the function besides its register accesses, counted by the
+ * datasheet timings. A register operation takes a cycle per byte, a load
+ * or store from RAM 2, a taken branch 2, a call with its return 8. Where
+ * the path varies, the longest common one is counted. An interrupt that
+ * calls out saves the call-clobbered registers on entry and restores them
+ * on return, which is counted at the function it calls them for.
+ */
+#include <cxxabi.h>
+#include <elf.h>
+#include <link.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "sim.h"
+
+struct cost {
+	const char *file;
+	const char *function;
+	uint16_t enter, exit;
+	// the build flag the function comes and goes with
+	const char *flag;
+};
+
+static const struct cost costs[] = {
+	// the interrupt of slots 1-7 and the SOF of slot 0 call into the
+	// slot task, the late latch runs slots from its own interrupt
+	{"sched.c", "dispatch", 32, 32, "LATE_LATCH_US"},
+	{"sched.c", "run_slots", 32, 32, "LATE_LATCH_US"},
+	// after it takes the duration of slot 7, see LATCH_EXIT
+	{"sched.c", "slot_next", 0, 40, "LATE_LATCH_US"},
+
+	// the burst interrupt calls pmw3366_burst_done
+	{"spi.c", "spi_burst_start", 20, 0, NULL},
+	{"spi.c", "TIMER1_COMPB_vect", 32, 32, NULL},
+	{"spi.c", "spi_burst_wait", 12, 0, NULL},
+
+	{"pmw3366.c", "pmw3366_burst_start", 24, 0, NULL},
+	{"pmw3366.c", "pmw3366_set_cpi", 48, 0, NULL},
+	{"pmw3366.c", "pmw3366_set_mode", 12, 0, NULL},
+	{"pmw3366.c", "shadow_set", 6, 0, NULL},
+
+	{"power.c", "power_sample", 16, 0, NULL},
+	{"power.c", "power_slot_done", 28, 0, NULL},
+
+	{"buttons.c", "BUTTONS_task", 32, 0, NULL},
+	{"mouse.c", "mouse_step", 56, 0, NULL},
+	{"mouse.c", "mode_changed", 24, 0, NULL},
+	{"mouse.c", "cpi_mode_step", 60, 0, NULL},
+
+	// the flag of the slot before, before the burst
+	{"main.c", "slot_task", 8, 0, NULL},
+	// the input structs; then the 32 bit tick, the buttons into the report
+	// and the flag
+	{"main.c", "slot_inputs", 20, 22, NULL},
+	{"main.c", "pmw3366_burst_done", 24, 0, NULL},
+	// the motion into the accumulators and the flag
+	{"main.c", "slot_finish", 82, 0, NULL},
+	// the arguments of stream_slot
+	{"main.c", "slot_stream", 12, 0, NULL},
+	{"main.c", "slot_weight", 36, 0, "MOUSE_TIMESTAMP"},
+	{"main.c", "motion_carry", 16, 0, "PMW3366_BURST_EXTENDED"},
+	{"main.c", "report_prepare", 30, 0, NULL},
+	// inlined into slot_finish, which leaves x and y in registers
+	{"main.c", "report_latch", 8, 0, NULL},
+	// the clamps and the report, a byte of it in report_put; with x and y
+	// loaded 16 more, in the GET_REPORT the slots do not see
+	{"main.c", "report_take", 50, 0, NULL},
+	{"main.c", "report_put", 2, 0, NULL},
+
+	// without the loops, their calls are counted on their own
+	{"stream.c", "stream_slot", 24, 0, NULL},
+	{"stream.c", "frame_end", 16, 0, NULL},
+	{"stream.c", "write_sample", 16, 0, NULL},
+	{"stream.c", "clear_sample", 12, 0, NULL},
+
+	{"trace.c", "trace_task", 50, 0, NULL},
+	{"trace.c", "record", 50, 0, NULL},
+};
+
+static std::unordered_map<uintptr_t, const struct cost *> by_address;
+static bool resolved = false;
+
+static int load_base(struct dl_phdr_info *info, size_t, void *base)
+{
+	// the program itself comes first
+	*(uintptr_t *)base = info->dlpi_addr;
+	return 1;
+}
+
+// the name of a symbol as in the source, without the parameters
+static std::string source_name(const char *symbol)
+{
+	int status;
+	char *d = abi::__cxa_demangle(symbol, NULL, NULL, &status);
+	std::string name = status ? symbol : d;
+	free(d);
+	const size_t paren = name.find('(');
+	if (paren != std::string::npos)
+		name.resize(paren);
+	return name;
+}
+
+static void resolve(void)
+{
+	resolved = true;
+	FILE *f = fopen("/proc/self/exe", "rb");
+	if (!f) {
+		perror("sim: cost: /proc/self/exe");
+		abort();
+	}
+	std::vector<uint8_t> image;
+	uint8_t chunk[65536];
+	size_t n;
+	while ((n = fread(chunk, 1, sizeof(chunk), f)))
+		image.insert(image.end(), chunk, chunk + n);
+	fclose(f);
+
+	const Elf64_Ehdr *eh = (const Elf64_Ehdr *)image.data();
+	const Elf64_Shdr *sh = (const Elf64_Shdr *)(image.data() + eh->e_shoff);
+	const Elf64_Shdr *symtab = NULL;
+	for (unsigned i = 0; i < eh->e_shnum; i++)
+		if (sh[i].sh_type == SHT_SYMTAB)
+			symtab = &sh[i];
+	if (!symtab) {
+		fprintf(stderr, "sim: cost: no symbol table, do not strip\n");
+		abort();
+	}
+	const Elf64_Sym *syms = (const Elf64_Sym *)(image.data()
+		+ symtab->sh_offset);
+	const char *names = (const char *)(image.data()
+		+ sh[symtab->sh_link].sh_offset);
+	const size_t nsyms = symtab->sh_size / sizeof(Elf64_Sym);
+
+	uintptr_t base = 0;
+	dl_iterate_phdr(load_base, &base);
+
+	const size_t ncosts = sizeof(costs) / sizeof(costs[0]);
+	std::vector<bool> linked(ncosts), found(ncosts);
+	// the local symbols of a module follow its file symbol, the global
+	// ones come after all of them
+	const char *file = "";
+	for (size_t i = 0; i < nsyms; i++) {
+		const Elf64_Sym *s = &syms[i];
+		const char *name = names + s->st_name;
+		if (ELF64_ST_TYPE(s->st_info) == STT_FILE) {
+			file = name;
+			for (size_t c = 0; c < ncosts; c++)
+				if (!strcmp(costs[c].file, name))
+					linked[c] = true;
+			continue;
+		}
+		// parts and clones of a function (name.cold, name.isra.0)
+		// report the address of the original
+		if (ELF64_ST_TYPE(s->st_info) != STT_FUNC || !s->st_value
+				|| strchr(name, '.'))
+			continue;
+		const bool local = ELF64_ST_BIND(s->st_info) == STB_LOCAL;
+		const std::string fn = source_name(name);
+		for (size_t c = 0; c < ncosts; c++) {
+			if (fn != costs[c].function
+					|| (local && strcmp(costs[c].file, file)))
+				continue;
+			if (found[c]) {
+				fprintf(stderr, "sim: cost: %s:%s twice\n",
+					costs[c].file, costs[c].function);
+				abort();
+			}
+			found[c] = true;
+			by_address[base + s->st_value] = &costs[c];
+		}
+	}
+	for (size_t c = 0; c < ncosts; c++) {
+		if (linked[c] && !found[c] && !costs[c].flag) {
+			fprintf(stderr, "sim: cost: no function %s in %s\n",
+				costs[c].function, costs[c].file);
+			abort();
+		}
+	}
+}
+
+extern "C" void __cyg_profile_func_enter(void *fn, void *)
+{
+	if (!resolved)
+		resolve();
+	const auto c = by_address.find((uintptr_t)fn);
+	if (c != by_address.end() && c->second->enter)
+		sim_compute(c->second->enter);
+}
+
+extern "C" void __cyg_profile_func_exit(void *fn, void *)
+{
+	const auto c = by_address.find((uintptr_t)fn);
+	if (c != by_address.end() && c->second->exit)
+		sim_compute(c->second->exit);
+}
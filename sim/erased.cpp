@@ -0,0 +1,59 @@
+/* Settings report (see settings.h) of the virtual M1K with an erased eeprom.
+ *
+ * Every eeprom byte reads 0xff, so the firmware boots with the default SROM
+ * and power profile. Exits non-zero if the config report does not give the
+ * SROM and the power profile that were actually loaded.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/io.h>
+#include "power.h"
+#include "settings.h"
+#include "test.h"
+
+// wValue of GET_REPORT
+#define FEATURE(id) (0x0300 | (id))
+
+static struct settings_config config;
+static struct settings_info info;
+static int config_status = -1, info_status = -1;
+
+static void get(uint8_t id, void *report, size_t size, int *status)
+{
+	sim_usb_control(0xa1, 1, FEATURE(id), SETTINGS_INTERFACE, size, NULL,
+			[=](int s, const uint8_t *data, uint16_t len) {
+		*status = s || len != size ? -1 : 0;
+		if (!*status)
+			memcpy(report, data, size);
+	});
+}
+
+int main(void)
+{
+	sim_reset();
+	memset(sim_eeprom_data(), 0xff, sim_eeprom_size());
+	sim_usb_host_start(sim_usb_host_config());
+	sim_at(MS(1000), [] {
+		get(SETTINGS_REPORT_CONFIG, &config, sizeof(config),
+		    &config_status);
+		get(SETTINGS_REPORT_INFO, &info, sizeof(info), &info_status);
+	});
+	sim_run(entry, MS(1100));
+
+	printf("config: srom %u power %u\n", config.srom_version,
+	       config.power_profile);
+	printf("info: srom id %u power %u\n\n", info.srom_id,
+	       info.power_profile);
+
+	int failed = 0;
+	failed += check(!config_status && !info_status, "reports");
+	failed += check(config.srom_version == SROM_VERSION
+			&& info.srom_id == SROM_VERSION
+			&& sim_sensor_reg(0x2a) == SROM_VERSION, "srom loaded");
+	failed += check(config.power_profile == POWER_PROFILE
+			&& info.power_profile == POWER_PROFILE,
+			"power profile loaded");
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
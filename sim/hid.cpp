@@ -0,0 +1,162 @@
+/* HID class requests of the mouse interface (see usb_mouse.c) on the
+ * virtual M1K.
+ *
+ * The host sets an idle rate of 8 ms and holds a button down while the
+ * mouse lies still, then turns the idle rate off again. Then it moves the
+ * mouse and reads input reports with GET_REPORT between the polls, and
+ * reads a held button that way. Exits non-zero if the reports of the idle
+ * rate do not come every 8 ms or keep coming after it is off, motion is
+ * lost or counted twice between GET_REPORT and the endpoint, GET_REPORT
+ * misses the button, a control request is stalled or a slot overruns.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include <avr/io.h>
+#include "usb_mouse.h"
+#include "sched.h"
+#include "test.h"
+
+#define IDLE_RATE 2 // in 4 ms
+#define IDLE_FROM MS(600)
+#define IDLE_TO MS(800)
+#define QUIET_FROM MS(900)
+#define QUIET_TO MS(1000)
+#define MOVE_FROM MS(1000)
+#define MOVE_TO MS(1200)
+
+static struct {
+	int64_t x, y;
+	std::vector<uint64_t> idle_reports;
+	unsigned idle_bad;
+	unsigned quiet_reports;
+	int64_t get_x, get_y;
+	unsigned gets, get_motion, get_failed;
+	uint8_t get_buttons;
+	int idle_set = -1, idle_off = -1;
+} host;
+
+static void on_report(uint8_t ep, const uint8_t *data, uint8_t len)
+{
+	if (ep != MOUSE_ENDPOINT || len != MOUSE_REPORT_SIZE)
+		return;
+	const int16_t dx = data[1] | data[2] << 8;
+	const int16_t dy = data[3] | data[4] << 8;
+	host.x += dx;
+	host.y += dy;
+	if (sim_now >= IDLE_FROM && sim_now < IDLE_TO) {
+		host.idle_reports.push_back(sim_now);
+		if (data[0] != 1 || dx || dy)
+			++host.idle_bad;
+	}
+	if (sim_now >= QUIET_FROM && sim_now < QUIET_TO)
+		++host.quiet_reports;
+}
+
+static void set_idle(uint8_t rate)
+{
+	sim_usb_control(0x21, 10, rate << 8, MOUSE_INTERFACE, 0, NULL, NULL);
+}
+
+static void get_idle(int *rate)
+{
+	sim_usb_control(0xa1, 2, 0, MOUSE_INTERFACE, 1, NULL,
+			[=](int s, const uint8_t *data, uint16_t len) {
+		*rate = s || len != 1 ? -1 : data[0];
+	});
+}
+
+static void get_report(void)
+{
+	sim_usb_control(0xa1, 1, 0x0100, MOUSE_INTERFACE, MOUSE_REPORT_SIZE,
+			NULL, [](int s, const uint8_t *data, uint16_t len) {
+		if (s || len != MOUSE_REPORT_SIZE) {
+			++host.get_failed;
+			return;
+		}
+		const int16_t dx = data[1] | data[2] << 8;
+		const int16_t dy = data[3] | data[4] << 8;
+		host.get_x += dx;
+		host.get_y += dy;
+		++host.gets;
+		if (dx || dy)
+			++host.get_motion;
+		host.get_buttons |= data[0];
+	});
+}
+
+int main(void)
+{
+	sim_reset();
+	sim_usb_on_report(on_report);
+	sim_usb_host_start(sim_usb_host_config());
+	sim_at(MS(500), [] {
+		set_idle(IDLE_RATE);
+		get_idle(&host.idle_set);
+	});
+	sim_at(MS(520), [] { sim_button(0, true); });
+	sim_at(IDLE_TO, [] {
+		set_idle(0);
+		get_idle(&host.idle_off);
+	});
+	sim_at(MS(850), [] { sim_button(0, false); });
+	sim_at(MOVE_FROM, [] { sim_sensor_velocity(2, -1); });
+	// between the polls, at a rate that does not divide the frame
+	for (uint64_t t = MOVE_FROM + MS(10); t < MOVE_TO; t += US(7300))
+		sim_at(t, get_report);
+	sim_at(MOVE_TO, [] { sim_sensor_velocity(0, 0); });
+	sim_at(MS(1250), [] { sim_button(1, true); });
+	sim_at(MS(1300), [] {
+		host.get_buttons = 0;
+		get_report();
+	});
+	sim_at(MS(1350), [] { sim_button(1, false); });
+	sim_run(entry, MS(1500));
+
+	// every IDLE_RATE * 4 frames, give or take the poll jitter
+	unsigned gaps_bad = 0;
+	for (size_t i = 1; i < host.idle_reports.size(); i++) {
+		const uint64_t gap = host.idle_reports[i] - host.idle_reports[i - 1];
+		if (gap < MS(IDLE_RATE * 4) - US(50)
+				|| gap > MS(IDLE_RATE * 4) + US(50))
+			++gaps_bad;
+	}
+	const int64_t total_x = host.x + host.get_x;
+	const int64_t total_y = host.y + host.get_y;
+	printf("idle rate %d, then %d: %zu reports in %.0f ms, %u gaps off\n",
+	       host.idle_set, host.idle_off, host.idle_reports.size(),
+	       (double)(IDLE_TO - IDLE_FROM) / MS(1), gaps_bad);
+	printf("%u get reports, %u with motion, %lld,%lld of it\n",
+	       host.gets, host.get_motion, (long long)host.get_x,
+	       (long long)host.get_y);
+	printf("motion: sensor %lld,%lld host %lld,%lld\n",
+	       (long long)sim_sensor.latched_x, (long long)sim_sensor.latched_y,
+	       (long long)total_x, (long long)total_y);
+	printf("%llu control stalls, %llu tokens without response\n\n",
+	       (unsigned long long)sim_usb.control_stalls,
+	       (unsigned long long)sim_usb.no_response);
+
+	const size_t idle_expected = (IDLE_TO - IDLE_FROM) / MS(IDLE_RATE * 4);
+	int failed = 0;
+	failed += check(host.idle_set == IDLE_RATE && !host.idle_off,
+			"get idle");
+	failed += check(host.idle_reports.size() >= idle_expected - 1
+			&& host.idle_reports.size() <= idle_expected + 1
+			&& !gaps_bad && !host.idle_bad, "idle rate");
+	failed += check(!host.quiet_reports, "no reports without idle rate");
+	failed += check(!host.get_failed && host.get_motion > 10,
+			"get report");
+	failed += check(sim_sensor.latched_x && sim_sensor.latched_y
+			&& total_x == sim_sensor.latched_x
+			&& total_y == sim_sensor.latched_y, "all motion reported once");
+	failed += check(host.get_buttons == 2, "button in get report");
+	failed += check(!sim_usb.control_stalls && !sim_usb.no_response,
+			"no control stalls");
+	failed += check(!sim_sensor.t_srad && !sim_sensor.t_srad_motbr
+			&& !sim_sensor.t_sww && !sim_sensor.t_swr
+			&& !sim_sensor.t_srw && !sim_sensor.t_srom,
+			"sensor timing");
+	failed += check(!sched_overruns, "slot overruns");
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
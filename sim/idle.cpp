@@ -0,0 +1,80 @@
+/* SPI and cpu time per second of a mouse that lies still, on the virtual
+ * M1K.
+ *
+ * After the boot the mouse lies still for two seconds, which are measured,
+ * then it moves and stops again. Reports per idle second the SPI bytes
+ * clocked, the bursts and the cycles the cpu was awake. Built once with
+ * the gated burst (idle_gated) and once with PMW3366_BURST_UNGATED
+ * (idle_ungated), make bench runs both. Exits non-zero if the motion after
+ * the idle time is not reported in full or a sensor timing is violated.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <avr/io.h>
+#include "usb_mouse.h"
+#include "test.h"
+
+#define IDLE_FROM MS(1000)
+#define IDLE_TO MS(3000)
+
+#ifdef PMW3366_BURST_UNGATED
+#define BURST "ungated"
+#else
+#define BURST "gated"
+#endif
+
+static int64_t host_x, host_y;
+
+static void on_report(uint8_t ep, const uint8_t *data, uint8_t len)
+{
+	if (ep != MOUSE_ENDPOINT || len < 5)
+		return;
+	host_x += (int16_t)(data[1] | data[2] << 8);
+	host_y += (int16_t)(data[3] | data[4] << 8);
+}
+
+static bool measuring;
+
+static struct {
+	uint64_t bytes, bursts, sleep;
+} at_start, at_end;
+
+static void snapshot(void)
+{
+	auto &s = measuring ? at_end : at_start;
+	s.bytes = sim_sensor.bytes;
+	s.bursts = sim_sensor.bursts;
+	s.sleep = sim_sleep_cycles;
+	measuring = !measuring;
+}
+
+int main(void)
+{
+	sim_reset();
+	sim_usb_on_report(on_report);
+	sim_usb_host_start(sim_usb_host_config());
+	sim_at(IDLE_FROM, snapshot);
+	sim_at(IDLE_TO, snapshot);
+	sim_at(MS(3200), [] { sim_sensor_velocity(10, -7); });
+	sim_at(MS(3700), [] { sim_sensor_velocity(0, 0); });
+	sim_run(entry, MS(4000));
+
+	const double seconds = (double)(IDLE_TO - IDLE_FROM) / MS(1000);
+	const uint64_t awake = IDLE_TO - IDLE_FROM - (at_end.sleep - at_start.sleep);
+	printf("%-8s idle: %7.0f spi bytes/s, %6.0f bursts/s, "
+	       "awake %8.0f cycles/s (%.1f%%)\n", BURST,
+	       (at_end.bytes - at_start.bytes) / seconds,
+	       (at_end.bursts - at_start.bursts) / seconds,
+	       awake / seconds,
+	       100.0 * awake / (IDLE_TO - IDLE_FROM));
+
+	const bool ok = sim_sensor.latched_x && host_x == sim_sensor.latched_x
+		&& host_y == sim_sensor.latched_y
+		&& !sim_sensor.t_srad && !sim_sensor.t_srad_motbr
+		&& !sim_sensor.t_sww && !sim_sensor.t_swr
+		&& !sim_sensor.t_srw && !sim_sensor.t_srom;
+	if (!ok)
+		printf("FAIL: motion lost or sensor timing\n");
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
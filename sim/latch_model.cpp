@@ -0,0 +1,92 @@
+/* Motion to report age as a function of the slot phase.
+ *
+ * Deterministic model of one USB frame: the sensor is read at the start of
+ * each of the 8 slots, the report is committed to the endpoint work_us later
+ * and the host polls once per frame, poll_us after the SOF with up to
+ * poll_jitter_us of random spread. For motion happening at any time in the
+ * frame, the age is the time until the first poll that returns a report
+ * containing it.
+ *
+ * Sweeps the offset of slot 0 from the SOF (the phase) over one slot and
+ * prints the age distribution for each, plus the LATE_LATCH_US that sched.c
+ * needs to get there. The model ends the work of slot 7 exactly on time;
+ * the scheduler needs a few us more before the SOF, see latch_timing.
+ *
+ * usage: latch_model [work_us [poll_us [poll_jitter_us]]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+
+#define FRAME_US 1000.0
+#define SLOT_US (FRAME_US / 8)
+#define STEP_US 0.25
+#define POLL_SAMPLES 16
+
+struct age_stats {
+	double mean, p50, p99, max;
+};
+
+static age_stats model(double phase, double work, double poll, double jitter)
+{
+	std::vector<double> ages;
+	for (int j = 0; j < POLL_SAMPLES; ++j) {
+		const double poll_at = poll + jitter * (j + 0.5) / POLL_SAMPLES;
+		// the report of slot s is visible at phase + s * SLOT + work; the
+		// host takes whatever is committed last at its poll
+		for (double t = 0; t < FRAME_US; t += STEP_US) {
+			// next read at or after the motion
+			double read = phase;
+			while (read < t)
+				read += SLOT_US;
+			const double commit = read + work;
+			// first poll after the commit
+			double report = poll_at;
+			while (report < commit)
+				report += FRAME_US;
+			ages.push_back(report - t);
+		}
+	}
+	std::sort(ages.begin(), ages.end());
+	age_stats s;
+	double sum = 0;
+	for (double a : ages)
+		sum += a;
+	s.mean = sum / ages.size();
+	s.p50 = ages[ages.size() / 2];
+	s.p99 = ages[ages.size() * 99 / 100];
+	s.max = ages.back();
+	return s;
+}
+
+int main(int argc, char **argv)
+{
+	const double work = argc > 1 ? atof(argv[1]) : 60;
+	const double poll = argc > 2 ? atof(argv[2]) : 2;
+	const double jitter = argc > 3 ? atof(argv[3]) : 10;
+
+	printf("slot work %.1f us, host poll %.1f..%.1f us after SOF\n\n",
+	       work, poll, poll + jitter);
+	printf("phase  LATE_LATCH_US   mean    p50    p99    max\n");
+
+	double best_phase = 0, best_mean = 1e9;
+	for (double phase = 0; phase < SLOT_US; phase += 5) {
+		const age_stats s = model(phase, work, poll, jitter);
+		// slot 7 ends at phase + 7 * SLOT + work, LATE_LATCH_US before
+		// the next SOF
+		const double latch = SLOT_US - phase - work;
+		printf("%5.0f  %13.0f  %5.1f  %5.1f  %5.1f  %5.1f\n",
+		       phase, latch, s.mean, s.p50, s.p99, s.max);
+		if (s.mean < best_mean) {
+			best_mean = s.mean;
+			best_phase = phase;
+		}
+	}
+	const age_stats sof = model(0, work, poll, jitter);
+	printf("\nbest phase %.0f us (LATE_LATCH_US %.0f): mean age %.1f us, "
+	       "%.1f us less than starting slot 0 at the SOF\n",
+	       best_phase, SLOT_US - best_phase - work, best_mean,
+	       sof.mean - best_mean);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,118 @@
+/* Slot timing of the late latch scheduler (sched.c built with LATE_LATCH_US).
+ *
+ * Runs the scheduler against a SOF that drifts relative to the cpu clock and
+ * occasionally goes missing, and checks that
+ *  - every frame gets its 8 slots, in order, without overruns,
+ *  - the SOF period estimate follows the drift,
+ *  - slot 7 finishes LATE_LATCH_US before the next SOF, with the return
+ *    from the interrupt that runs it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "sched.h"
+
+#define FRAMES 20000
+#define WARMUP 100
+#define RUN_CYCLES ((uint64_t)FRAMES * 8000)
+#define SOF_PERIOD (8000 * (1 + 250e-6)) // 250ppm fast crystal on the host
+#define SOF_JITTER 2
+#define SLOT_WORK_CYCLES 480
+#define LEAD_CYCLES (LATE_LATCH_US * 8)
+#define LEAD_TOLERANCE 32
+
+static uint64_t frames = 0;
+static uint8_t expected_slot = 0;
+static bool out_of_order = false;
+static uint64_t slot7_end = 0;
+static bool slot7_running = false;
+static uint64_t lead_n = 0, lead_sum = 0;
+static int64_t lead_min = INT64_MAX, lead_max = INT64_MIN;
+
+void slot_task(uint8_t slot)
+{
+	if (slot != expected_slot)
+		out_of_order = true;
+	expected_slot = (slot + 1) % SCHED_SLOTS;
+
+	if (slot == 0) {
+		++frames;
+		// skip frames whose SOF was dropped
+		if (frames > WARMUP && sim_last_sof > slot7_end) {
+			const int64_t lead = sim_last_sof - slot7_end;
+			lead_sum += lead;
+			++lead_n;
+			if (lead < lead_min)
+				lead_min = lead;
+			if (lead > lead_max)
+				lead_max = lead;
+		}
+	}
+	sim_delay_cycles(SLOT_WORK_CYCLES + (slot == 7 ? sim_now % 8 : 0));
+	if (slot == 7)
+		slot7_running = true;
+}
+
+// interrupts do not nest: the first to return after slot 7 is its own
+static void on_isr(int, uint64_t taken, uint64_t cycles)
+{
+	if (!slot7_running)
+		return;
+	slot7_end = taken + cycles;
+	slot7_running = false;
+}
+
+ISR(USB_GEN_vect)
+{
+	const uint8_t intbits = UDINT;
+	UDINT = 0;
+	if (intbits & (1<<SOFI))
+		sched_sof();
+}
+
+static void sched_main(void)
+{
+	sched_init();
+	while (1)
+		sched_idle();
+}
+
+int main(void)
+{
+	sim_reset();
+	sim_on_isr(on_isr);
+	sim_sof_start(SOF_PERIOD, 8000, SOF_JITTER);
+	sim_sof_miss_every = 97;
+	sim_run(sched_main, RUN_CYCLES);
+
+	const double period = sched_sof_period() / 16.0;
+	printf("late latch %u us: %llu frames, period %.2f (SOF %.2f), "
+	       "%u overruns\n", LATE_LATCH_US, (unsigned long long)frames,
+	       period, SOF_PERIOD, sched_overruns);
+	printf("slot 7 end to SOF: %lld..%lld avg %.1f cycles (target %d)\n",
+	       (long long)lead_min, (long long)lead_max,
+	       lead_n ? (double)lead_sum / lead_n : 0.0, LEAD_CYCLES);
+
+	bool ok = true;
+	const uint64_t sof_frames = (RUN_CYCLES - 8000) / SOF_PERIOD;
+	if (frames < sof_frames || out_of_order || sched_overruns) {
+		printf("FAIL: missing, out of order or overrun slots\n");
+		ok = false;
+	}
+	if (period < SOF_PERIOD - 1 || period > SOF_PERIOD + 1) {
+		printf("FAIL: SOF period not tracked\n");
+		ok = false;
+	}
+	if (lead_min < LEAD_CYCLES - LEAD_TOLERANCE
+			|| lead_max > LEAD_CYCLES + LEAD_TOLERANCE) {
+		printf("FAIL: slot 7 not latched %d cycles before SOF\n",
+		       LEAD_CYCLES);
+		ok = false;
+	}
+	if (!ok)
+		return EXIT_FAILURE;
+	printf("OK\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,165 @@
+/* Virtual M1K: the complete firmware (main.c and everything it links) on the
+ * emulated ATmega32U2, with a PMW3366 on the SPI bus and a USB host that
+ * enumerates the device and polls the mouse endpoint.
+ *
+ * After the boot the sensor is moved and the buttons are clicked; the host
+ * side sums up the reports. Exits non-zero if the device does not enumerate,
+ * the reported motion or buttons differ from what was done to the mouse,
+ * the firmware violates a sensor timing or uses a block whose clock it
+ * stopped in PRR0/PRR1.
+ *
+ * m1k_xy12 is the same with 12 bit X/Y in the mouse report.
+ *
+ * usage: m1k [seconds]   (virtual time to run, default 5)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <avr/io.h>
+#include "sched.h"
+#include "usb_mouse.h"
+#include "test.h"
+
+// SROM_ID after the download, the second byte of the image. The image is
+// picked by the eeprom config, whose default is SROM_VERSION of mouse.c;
+// m1k_srom3 builds that and this with another SROM_VERSION than the rest
+#define SROM_ID SROM_VERSION
+
+static struct {
+	int64_t x, y;
+	uint8_t buttons;
+	uint32_t presses[2], releases[2];
+	uint64_t bad_length;
+} host;
+
+static void on_report(uint8_t ep, const uint8_t *data, uint8_t len)
+{
+	if (ep != MOUSE_ENDPOINT)
+		return;
+	if (len != MOUSE_REPORT_SIZE) {
+		++host.bad_length;
+		return;
+	}
+	for (uint8_t b = 0; b < 2; ++b) {
+		const uint8_t mask = 1 << b;
+		if ((data[0] & mask) && !(host.buttons & mask))
+			++host.presses[b];
+		if (!(data[0] & mask) && (host.buttons & mask))
+			++host.releases[b];
+	}
+	host.buttons = data[0];
+#if MOUSE_XY_BITS == 12
+	// sign extended from bit 11
+	host.x += (int16_t)((data[1] | data[2] << 8) << 4) >> 4;
+	host.y += (int16_t)((data[2] >> 4 | data[3] << 4) << 4) >> 4;
+#else
+	host.x += (int16_t)(data[1] | data[2] << 8);
+	host.y += (int16_t)(data[3] | data[4] << 8);
+#endif
+}
+
+static void click(uint8_t button, uint64_t at, uint64_t duration)
+{
+	sim_at(at, [=] { sim_button(button, true); });
+	sim_at(at + duration, [=] { sim_button(button, false); });
+}
+
+int main(int argc, char **argv)
+{
+	const double seconds = argc > 1 ? atof(argv[1]) : 5;
+	const uint64_t end = (uint64_t)(seconds * MS(1000));
+	// sensor init and enumeration are done well before this
+	const uint64_t start = MS(1000);
+	if (end < start + MS(1000)) {
+		fprintf(stderr, "m1k: run for at least 2 seconds\n");
+		return EXIT_FAILURE;
+	}
+
+	sim_reset();
+	// no DPI jumper: PD4/PD6 read their pull-ups
+	sim_usb_on_report(on_report);
+	sim_usb_host_start(sim_usb_host_config());
+
+	// stop moving 500ms before the end, so that all motion is reported
+	const uint64_t still = end - MS(500);
+	sim_at(start, [] { sim_sensor_velocity(12.5, -4); });
+	sim_at(start + MS(200), [] { sim_sensor_velocity(-60, 35); });
+	sim_at(start + MS(300), [] { sim_sensor_move(0.5, -0.25); });
+	// more than a 12 bit report takes, see MOUSE_XY_BITS
+	sim_at(start + MS(350), [] { sim_sensor_move(-3, 3); });
+	sim_at(start + MS(400), [] { sim_sensor_velocity(0.3, 0.1); });
+	sim_at(still, [] { sim_sensor_velocity(0, 0); });
+	click(0, start + MS(100), MS(40));
+	click(1, start + MS(250), MS(60));
+	click(0, start + MS(500), MS(5));
+
+	const clock_t wall = clock();
+	sim_run(entry, end);
+	const double wall_s = (double)(clock() - wall) / CLOCKS_PER_SEC;
+
+	const double configured_ms = (double)sim_usb.configured_at / MS(1);
+	printf("srom %u bytes, id 0x%02x, done at %.1f ms\n",
+	       sim_sensor.srom_bytes, sim_sensor_reg(0x2a),
+	       (double)sim_sensor.srom_done_at / MS(1));
+	printf("configured at %.1f ms, %llu control transfers, %llu naks\n",
+	       configured_ms,
+	       (unsigned long long)sim_usb.control_transfers,
+	       (unsigned long long)sim_usb.control_naks);
+	printf("%llu polls, %llu reports, %llu naks\n",
+	       (unsigned long long)sim_usb.polls,
+	       (unsigned long long)sim_usb.reports,
+	       (unsigned long long)sim_usb.poll_naks);
+	printf("motion: sensor %lld,%lld host %lld,%lld, %u cpi\n",
+	       (long long)sim_sensor.latched_x, (long long)sim_sensor.latched_y,
+	       (long long)host.x, (long long)host.y, sim_sensor_cpi());
+	printf("buttons: presses %u,%u releases %u,%u\n",
+	       host.presses[0], host.presses[1],
+	       host.releases[0], host.releases[1]);
+	printf("sensor timing violations: t_srad %u t_srad_motbr %u t_sww %u "
+	       "t_swr %u t_srw %u t_srom %u\n",
+	       sim_sensor.t_srad, sim_sensor.t_srad_motbr, sim_sensor.t_sww,
+	       sim_sensor.t_swr, sim_sensor.t_srw, sim_sensor.t_srom);
+	printf("%llu control stalls, %llu tokens without response\n",
+	       (unsigned long long)sim_usb.control_stalls,
+	       (unsigned long long)sim_usb.no_response);
+	printf("%llu bursts, %u slot overruns\n",
+	       (unsigned long long)sim_sensor.bursts, sched_overruns);
+	printf("%.1f s virtual in %.2f s, %.0fx real time\n\n",
+	       seconds, wall_s, wall_s > 0 ? seconds / wall_s : 0);
+
+	int failed = 0;
+	failed += check(sim_sensor.srom_bytes == 4094, "srom downloaded");
+	failed += check(sim_sensor_reg(0x2a) == SROM_ID, "srom id");
+	failed += check(!sim_sensor.t_srad && !sim_sensor.t_srad_motbr
+			&& !sim_sensor.t_sww && !sim_sensor.t_swr
+			&& !sim_sensor.t_srw && !sim_sensor.t_srom,
+			"sensor timing");
+	failed += check(!sim_sensor.burst_unarmed && !sim_sensor.wcol,
+			"sensor spi protocol");
+	failed += check(sim_usb_host_configured()
+			&& sim_usb.configured_at < start, "enumerated");
+	failed += check(!sim_usb.no_response, "no bus timeouts");
+	failed += check(!sim_usb.control_stalls, "no control stalls");
+	failed += check(sim_sensor_cpi() == 800, "cpi from eeprom");
+	failed += check(sim_sensor.latched_x && sim_sensor.latched_y
+			&& host.x == sim_sensor.latched_x
+			&& host.y == sim_sensor.latched_y
+			&& !sim_sensor.saturated, "all motion reported");
+	failed += check(!host.bad_length, "report length");
+	failed += check(host.presses[0] == 2 && host.releases[0] == 2
+			&& host.presses[1] == 1 && host.releases[1] == 1
+			&& !host.buttons, "buttons");
+	// the eeprom config is written to the sensor between bursts
+	failed += check(!sched_overruns, "slot overruns");
+	failed += check(!sim_bootloader_entered, "no bootloader");
+	// of the sensor transports (m1k_usart has the other) only the one in
+	// use is clocked; the analog comparator is off
+	const uint8_t prr0 = PRR0, prr1 = PRR1, acsr = ACSR;
+	failed += check(!(prr0 & _BV(PRSPI)) != !(prr1 & _BV(PRUSART1))
+			&& (acsr & _BV(ACD)) && !sim_prr_errors, "power reduction");
+	// virtual time is only useful if it is cheaper than the real thing
+	failed += check(wall_s < seconds, "faster than real time");
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,34 @@
+/* Interface between the emulator core (sim.cpp) and the peripherals that
+ * live in their own files. Not for use by scenarios or firmware. */
+#ifndef SIM_PERIPH_H
+#define SIM_PERIPH_H
+
+#include "sim.h"
+
+#define SIM_NEVER UINT64_MAX
+
+/* registers without side effects, indexed by data space address */
+extern uint8_t sim_io[0x100];
+
+struct sim_device {
+	void (*reset)(void);
+	/* first cycle at which update has work to do */
+	uint64_t (*next_event)(void);
+	/* processes everything due at or before sim_now */
+	void (*update)(void);
+	/* register hooks, return false for registers they do not handle */
+	bool (*read)(uint16_t addr, uint8_t *value);
+	bool (*write)(uint16_t addr, uint8_t value);
+};
+
+extern const sim_device sim_usb_device;	/* usb.cpp */
+extern const sim_device sim_spi_device;	/* pmw3366.cpp */
+
+/* start of frame, called by the SOF generator in sim.cpp */
+void sim_usb_sof(uint64_t when, uint16_t frame);
+/* USB_COM interrupt request */
+bool sim_usb_com_pending(void);
+
+uint32_t sim_rand(void);
+
+#endif
@@ -0,0 +1,645 @@
+/* SPI master of the ATmega32U2 with a PMW3366 sensor on it.
+ *
+ * The SPI transfers a byte in 8 SCK periods, sets SPIF at the end and
+ * clears it on the SPSR read / SPDR access sequence; writing SPDR during a
+ * transfer sets WCOL. USART1 in master SPI mode (MSPIM) is the other way to
+ * reach the sensor: UDR1 writes go to a one byte transmit buffer that feeds
+ * the shift register, so a byte written while another one shifts follows
+ * it without a gap, and received bytes go to a two byte FIFO (a third one
+ * sets DOR1). Its pins are not modelled, the sensor simply listens to
+ * whichever of the two is clocking. The sensor answers each byte according to its
+ * protocol state: address, write data, read data, motion burst, SROM
+ * download, raw data burst. Motion is integrated from a surface velocity at
+ * the current CPI and latched into Delta_X/Y by a Motion read or a burst; a
+ * frame capture stops it until the next power up reset, its pixels are
+ * made up by sim_sensor_pixel. The datasheet
+ * timings between bytes and commands are checked and violations counted in
+ * sim_sensor.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#define SIM_REG(addr) (addr)
+#define SIM_REG16(addr) (addr)
+#include <avr/io.h>
+#include "periph.h"
+
+sim_sensor_stats sim_sensor;
+
+#define US(t) ((uint64_t)(t) * SIM_CYCLES_PER_US)
+
+/* datasheet timings */
+#define T_SRAD		US(160)	// read address to data
+#define T_SRAD_MOTBR	US(35)	// burst address to first data
+#define T_SWW		US(180)	// write to next write
+#define T_SWR		US(180)	// write to next read
+#define T_SRW		US(20)	// read to next command
+#define T_SROM		US(15)	// between SROM download bytes
+#define T_CAPTURE	US(20000) // frame capture to the raw data burst
+#define T_RAW		US(15)	// between raw data burst bytes
+
+#define NCS_BIT		PB6
+#define BURST_LENGTH	12
+#define FRAME_PIXELS	(36 * 36)
+
+/* registers */
+#define REG_PRODUCT_ID		0x00
+#define REG_REVISION_ID		0x01
+#define REG_MOTION		0x02
+#define REG_DELTA_X_L		0x03
+#define REG_SQUAL		0x07
+#define REG_CONFIG1		0x0f
+#define REG_CONFIG2		0x10
+#define REG_FRAME_CAPTURE	0x12
+#define REG_SROM_ID		0x2a
+#define REG_POWER_UP_RESET	0x3a
+#define REG_SHUTDOWN		0x3b
+#define REG_INVERSE_PRODUCT_ID	0x3f
+#define REG_MOTION_BURST	0x50
+#define REG_SROM_LOAD_BURST	0x62
+#define REG_RAW_DATA_BURST	0x64
+
+#define SQUAL_TRACKING 0x30
+
+static struct {
+	bool busy;
+	uint64_t done_at;
+	uint8_t out;
+	uint8_t in;
+	uint8_t spdr;
+	bool spif_seen;	// SPSR read with SPIF set, the SPDR access clears it
+} spi;
+
+static struct {
+	bool shifting;
+	uint64_t done_at;
+	uint8_t out, in;
+	bool tx_full;
+	uint8_t tx;
+	uint8_t rx[2];
+	int rx_count;
+} usart;
+
+enum sensor_state { ADDR, WRITE_DATA, READ_DATA, BURST, SROM, RAW };
+
+static struct {
+	uint8_t reg[128];
+	bool selected;
+	bool shutdown;
+	sensor_state state;
+	uint8_t addr;
+	bool burst_armed;
+	uint8_t burst[BURST_LENGTH];
+	int burst_pos;
+	uint64_t byte_start;
+	uint64_t addr_end;
+	uint64_t last_write_end, last_read_end;
+	uint64_t last_srom_byte;
+	uint64_t burst_data_start;
+	std::vector<uint8_t> srom;
+	// frame capture
+	bool capture_started;	// 0x83 written to Frame_Capture
+	bool captured;		// navigation stopped by a frame capture
+	uint64_t captured_at;	// frame to read, 0 if none
+	int raw_pos;
+	uint64_t last_raw_byte;
+	// motion
+	double vx, vy;		// inches per second
+	uint64_t motion_at;	// time acc_x/y was integrated up to
+	double acc_x, acc_y;	// counts not yet latched
+	bool lifted;
+} sns;
+
+/**************************************************************************
+ *  sensor
+ **************************************************************************/
+
+uint16_t sim_sensor_cpi(void)
+{
+	return (sns.reg[REG_CONFIG1] + 1) * 100;
+}
+
+static void integrate(void)
+{
+	const double dt = (double)(sim_now - sns.motion_at) / F_CPU;
+	sns.motion_at = sim_now;
+	if (sns.lifted || sns.shutdown || sns.captured)
+		return;
+	sns.acc_x += sns.vx * dt * sim_sensor_cpi();
+	sns.acc_y += sns.vy * dt * sim_sensor_cpi();
+}
+
+void sim_sensor_velocity(double x_ips, double y_ips)
+{
+	integrate();
+	sns.vx = x_ips;
+	sns.vy = y_ips;
+}
+
+void sim_sensor_move(double x_in, double y_in)
+{
+	integrate();
+	if (sns.lifted || sns.shutdown)
+		return;
+	sns.acc_x += x_in * sim_sensor_cpi();
+	sns.acc_y += y_in * sim_sensor_cpi();
+}
+
+void sim_sensor_lift(bool lifted)
+{
+	integrate();
+	sns.lifted = lifted;
+}
+
+uint8_t sim_sensor_reg(uint8_t addr)
+{
+	return sns.reg[addr & 0x7f];
+}
+
+uint8_t sim_sensor_pixel(uint16_t i)
+{
+	// a diagonal gradient with some texture
+	return ((i % 36 + i / 36) * 2 + (i * 7 % 11)) & 0x7f;
+}
+
+static int16_t take_counts(double *acc, int64_t *latched)
+{
+	double whole = trunc(*acc);
+	*acc -= whole;
+	if (whole > INT16_MAX || whole < -INT16_MAX) {
+		const double clipped = whole > 0 ? INT16_MAX : -INT16_MAX;
+		sim_sensor.saturated += (uint64_t)fabs(whole - clipped);
+		whole = clipped;
+	}
+	*latched += (int64_t)whole;
+	return (int16_t)whole;
+}
+
+// moves the motion since the last latch into the motion registers
+static void latch_motion(void)
+{
+	integrate();
+	const int16_t dx = take_counts(&sns.acc_x, &sim_sensor.latched_x);
+	const int16_t dy = take_counts(&sns.acc_y, &sim_sensor.latched_y);
+	sns.reg[REG_MOTION] = (dx || dy ? 0x80 : 0) | (sns.lifted ? 0x08 : 0);
+	sns.reg[REG_DELTA_X_L] = dx & 0xff;
+	sns.reg[REG_DELTA_X_L + 1] = (uint16_t)dx >> 8;
+	sns.reg[REG_DELTA_X_L + 2] = dy & 0xff;
+	sns.reg[REG_DELTA_X_L + 3] = (uint16_t)dy >> 8;
+	sns.reg[REG_SQUAL] = sns.lifted ? 0 : SQUAL_TRACKING;
+}
+
+static void power_up_reset(void)
+{
+	integrate();
+	memset(sns.reg, 0, sizeof(sns.reg));
+	sns.reg[REG_PRODUCT_ID] = 0x42;
+	sns.reg[REG_REVISION_ID] = 0x01;
+	sns.reg[REG_INVERSE_PRODUCT_ID] = 0xbd;
+	sns.reg[REG_CONFIG1] = 0x31;
+	sns.reg[0x08] = 0x80; // Raw_Data_Sum
+	sns.reg[0x09] = 0xa0; // Maximum_Raw_Data
+	sns.reg[0x0a] = 0x60; // Minimum_Raw_Data
+	sns.reg[0x0b] = 0x20; // Shutter_Lower
+	sns.shutdown = false;
+	sns.burst_armed = false;
+	sns.capture_started = sns.captured = false;
+	sns.captured_at = 0;
+	sns.acc_x = sns.acc_y = 0;
+}
+
+static void write_reg(uint8_t addr, uint8_t value)
+{
+	if (sns.shutdown && addr != REG_POWER_UP_RESET)
+		return;
+	switch (addr) {
+	case REG_POWER_UP_RESET:
+		if (value == 0x5a)
+			power_up_reset();
+		return;
+	case REG_SHUTDOWN:
+		if (value == 0xb6) {
+			integrate();
+			sns.shutdown = true;
+		}
+		return;
+	case REG_MOTION_BURST:
+		sns.burst_armed = true;
+		return;
+	case REG_CONFIG1:
+		integrate(); // motion so far at the old cpi
+		break;
+	case REG_FRAME_CAPTURE:
+		// 0x83 then 0xc5, with the rest modes off
+		if (value == 0xc5 && sns.capture_started
+		    && !(sns.reg[REG_CONFIG2] & 0x20)) {
+			integrate();
+			sns.captured = true;
+			sns.captured_at = sim_now;
+		}
+		sns.capture_started = value == 0x83;
+		break;
+	}
+	sns.reg[addr] = value;
+}
+
+static uint8_t read_reg(uint8_t addr)
+{
+	if (sns.shutdown)
+		return 0;
+	if (addr == REG_MOTION)
+		latch_motion();
+	return sns.reg[addr];
+}
+
+static void check_gap(uint64_t since, uint64_t min, uint32_t *violations)
+{
+	if (since && sns.byte_start - since < min)
+		++*violations;
+}
+
+// MISO for the byte starting now
+static uint8_t byte_begin(uint8_t out)
+{
+	sns.byte_start = sim_now;
+	switch (sns.state) {
+	case ADDR:
+		check_gap(sns.last_write_end, out & 0x80 ? T_SWW : T_SWR,
+			  out & 0x80 ? &sim_sensor.t_sww : &sim_sensor.t_swr);
+		check_gap(sns.last_read_end, T_SRW, &sim_sensor.t_srw);
+		return 0;
+	case READ_DATA:
+		check_gap(sns.addr_end, T_SRAD, &sim_sensor.t_srad);
+		return read_reg(sns.addr);
+	case BURST:
+		if (sns.burst_pos == 0) {
+			check_gap(sns.addr_end, T_SRAD_MOTBR, &sim_sensor.t_srad_motbr);
+			sns.burst_data_start = sim_now;
+		}
+		return sns.burst_pos < BURST_LENGTH ? sns.burst[sns.burst_pos] : 0;
+	case RAW:
+		if (sns.raw_pos == 0) {
+			check_gap(sns.addr_end, T_SRAD, &sim_sensor.t_srad);
+			if (sim_now - sns.captured_at < T_CAPTURE)
+				++sim_sensor.t_raw;
+		} else {
+			check_gap(sns.last_raw_byte, T_RAW, &sim_sensor.t_raw);
+		}
+		return sns.raw_pos < FRAME_PIXELS ? sim_sensor_pixel(sns.raw_pos) : 0;
+	case SROM:
+		check_gap(sns.last_srom_byte, T_SROM, &sim_sensor.t_srom);
+		if (sns.srom.empty())
+			sim_sensor.srom_start_at = sim_now;
+		sns.last_srom_byte = sim_now;
+		return 0;
+	case WRITE_DATA:
+		return 0;
+	}
+	return 0;
+}
+
+static void start_burst(void)
+{
+	latch_motion();
+	sns.burst[0] = sns.reg[REG_MOTION];
+	sns.burst[1] = sns.reg[0x20]; // Observation
+	for (int i = 0; i < 4; i++)
+		sns.burst[2 + i] = sns.reg[REG_DELTA_X_L + i];
+	sns.burst[6] = sns.reg[REG_SQUAL];
+	sns.burst[7] = sns.reg[0x08];
+	sns.burst[8] = sns.reg[0x09];
+	sns.burst[9] = sns.reg[0x0a];
+	sns.burst[10] = sns.reg[0x0c]; // Shutter_Upper
+	sns.burst[11] = sns.reg[0x0b]; // Shutter_Lower
+	sns.burst_pos = 0;
+	++sim_sensor.bursts;
+}
+
+static void byte_end(uint8_t out)
+{
+	++sim_sensor.bytes;
+	switch (sns.state) {
+	case ADDR:
+		sns.addr_end = sim_now;
+		if (out & 0x80) {
+			sns.addr = out & 0x7f;
+			if (sns.addr == REG_SROM_LOAD_BURST && !sns.shutdown) {
+				sns.state = SROM;
+				sns.srom.clear();
+				sns.last_srom_byte = sim_now;
+			} else {
+				sns.state = WRITE_DATA;
+			}
+		} else if (out == REG_RAW_DATA_BURST && sns.captured_at) {
+			sns.raw_pos = 0;
+			sns.state = RAW;
+		} else if (out == REG_MOTION_BURST && !sns.shutdown) {
+			if (sns.burst_armed) {
+				start_burst();
+				sns.state = BURST;
+			} else {
+				++sim_sensor.burst_unarmed;
+				sns.addr = out;
+				sns.state = READ_DATA;
+			}
+		} else {
+			sns.addr = out;
+			sns.state = READ_DATA;
+		}
+		break;
+	case WRITE_DATA:
+		write_reg(sns.addr, out);
+		sns.last_write_end = sim_now;
+		++sim_sensor.writes;
+		sns.state = ADDR;
+		break;
+	case READ_DATA:
+		sns.last_read_end = sim_now;
+		++sim_sensor.reads;
+		// a read of any other register ends burst mode
+		if (sns.addr != REG_MOTION_BURST)
+			sns.burst_armed = false;
+		sns.state = ADDR;
+		break;
+	case BURST:
+		++sns.burst_pos;
+		break;
+	case SROM:
+		sns.srom.push_back(out);
+		break;
+	case RAW:
+		sns.last_raw_byte = sim_now;
+		if (++sns.raw_pos == FRAME_PIXELS)
+			++sim_sensor.frames;
+		break;
+	}
+}
+
+static void deselect(void)
+{
+	if (sns.state == BURST && sns.burst_pos > 0) {
+		const uint64_t t = sim_now - sns.burst_data_start;
+		sim_sensor.burst_read_cycles += t;
+		if (t > sim_sensor.burst_read_max)
+			sim_sensor.burst_read_max = t;
+	}
+	if (sns.state == SROM) {
+		uint32_t hash = 2166136261u;
+		for (uint8_t b : sns.srom)
+			hash = (hash ^ b) * 16777619u;
+		sim_sensor.srom_bytes = sns.srom.size();
+		sim_sensor.srom_hash = hash;
+		sim_sensor.srom_done_at = sim_now;
+		// the second byte of the image is its version
+		sns.reg[REG_SROM_ID] = sns.srom.size() > 1 ? sns.srom[1] : 0;
+	}
+	// the frame is read once, the next one needs another capture
+	if (sns.state == RAW)
+		sns.captured_at = 0;
+	sns.state = ADDR;
+}
+
+static void update_ncs(void)
+{
+	const bool selected = (sim_io[0x24] & _BV(NCS_BIT))
+		&& !(sim_io[0x25] & _BV(NCS_BIT));
+	if (selected == sns.selected)
+		return;
+	sns.selected = selected;
+	if (selected)
+		sns.state = ADDR;
+	else
+		deselect();
+}
+
+/**************************************************************************
+ *  SPI
+ **************************************************************************/
+
+static uint32_t spi_byte_cycles(void)
+{
+	static const uint8_t div[4] = {4, 16, 64, 128};
+	uint32_t d = div[sim_io[0x4C] & 3];
+	if (sim_io[0x4D] & _BV(SPI2X))
+		d /= 2;
+	return 8 * d;
+}
+
+static void spi_complete(void)
+{
+	spi.busy = false;
+	if (sns.selected)
+		byte_end(spi.out);
+	spi.spdr = spi.in;
+	sim_io[0x4D] |= _BV(SPIF);
+}
+
+static void spi_clear_flags(void)
+{
+	if (spi.spif_seen)
+		sim_io[0x4D] &= ~(_BV(SPIF) | _BV(WCOL));
+	spi.spif_seen = false;
+}
+
+static bool spi_read(uint16_t addr, uint8_t *value)
+{
+	switch (addr) {
+	case 0x4D: // SPSR
+		*value = sim_io[addr];
+		if (*value & _BV(SPIF))
+			spi.spif_seen = true;
+		return true;
+	case 0x4E: // SPDR
+		spi_clear_flags();
+		*value = spi.spdr;
+		return true;
+	}
+	return false;
+}
+
+static bool spi_write(uint16_t addr, uint8_t value)
+{
+	switch (addr) {
+	case 0x24: // DDRB
+	case 0x25: // PORTB
+		sim_io[addr] = value;
+		update_ncs();
+		return true;
+	case 0x4D: // SPSR, only SPI2X is writable
+		sim_io[addr] = (sim_io[addr] & ~_BV(SPI2X)) | (value & _BV(SPI2X));
+		return true;
+	case 0x4E: // SPDR
+		spi_clear_flags();
+		if (!(sim_io[0x4C] & _BV(SPE)) || !(sim_io[0x4C] & _BV(MSTR)))
+			return true;
+		if (spi.busy) {
+			sim_io[0x4D] |= _BV(WCOL);
+			++sim_sensor.wcol;
+			return true;
+		}
+		spi.busy = true;
+		spi.done_at = sim_now + spi_byte_cycles();
+		spi.out = value;
+		spi.in = sns.selected ? byte_begin(value) : 0xff;
+		return true;
+	}
+	return false;
+}
+
+/**************************************************************************
+ *  USART1 in master SPI mode
+ **************************************************************************/
+
+static bool usart_mspim(void)
+{
+	return (sim_io[0xCA] & (_BV(UMSEL11) | _BV(UMSEL10)))
+		== (_BV(UMSEL11) | _BV(UMSEL10));
+}
+
+// 8 XCK periods of 2 * (UBRR1 + 1) cycles
+static uint32_t usart_byte_cycles(void)
+{
+	const uint16_t ubrr = sim_io[0xCC] | (sim_io[0xCD] & 0x0f) << 8;
+	return 16 * ((uint32_t)ubrr + 1);
+}
+
+static void usart_shift(uint8_t out)
+{
+	usart.shifting = true;
+	usart.done_at = sim_now + usart_byte_cycles();
+	usart.out = out;
+	usart.in = sns.selected ? byte_begin(out) : 0xff;
+	// TXD1 and RXD1 are PD3 and PD2, shared with the top contacts of the
+	// buttons on the M1K; the lines carry the first bit of the byte
+	sim_pin_drive('D', PD3, out & 0x80);
+	sim_pin_drive('D', PD2, usart.in & 0x80);
+}
+
+static void usart_complete(void)
+{
+	usart.shifting = false;
+	if (sns.selected)
+		byte_end(usart.out);
+	if (sim_io[0xC9] & _BV(RXEN1)) {
+		if (usart.rx_count < 2) {
+			usart.rx[usart.rx_count++] = usart.in;
+			sim_io[0xC8] |= _BV(RXC1);
+		} else {
+			sim_io[0xC8] |= _BV(DOR1);
+		}
+	}
+	if (usart.tx_full) {
+		usart.tx_full = false;
+		sim_io[0xC8] |= _BV(UDRE1);
+		usart_shift(usart.tx);
+	} else {
+		sim_io[0xC8] |= _BV(TXC1);
+		// idle high
+		sim_pin_drive('D', PD3, true);
+		sim_pin_drive('D', PD2, true);
+	}
+}
+
+static bool usart_read(uint16_t addr, uint8_t *value)
+{
+	if (addr != 0xCE) // UDR1
+		return false;
+	*value = usart.rx_count ? usart.rx[0] : 0;
+	if (usart.rx_count) {
+		usart.rx[0] = usart.rx[1];
+		if (!--usart.rx_count)
+			sim_io[0xC8] &= ~_BV(RXC1);
+	}
+	return true;
+}
+
+static bool usart_write(uint16_t addr, uint8_t value)
+{
+	switch (addr) {
+	case 0xC8: // UCSR1A, TXC1 is cleared by writing 1
+		if (value & _BV(TXC1))
+			sim_io[addr] &= ~_BV(TXC1);
+		return true;
+	case 0xC9: // UCSR1B
+		sim_io[addr] = value;
+		if (!(value & _BV(RXEN1))) {
+			usart.rx_count = 0;
+			sim_io[0xC8] &= ~(_BV(RXC1) | _BV(DOR1));
+		}
+		if (!(value & _BV(TXEN1))) {
+			usart.shifting = usart.tx_full = false;
+			sim_io[0xC8] |= _BV(UDRE1);
+		}
+		return true;
+	case 0xCE: // UDR1
+		if (!usart_mspim() || !(sim_io[0xC9] & _BV(TXEN1)))
+			return true;
+		if (!usart.shifting) {
+			usart_shift(value);
+		} else if (!usart.tx_full) {
+			usart.tx_full = true;
+			usart.tx = value;
+			sim_io[0xC8] &= ~_BV(UDRE1);
+		} else {
+			++sim_sensor.wcol; // lost, the buffer is full
+		}
+		return true;
+	}
+	return false;
+}
+
+/**************************************************************************
+ *  device
+ **************************************************************************/
+
+static bool dev_read(uint16_t addr, uint8_t *value)
+{
+	return spi_read(addr, value) || usart_read(addr, value);
+}
+
+static bool dev_write(uint16_t addr, uint8_t value)
+{
+	return spi_write(addr, value) || usart_write(addr, value);
+}
+
+static void spi_reset(void)
+{
+	spi.busy = false;
+	spi.spdr = 0;
+	spi.spif_seen = false;
+	usart.shifting = usart.tx_full = false;
+	usart.rx_count = 0;
+	sim_io[0xC8] = _BV(UDRE1);
+	sns.selected = false;
+	sns.state = ADDR;
+	sns.last_write_end = sns.last_read_end = sns.last_srom_byte = 0;
+	sns.addr_end = 0;
+	sns.srom.clear();
+	sns.vx = sns.vy = 0;
+	sns.motion_at = 0;
+	sns.lifted = false;
+	sim_sensor = sim_sensor_stats();
+	power_up_reset();
+}
+
+static uint64_t spi_next_event(void)
+{
+	return std::min(spi.busy ? spi.done_at : SIM_NEVER,
+			usart.shifting ? usart.done_at : SIM_NEVER);
+}
+
+static void spi_update(void)
+{
+	if (spi.busy && sim_now >= spi.done_at)
+		spi_complete();
+	if (usart.shifting && sim_now >= usart.done_at)
+		usart_complete();
+}
+
+const sim_device sim_spi_device = {
+	spi_reset, spi_next_event, spi_update, dev_read, dev_write
+};
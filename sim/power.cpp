@@ -0,0 +1,179 @@
+/* Duty cycle and wake latency of the power profiles (see power.h), on the
+ * virtual M1K.
+ *
+ * After the boot the mouse lies still; the second from 1s to 4s is measured
+ * like in idle.cpp. Then it is woken up a number of times, each after 3s of
+ * lying still and at a different point within the frame, half of them by
+ * motion and half by a button press. Reports the cycles the cpu was awake
+ * and the SPI bytes per idle second, and the time from the wake-up to the
+ * first report that has it, and after a motion the time from the first
+ * burst that reads it to the next burst, which must be the next slot.
+ * Built once per profile (power_full, power_balanced, power_saver), make
+ * check and make bench run all of them. The sim does not model the rest
+ * modes of the sensor, whose own wake-up comes on top in the balanced and
+ * saver profiles. Exits non-zero if motion or a click is lost, the rate
+ * does not snap back within a slot or a sensor timing is violated.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <avr/io.h>
+#include "usb_mouse.h"
+#include "power.h"
+#include "test.h"
+
+#define IDLE_FROM MS(1000)
+#define IDLE_TO MS(4000)
+
+#define WAKES 10
+#define WAKE_FIRST MS(6000)
+#define WAKE_EVERY MS(3000)
+
+static const char *const names[POWER_PROFILES] = {
+	[POWER_FULL] = "full",
+	[POWER_BALANCED] = "balanced",
+	[POWER_SAVER] = "saver",
+};
+
+static int64_t host_x, host_y;
+static uint8_t host_buttons;
+static uint32_t presses;
+
+// the wake-up being waited for, 0 if none
+static uint64_t wake_at;
+static bool wake_button;
+static uint64_t latency_sum, latency_max;
+static uint32_t woken;
+
+static void on_report(uint8_t ep, const uint8_t *data, uint8_t len)
+{
+	if (ep != MOUSE_ENDPOINT || len < 5)
+		return;
+	const int16_t dx = data[1] | data[2] << 8;
+	const int16_t dy = data[3] | data[4] << 8;
+	host_x += dx;
+	host_y += dy;
+	const bool pressed = (data[0] & 1) && !(host_buttons & 1);
+	presses += pressed;
+	host_buttons = data[0];
+	if (wake_at && (wake_button ? pressed : dx || dy)) {
+		const uint64_t latency = sim_now - wake_at;
+		latency_sum += latency;
+		if (latency > latency_max)
+			latency_max = latency;
+		++woken;
+		wake_at = 0;
+	}
+}
+
+// the burst rate snaps back from the slot after the first motion: the
+// bursts are a slot apart, give or take the slot 0 start after the SOF
+#define SNAP_BACK_MAX US(150)
+
+// a motion wake-up whose first burst with motion is being waited for, then
+// the burst after it
+static bool snap_waiting;
+static uint64_t snap_from, snap_max;
+static uint32_t snapped;
+static uint64_t bursts_seen;
+static int64_t latched_x_seen, latched_y_seen;
+
+static void on_isr(int, uint64_t taken, uint64_t)
+{
+	if (sim_sensor.bursts == bursts_seen)
+		return;
+	bursts_seen = sim_sensor.bursts;
+	// the burst latched motion into the delta registers
+	const bool moved = sim_sensor.latched_x != latched_x_seen
+		|| sim_sensor.latched_y != latched_y_seen;
+	latched_x_seen = sim_sensor.latched_x;
+	latched_y_seen = sim_sensor.latched_y;
+	if (snap_from) {
+		const uint64_t snap = taken - snap_from;
+		if (snap > snap_max)
+			snap_max = snap;
+		++snapped;
+		snap_from = 0;
+	} else if (snap_waiting && moved) {
+		snap_from = taken;
+		snap_waiting = false;
+	}
+}
+
+static bool measuring;
+
+static struct {
+	uint64_t bytes, bursts, sleep;
+	uint8_t shift;
+} at_start, at_end;
+
+static void snapshot(void)
+{
+	auto &s = measuring ? at_end : at_start;
+	s.bytes = sim_sensor.bytes;
+	s.bursts = sim_sensor.bursts;
+	s.sleep = sim_sleep_cycles;
+	s.shift = power_rate_shift();
+	measuring = !measuring;
+}
+
+static void wake(unsigned n)
+{
+	// spread over the frame, off the slot boundaries
+	const uint64_t at = WAKE_FIRST + n * WAKE_EVERY + US(n * 97 % 1000);
+	const bool button = n & 1;
+	sim_at(at, [=] {
+		wake_at = sim_now;
+		wake_button = button;
+		if (button) {
+			sim_button(0, true);
+		} else {
+			sim_sensor_velocity(4, 3);
+			snap_waiting = true;
+		}
+	});
+	sim_at(at + MS(30), [=] {
+		if (button)
+			sim_button(0, false);
+		else
+			sim_sensor_velocity(0, 0);
+	});
+}
+
+int main(void)
+{
+	sim_reset();
+	sim_usb_on_report(on_report);
+	sim_usb_host_start(sim_usb_host_config());
+	sim_on_isr(on_isr);
+	sim_at(IDLE_FROM, snapshot);
+	sim_at(IDLE_TO, snapshot);
+	for (unsigned n = 0; n < WAKES; ++n)
+		wake(n);
+	const uint64_t end = WAKE_FIRST + WAKES * WAKE_EVERY;
+	sim_run(entry, end);
+
+	const double seconds = (double)(IDLE_TO - IDLE_FROM) / MS(1000);
+	const uint64_t awake = IDLE_TO - IDLE_FROM - (at_end.sleep - at_start.sleep);
+	printf("%-8s idle: %5.0f bursts/s at %u Hz, %6.0f spi bytes/s, awake "
+	       "%.1f%%; wake-up to report %.3f ms (max %.3f), snap-back "
+	       "%.3f ms\n",
+	       names[POWER_PROFILE],
+	       (at_end.bursts - at_start.bursts) / seconds,
+	       8000 >> at_end.shift,
+	       (at_end.bytes - at_start.bytes) / seconds,
+	       100.0 * awake / (IDLE_TO - IDLE_FROM),
+	       woken ? (double)latency_sum / woken / MS(1) : 0.0,
+	       (double)latency_max / MS(1), (double)snap_max / MS(1));
+
+	const bool ok = woken == WAKES && presses == WAKES / 2
+		&& snapped == WAKES / 2 && snap_max <= SNAP_BACK_MAX
+		&& host_x == sim_sensor.latched_x && host_y == sim_sensor.latched_y
+		&& !sim_sensor.t_srad && !sim_sensor.t_srad_motbr
+		&& !sim_sensor.t_sww && !sim_sensor.t_swr
+		&& !sim_sensor.t_srw && !sim_sensor.t_srom;
+	if (!ok)
+		printf("FAIL: wake-up, motion or click lost, snap-back or "
+		       "sensor timing\n");
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
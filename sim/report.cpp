@@ -0,0 +1,212 @@
+/* The mouse endpoint (see report_latch in main.c) under host poll timing.
+ *
+ * Built twice: report_early with the default host, which polls right
+ * after the SOF, and report_late with a host that polls anywhere in the
+ * first 90% of the frame and leaves a quarter of the polls out, so that
+ * both banks fill up. The mouse moves at a changing speed while the
+ * buttons are clicked; then it lies still and is moved by small steps at
+ * random points within the frame. Reports the time from a step to the
+ * report that has it. Exits non-zero if motion is lost or counted twice,
+ * a click is lost, the steps take longer than LATENCY_MAX on average, a
+ * sensor timing is violated or a slot overruns.
+ *
+ * report_ts is report_early with MOUSE_TIMESTAMP (see usb_mouse.h): the
+ * time of each step is taken from the frame number and the slot weights
+ * of its report, and must be within the slot before the burst that read
+ * it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <avr/io.h>
+#include "usb_mouse.h"
+#include "sched.h"
+#include "test.h"
+
+#define MOVE_FROM MS(1000)
+#define MOVE_TO MS(3000)
+#define STEPS_FROM MS(3100)
+#define STEPS 100
+#define STEP_EVERY MS(20)
+
+// the average from a step to its report. With the early polls the step
+// waits for the latch in slot 7, half a frame on average. With the late
+// ones a step after the latch waits for the one of the next frame, even
+// if the poll of its own frame is still to come: the single bank that was
+// rewritten every slot had 0.95 ms there, but could lose or double a
+// report (see report_latch)
+#ifdef REPORT_LATE
+#define LATENCY_MAX US(1500)
+#else
+#define LATENCY_MAX US(700)
+#endif
+
+static struct {
+	int64_t x, y;
+	uint8_t buttons;
+	uint32_t presses[2], releases[2];
+	uint32_t reports;
+} host;
+
+static uint32_t clicks[2];
+
+// the step being waited for, 0 if none
+static uint64_t step_at;
+static uint64_t latency_sum, latency_max;
+static uint32_t stepped;
+
+#ifdef MOUSE_TIMESTAMP
+static struct {
+	uint16_t frame;
+	uint32_t same_frame, missing;
+	int64_t error_sum, error_min, error_max;
+} ts;
+
+// the step at step_at against the slot of its report: the burst at the
+// start of the slot read it, so it was in the slot before
+static void timestamp(const uint8_t *data)
+{
+	const uint8_t *t = data + MOUSE_REPORT_SIZE - MOUSE_TIMESTAMP_SIZE;
+	const uint16_t frame = t[0] | t[1] << 8;
+	const uint16_t weights = t[2] | t[3] << 8;
+	int slot = SCHED_SLOTS - 1;
+	while (slot >= 0 && !((weights >> 2 * slot) & 3))
+		--slot;
+	if (slot < 0) {
+		++ts.missing;
+		return;
+	}
+	const uint64_t sof = sim_last_sof
+		- ((sim_last_frame - frame) & 0x7ff) * MS(1);
+	const int64_t error = (int64_t)(sof + slot * US(125)) - (int64_t)step_at;
+	ts.error_sum += error;
+	if (error < ts.error_min)
+		ts.error_min = error;
+	if (error > ts.error_max)
+		ts.error_max = error;
+}
+#endif
+
+static void on_report(uint8_t ep, const uint8_t *data, uint8_t len)
+{
+	if (ep != MOUSE_ENDPOINT || len != MOUSE_REPORT_SIZE)
+		return;
+#ifdef MOUSE_TIMESTAMP
+	const uint16_t frame = data[MOUSE_REPORT_SIZE - MOUSE_TIMESTAMP_SIZE]
+		| data[MOUSE_REPORT_SIZE - MOUSE_TIMESTAMP_SIZE + 1] << 8;
+	if (host.reports && frame == ts.frame)
+		++ts.same_frame;
+	ts.frame = frame;
+#endif
+	++host.reports;
+	for (uint8_t b = 0; b < 2; ++b) {
+		const uint8_t mask = 1 << b;
+		if ((data[0] & mask) && !(host.buttons & mask))
+			++host.presses[b];
+		if (!(data[0] & mask) && (host.buttons & mask))
+			++host.releases[b];
+	}
+	host.buttons = data[0];
+	const int16_t dx = data[1] | data[2] << 8;
+	const int16_t dy = data[3] | data[4] << 8;
+	host.x += dx;
+	host.y += dy;
+	if (step_at && (dx || dy)) {
+#ifdef MOUSE_TIMESTAMP
+		timestamp(data);
+#endif
+		const uint64_t latency = sim_now - step_at;
+		latency_sum += latency;
+		if (latency > latency_max)
+			latency_max = latency;
+		++stepped;
+		step_at = 0;
+	}
+}
+
+// the test's own, sim_rand belongs to the peripherals
+static uint32_t next_random(void)
+{
+	static uint32_t state = 2463534242u;
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+// -4..4 ips
+static double random_speed(void)
+{
+	return (double)(next_random() % 801) / 100 - 4;
+}
+
+int main(void)
+{
+	sim_reset();
+	sim_usb_on_report(on_report);
+	sim_usb_host_config config;
+#ifdef REPORT_LATE
+	config.poll_jitter_cycles = US(900);
+	config.poll_skip_percent = 25;
+#endif
+	sim_usb_host_start(config);
+
+	for (uint64_t t = MOVE_FROM; t < MOVE_TO; t += MS(10))
+		sim_at(t, [] { sim_sensor_velocity(random_speed(), random_speed()); });
+	sim_at(MOVE_TO, [] { sim_sensor_velocity(0, 0); });
+	// short clicks, one button after the other
+	uint8_t b = 0;
+	for (uint64_t t = MOVE_FROM; t < MOVE_TO; t += MS(40), b ^= 1) {
+		const uint64_t duration = MS(5) + next_random() % MS(10);
+		sim_at(t, [b] { sim_button(b, true); ++clicks[b]; });
+		sim_at(t + duration, [b] { sim_button(b, false); });
+	}
+	for (int i = 0; i < STEPS; i++) {
+		const uint64_t t = STEPS_FROM + i * STEP_EVERY + next_random() % MS(1);
+		sim_at(t, [] {
+			step_at = sim_now;
+			sim_sensor_move(0.01, -0.01);
+		});
+	}
+	sim_run(entry, STEPS_FROM + STEPS * STEP_EVERY + MS(100));
+
+	printf("%u reports, %llu of %llu polls NAKed; step to report %.3f ms "
+	       "(max %.3f)\n", host.reports,
+	       (unsigned long long)sim_usb.poll_naks,
+	       (unsigned long long)sim_usb.polls,
+	       stepped ? (double)latency_sum / stepped / MS(1) : 0.0,
+	       (double)latency_max / MS(1));
+#ifdef MOUSE_TIMESTAMP
+	printf("step time from the report: %.1f us off (%.1f..%.1f), "
+	       "%u without slot\n",
+	       stepped ? (double)ts.error_sum / stepped / US(1) : 0.0,
+	       (double)ts.error_min / US(1), (double)ts.error_max / US(1),
+	       ts.missing);
+#endif
+	printf("motion: sensor %lld,%lld host %lld,%lld\n\n",
+	       (long long)sim_sensor.latched_x, (long long)sim_sensor.latched_y,
+	       (long long)host.x, (long long)host.y);
+
+	int failed = 0;
+	failed += check(sim_sensor.latched_x && sim_sensor.latched_x == host.x
+			&& sim_sensor.latched_y == host.y,
+			"motion neither lost nor doubled");
+	failed += check(stepped == STEPS, "every step reported");
+	failed += check(latency_sum <= LATENCY_MAX * stepped, "step to report");
+	failed += check(host.presses[0] == clicks[0]
+			&& host.releases[0] == clicks[0]
+			&& host.presses[1] == clicks[1]
+			&& host.releases[1] == clicks[1], "clicks");
+	failed += check(!sim_sensor.t_srad && !sim_sensor.t_srad_motbr
+			&& !sim_sensor.t_sww && !sim_sensor.t_swr
+			&& !sim_sensor.t_srw && !sim_sensor.t_srom,
+			"sensor timing");
+#ifdef MOUSE_TIMESTAMP
+	// the burst reads a few us into its slot
+	failed += check(!ts.missing && !ts.same_frame
+			&& ts.error_min > -(int64_t)US(20)
+			&& ts.error_max <= (int64_t)US(125), "step time");
+#endif
+	failed += check(!sched_overruns, "slot overruns");
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
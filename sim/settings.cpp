@@ -0,0 +1,180 @@
+/* Settings interface (see settings.h) of the virtual M1K.
+ *
+ * The host reads the configuration and the info report, sets a new
+ * configuration while the mouse moves, and tries a few it must refuse,
+ * among them two whose data stage is shorter or longer than announced.
+ * Reports how long the resolution takes to reach the sensor and the eeprom
+ * writes to finish. Exits non-zero if a report is wrong, the sensor does
+ * not get the new values, the eeprom does not hold them, a bad
+ * configuration is not stalled or changes anything, the mouse stops
+ * tracking or a slot overruns.
+ */
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <avr/io.h>
+#include "usb_mouse.h"
+#include "settings.h"
+#include "sched.h"
+#include "test.h"
+
+// wValue of GET_REPORT and SET_REPORT
+#define FEATURE(id) (0x0300 | (id))
+
+static struct {
+	int64_t x, y;
+} mouse;
+
+static void on_report(uint8_t ep, const uint8_t *data, uint8_t len)
+{
+	if (ep != MOUSE_ENDPOINT || len < 5)
+		return;
+	const int16_t dx = data[1] | data[2] << 8;
+	const int16_t dy = data[3] | data[4] << 8;
+	mouse.x += dx;
+	mouse.y += dy;
+}
+
+static struct settings_config initial, readback;
+static struct settings_info info;
+static int initial_status = -1, readback_status = -1, info_status = -1;
+static unsigned refused = 0;
+static uint64_t set_at, set_done_at, cpi_at;
+static std::vector<uint8_t> eeprom_before;
+
+static void get(uint8_t id, void *report, size_t size, int *status)
+{
+	sim_usb_control(0xa1, 1, FEATURE(id), SETTINGS_INTERFACE, size, NULL,
+			[=](int s, const uint8_t *data, uint16_t len) {
+		*status = s || len != size ? -1 : 0;
+		if (!*status)
+			memcpy(report, data, size);
+	});
+}
+
+// length is the wLength of the setup, data that of the data stage, both
+// up to the whole report
+static void set(const struct settings_config &c, bool expect_stall,
+		uint16_t length = sizeof(struct settings_config),
+		uint16_t data = sizeof(struct settings_config))
+{
+	sim_usb_control_out(0x21, 9, FEATURE(c.report_id), SETTINGS_INTERFACE,
+			length, (const uint8_t *)&c, data,
+			[=](int s, const uint8_t *, uint16_t) {
+		if (expect_stall) {
+			if (s == SIM_USB_STALL)
+				++refused;
+			return;
+		}
+		if (s)
+			printf("set report failed (%d)\n", s);
+		else
+			set_done_at = sim_now;
+	});
+}
+
+static const struct settings_config wanted = {
+	SETTINGS_REPORT_CONFIG, 1600, 1, 3, 3, 1
+};
+
+int main(void)
+{
+	sim_reset();
+	sim_usb_on_report(on_report);
+	sim_usb_host_start(sim_usb_host_config());
+	sim_at(MS(500), [] { sim_sensor_velocity(2, -1); });
+	sim_at(MS(1000), [] {
+		get(SETTINGS_REPORT_CONFIG, &initial, sizeof(initial),
+		    &initial_status);
+		get(SETTINGS_REPORT_INFO, &info, sizeof(info), &info_status);
+	});
+	sim_at(MS(1100), [] {
+		const uint8_t *e = sim_eeprom_data();
+		eeprom_before.assign(e, e + sim_eeprom_size());
+		set_at = sim_now;
+		set(wanted, false);
+	});
+	// the resolution register, within a few slots
+	for (uint64_t t = MS(1100); t < MS(1200); t += US(25))
+		sim_at(t, [] {
+			if (!cpi_at && sim_sensor_cpi() == wanted.cpi)
+				cpi_at = sim_now;
+		});
+	sim_at(MS(1200), [] {
+		struct settings_config c = wanted;
+		c.cpi = 150;
+		set(c, true);
+		c = wanted;
+		c.lod = 4;
+		set(c, true);
+		c = wanted;
+		c.srom_version = 4;
+		set(c, true);
+		c = wanted;
+		c.power_profile = 3;
+		set(c, true);
+		c = wanted;
+		c.report_id = SETTINGS_REPORT_INFO;
+		set(c, true);
+		// a good one without its last byte, which a power profile of 0
+		// would complete, and one with a byte more than announced
+		c = wanted;
+		c.cpi = 400;
+		set(c, true, sizeof(c), sizeof(c) - 1);
+		set(c, true, sizeof(c) - 1, sizeof(c));
+	});
+	sim_at(MS(1300), [] {
+		get(SETTINGS_REPORT_CONFIG, &readback, sizeof(readback),
+		    &readback_status);
+	});
+	sim_at(MS(1400), [] { sim_sensor_velocity(0, 0); });
+	sim_run(entry, MS(1500));
+
+	// the EEMEM variables changed by the set, in any order
+	std::vector<uint8_t> changed, expected = {0x40, 0x06, 1, 3, 3, 1};
+	const uint8_t *e = sim_eeprom_data();
+	for (size_t i = 0; i < eeprom_before.size(); i++)
+		if (e[i] != eeprom_before[i])
+			changed.push_back(e[i]);
+	std::sort(changed.begin(), changed.end());
+	std::sort(expected.begin(), expected.end());
+
+	printf("config: cpi %u as %u lod %u srom %u power %u\n",
+	       initial.cpi, initial.angle_snap, initial.lod,
+	       initial.srom_version, initial.power_profile);
+	printf("info: version %04x srom id %u power %u\n", info.version,
+	       info.srom_id, info.power_profile);
+	printf("set to sensor %.3f ms, set request done %.3f ms\n",
+	       (double)(cpi_at - set_at) / MS(1),
+	       (double)(set_done_at - set_at) / MS(1));
+	printf("motion: sensor %lld,%lld host %lld,%lld\n\n",
+	       (long long)sim_sensor.latched_x, (long long)sim_sensor.latched_y,
+	       (long long)mouse.x, (long long)mouse.y);
+
+	int failed = 0;
+	failed += check(!initial_status && initial.cpi == 800
+			&& !initial.angle_snap && initial.lod == 2
+			&& initial.srom_version == SROM_VERSION
+			&& !initial.power_profile, "config report");
+	failed += check(!info_status && info.version == 0x0100
+			&& info.srom_id == SROM_VERSION && !info.power_profile,
+			"info report");
+	failed += check(cpi_at && cpi_at - set_at < MS(2)
+			&& sim_sensor_reg(0x42) == 0x80,
+			"config reaches the sensor");
+	failed += check(changed == expected, "config in the eeprom");
+	failed += check(refused == 7, "bad config stalled");
+	failed += check(!readback_status && !memcmp(&readback, &wanted,
+			sizeof(wanted)), "config read back");
+	failed += check(sim_sensor.latched_x == mouse.x
+			&& sim_sensor.latched_y == mouse.y, "tracking");
+	failed += check(!sim_sensor.t_srad && !sim_sensor.t_srad_motbr
+			&& !sim_sensor.t_sww && !sim_sensor.t_swr
+			&& !sim_sensor.t_srw && !sim_sensor.t_srom,
+			"sensor timing");
+	failed += check(!sched_overruns, "slot overruns");
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,118 @@
+/* Round trip of the sensor register shadow (pmw3366.c) through
+ * pmw3366_config_save and pmw3366_config_load.
+ *
+ * Runs the sensor driver with a burst in every slot. Saves the shadow,
+ * changes the resolution, the mode and the rest setting, then loads the
+ * saved copy. Exits non-zero if the changes do not reach the sensor, the
+ * sensor registers differ from those at the save after the load, a second
+ * save differs from the first or a sensor timing is violated.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "pmw3366.h"
+#include "sched.h"
+#include "spi.h"
+#include "test.h"
+
+// the registers of the shadow, in pmw3366.c
+static const uint8_t regs[PMW3366_CONFIG_SIZE] = {
+	0x10, 0x14, 0x17, 0x18, 0x19, 0x1b, 0x1c, 0x2c, 0x2b, 0x0f, 0x42, 0x0d,
+	0x63
+};
+
+// frames from the first slot; a change of all of them is written in less
+// than 13 slots and settles in less than 2 slots each
+#define SAVE_FRAME 100
+#define CHANGED_FRAME 200
+#define RESTORED_FRAME 300
+#define FRAMES 310
+
+static struct pmw3366_burst burst;
+static uint8_t saved[PMW3366_CONFIG_SIZE], saved_again[PMW3366_CONFIG_SIZE];
+static uint8_t before[PMW3366_CONFIG_SIZE], changed[PMW3366_CONFIG_SIZE];
+static uint8_t restored[PMW3366_CONFIG_SIZE];
+static uint32_t frames;
+
+static void read_regs(uint8_t *values)
+{
+	for (uint8_t i = 0; i < PMW3366_CONFIG_SIZE; i++)
+		values[i] = sim_sensor_reg(regs[i]);
+}
+
+void slot_task(uint8_t slot)
+{
+	if (slot == 0) {
+		++frames;
+		if (frames == SAVE_FRAME) {
+			read_regs(before);
+			pmw3366_config_save(saved);
+			pmw3366_set_cpi(3200);
+			pmw3366_set_mode(true, 3);
+			pmw3366_set_rest(0x40);
+		} else if (frames == CHANGED_FRAME) {
+			read_regs(changed);
+			pmw3366_config_load(saved);
+		} else if (frames == RESTORED_FRAME) {
+			read_regs(restored);
+			pmw3366_config_save(saved_again);
+		}
+	}
+	if (pmw3366_burst_start(&burst, slot == 0))
+		sched_slot_defer();
+}
+
+void pmw3366_burst_done(void)
+{
+	sched_slot_done();
+}
+
+ISR(USB_GEN_vect)
+{
+	const uint8_t intbits = UDINT;
+	UDINT = 0;
+	if (intbits & (1<<SOFI))
+		sched_sof();
+}
+
+static void driver_main(void)
+{
+	sched_timebase_init();
+	spi_init();
+	pmw3366_init(CPI_VAL(800), SROM_VERSION);
+	pmw3366_burst_mode();
+	sched_init();
+	while (1)
+		sched_idle();
+}
+
+int main(void)
+{
+	sim_reset();
+	sim_sof_start(8000, 8000, 0);
+	// the SROM download takes the first few hundred frames
+	sim_run(driver_main, MS(1000) + (uint64_t)FRAMES * 8000);
+
+	printf("CPI %u->%u->%u, Angle_Snap %02x->%02x->%02x, "
+	       "Run_Downshift %02x->%02x->%02x\n\n",
+	       (before[9] + 1) * 100, (changed[9] + 1) * 100,
+	       (restored[9] + 1) * 100, before[10], changed[10], restored[10],
+	       before[1], changed[1], restored[1]);
+
+	int failed = 0;
+	failed += check(frames >= RESTORED_FRAME, "slots");
+	failed += check(changed[9] == CPI_VAL(3200) && changed[10] == 0x80
+			&& changed[12] == 3 && changed[1] == 0x40, "changes written");
+	failed += check(!memcmp(restored, before, sizeof(before)),
+			"registers after the load");
+	failed += check(!memcmp(saved_again, saved, sizeof(saved)),
+			"save after the load");
+	failed += check(!sim_sensor.t_srad && !sim_sensor.t_srad_motbr
+			&& !sim_sensor.t_sww && !sim_sensor.t_swr
+			&& !sim_sensor.t_srw && !sim_sensor.t_srom,
+			"sensor timing");
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,827 @@
+/* Virtual ATmega32U2 core: cycle counter, interrupts, sleep, timers, pins,
+ * eeprom and the USB start-of-frame generator. See sim.h. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <queue>
+
+#define SIM_REG(addr) (addr)
+#define SIM_REG16(addr) (addr)
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include "periph.h"
+
+uint64_t sim_now = 0;
+uint64_t sim_last_sof = 0;
+uint16_t sim_last_frame = 0;
+uint32_t sim_sof_miss_every = 0;
+uint64_t sim_t0_last_match = 0;
+uint64_t sim_sleep_cycles = 0;
+uint64_t sim_power_down_cycles = 0;
+uint64_t sim_compute_cycles = 0;
+uint64_t sim_isr_compute_cycles = 0;
+// computation not charged yet, see sim_compute
+static uint32_t compute_pending = 0;
+static void compute_flush(void);
+uint64_t sim_wake_count = 0;
+bool sim_bootloader_entered = false;
+
+#define NEVER SIM_NEVER
+#define io sim_io
+
+uint8_t sim_io[0x100];
+static uint64_t stop_at = NEVER;
+
+static const sim_device *const devices[] = {&sim_usb_device, &sim_spi_device};
+#define NUM_DEVICES (sizeof(devices) / sizeof(devices[0]))
+
+static uint32_t rand_state = 0x2545f491;
+
+uint32_t sim_rand(void)
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	return rand_state;
+}
+
+/**************************************************************************
+ *  interrupt vectors, defined by the firmware with ISR()
+ **************************************************************************/
+
+void INT0_vect(void) __attribute__((weak));
+void INT1_vect(void) __attribute__((weak));
+void INT2_vect(void) __attribute__((weak));
+void INT3_vect(void) __attribute__((weak));
+void USB_GEN_vect(void) __attribute__((weak));
+void USB_COM_vect(void) __attribute__((weak));
+void TIMER1_COMPA_vect(void) __attribute__((weak));
+void TIMER1_COMPB_vect(void) __attribute__((weak));
+void TIMER1_COMPC_vect(void) __attribute__((weak));
+void TIMER1_OVF_vect(void) __attribute__((weak));
+void TIMER0_COMPA_vect(void) __attribute__((weak));
+void TIMER0_COMPB_vect(void) __attribute__((weak));
+void TIMER0_OVF_vect(void) __attribute__((weak));
+void SPI_STC_vect(void) __attribute__((weak));
+
+static void (*vector(int v))(void)
+{
+	switch (v) {
+	case SIM_INT0: return INT0_vect;
+	case SIM_INT1: return INT1_vect;
+	case SIM_INT2: return INT2_vect;
+	case SIM_INT3: return INT3_vect;
+	case SIM_USB_GEN: return USB_GEN_vect;
+	case SIM_USB_COM: return USB_COM_vect;
+	case SIM_TIMER1_COMPA: return TIMER1_COMPA_vect;
+	case SIM_TIMER1_COMPB: return TIMER1_COMPB_vect;
+	case SIM_TIMER1_COMPC: return TIMER1_COMPC_vect;
+	case SIM_TIMER1_OVF: return TIMER1_OVF_vect;
+	case SIM_TIMER0_COMPA: return TIMER0_COMPA_vect;
+	case SIM_TIMER0_COMPB: return TIMER0_COMPB_vect;
+	case SIM_TIMER0_OVF: return TIMER0_OVF_vect;
+	case SIM_SPI_STC: return SPI_STC_vect;
+	}
+	return NULL;
+}
+
+/**************************************************************************
+ *  timer0: normal and CTC mode
+ **************************************************************************/
+
+static const uint16_t prescalers[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+
+static struct {
+	uint64_t base;	// cycle at which the counter was 0
+	uint64_t next;	// next compare match
+	uint8_t stopped_count;
+} t0;
+
+static uint16_t t0_top(void)
+{
+	return (io[0x44] & 0x02) ? io[0x47] : 0xff; // CTC: OCR0A
+}
+
+static uint8_t t0_count(void)
+{
+	const uint16_t presc = prescalers[io[0x45] & 7];
+	if (!presc)
+		return t0.stopped_count;
+	return ((sim_now - t0.base) / presc) % (t0_top() + 1);
+}
+
+static void t0_restart(uint8_t count)
+{
+	const uint16_t presc = prescalers[io[0x45] & 7];
+	if (!presc) {
+		t0.stopped_count = count;
+		t0.next = NEVER;
+		return;
+	}
+	t0.base = sim_now - (uint64_t)count * presc;
+	if (count <= io[0x47])
+		t0.next = t0.base + (uint64_t)(io[0x47] + 1) * presc;
+	else
+		t0.next = t0.base + (uint64_t)(256 + io[0x47] + 1) * presc;
+}
+
+static void t0_update(void)
+{
+	while (sim_now >= t0.next) {
+		io[0x35] |= _BV(OCF0A);
+		sim_t0_last_match = t0.next;
+		const uint16_t presc = prescalers[io[0x45] & 7];
+		if (io[0x44] & 0x02) {
+			t0.base = t0.next;
+			t0.next += (uint64_t)(io[0x47] + 1) * presc;
+		} else {
+			t0.next += 256 * (uint64_t)presc;
+		}
+	}
+}
+
+/**************************************************************************
+ *  timer1: normal mode only, compare A/B and overflow
+ **************************************************************************/
+
+static struct {
+	uint64_t base;	// cycle at which the counter was 0
+	uint64_t next;	// next compare match or overflow
+	uint16_t stopped_count;
+	uint16_t ocr[3];
+} t1;
+
+static uint16_t t1_count(void)
+{
+	const uint16_t presc = prescalers[io[0x81] & 7];
+	if (!presc)
+		return t1.stopped_count;
+	return (uint16_t)((sim_now - t1.base) / presc);
+}
+
+// first cycle after now at which the counter becomes value
+static uint64_t t1_when(uint16_t value)
+{
+	const uint16_t presc = prescalers[io[0x81] & 7];
+	const uint64_t ticks = (sim_now - t1.base) / presc;
+	const uint16_t delta = value - (uint16_t)ticks;
+	return t1.base + (ticks + (delta ? delta : 65536)) * presc;
+}
+
+static void t1_schedule(void)
+{
+	if (!prescalers[io[0x81] & 7]) {
+		t1.next = NEVER;
+		return;
+	}
+	t1.next = t1_when(0);
+	for (int i = 0; i < 3; i++) {
+		const uint64_t t = t1_when(t1.ocr[i] + 1);
+		if (t < t1.next)
+			t1.next = t;
+	}
+}
+
+static void t1_restart(uint16_t count)
+{
+	const uint16_t presc = prescalers[io[0x81] & 7];
+	if (!presc)
+		t1.stopped_count = count;
+	else
+		t1.base = sim_now - (uint64_t)count * presc;
+	t1_schedule();
+}
+
+static void t1_update(void)
+{
+	while (sim_now >= t1.next) {
+		const uint64_t when = t1.next;
+		const uint16_t presc = prescalers[io[0x81] & 7];
+		const uint16_t count = (uint16_t)((when - t1.base) / presc);
+		if (count == 0)
+			io[0x36] |= _BV(TOV1);
+		if (count == (uint16_t)(t1.ocr[0] + 1))
+			io[0x36] |= _BV(OCF1A);
+		if (count == (uint16_t)(t1.ocr[1] + 1))
+			io[0x36] |= _BV(OCF1B);
+		if (count == (uint16_t)(t1.ocr[2] + 1))
+			io[0x36] |= _BV(OCF1C);
+		// schedule the next event as seen from this one
+		const uint64_t now = sim_now;
+		sim_now = when;
+		t1_schedule();
+		sim_now = now;
+	}
+}
+
+/**************************************************************************
+ *  USB start of frame
+ **************************************************************************/
+
+static struct {
+	double period;
+	uint32_t jitter;
+	double nominal;		// next SOF without jitter
+	uint64_t next;
+	uint16_t frame;
+} sof = {0, 0, 0, NEVER, 0};
+
+void sim_sof_start(double period, uint64_t first, uint32_t jitter)
+{
+	sof.period = period;
+	sof.jitter = jitter;
+	sof.nominal = first;
+	sof.next = first;
+}
+
+void sim_sof_stop(void)
+{
+	sof.next = NEVER;
+}
+
+static void sof_update(void)
+{
+	while (sim_now >= sof.next) {
+		sof.frame = (sof.frame + 1) & 0x7ff;
+		if (!sim_sof_miss_every || sof.frame % sim_sof_miss_every) {
+			sim_last_sof = sof.next;
+			sim_last_frame = sof.frame;
+			io[0xE4] = sof.frame & 0xff;
+			io[0xE5] = sof.frame >> 8;
+			io[0xE1] |= _BV(SOFI);
+			sim_usb_sof(sof.next, sof.frame);
+		}
+		sof.nominal += sof.period;
+		sof.next = (uint64_t)sof.nominal;
+		if (sof.jitter)
+			sof.next += sim_rand() % sof.jitter;
+	}
+}
+
+/**************************************************************************
+ *  scenario events
+ **************************************************************************/
+
+struct timed_event {
+	uint64_t when;
+	uint64_t seq;	// keeps events at the same cycle in order
+	std::function<void()> fn;
+	bool operator<(const timed_event &o) const
+	{
+		return when != o.when ? when > o.when : seq > o.seq;
+	}
+};
+
+static std::priority_queue<timed_event> timed;
+static uint64_t timed_seq = 0;
+
+void sim_at(uint64_t when, std::function<void()> fn)
+{
+	timed.push(timed_event{when, timed_seq++, fn});
+}
+
+static void timed_update(void)
+{
+	while (!timed.empty() && timed.top().when <= sim_now) {
+		const std::function<void()> fn = timed.top().fn;
+		timed.pop();
+		fn();
+	}
+}
+
+/**************************************************************************
+ *  event loop
+ **************************************************************************/
+
+static uint64_t next_event(void)
+{
+	uint64_t t = stop_at;
+	if (t0.next < t)
+		t = t0.next;
+	if (t1.next < t)
+		t = t1.next;
+	if (sof.next < t)
+		t = sof.next;
+	if (!timed.empty() && timed.top().when < t)
+		t = timed.top().when;
+	for (unsigned i = 0; i < NUM_DEVICES; i++) {
+		const uint64_t d = devices[i]->next_event();
+		if (d < t)
+			t = d;
+	}
+	return t;
+}
+
+// process all peripheral events up to cycle t
+static void advance(uint64_t t)
+{
+	for (;;) {
+		const uint64_t e = next_event();
+		if (e > t)
+			break;
+		if (e > sim_now)
+			sim_now = e;
+		if (sim_now >= stop_at)
+			throw sim_stop();
+		t0_update();
+		t1_update();
+		sof_update();
+		for (unsigned i = 0; i < NUM_DEVICES; i++)
+			devices[i]->update();
+		timed_update();
+	}
+	if (t > sim_now)
+		sim_now = t;
+}
+
+// highest priority pending interrupt, 0 if none
+static int pending_vector(void)
+{
+	if (!(io[0x5F] & _BV(SREG_I)))
+		return 0;
+	const uint8_t ext = io[0x3C] & io[0x3D] & 0x0f;
+	if (ext)
+		return SIM_INT0 + __builtin_ctz(ext);
+	if (io[0xE1] & io[0xE2] & 0x7d)
+		return SIM_USB_GEN;
+	if (sim_usb_com_pending())
+		return SIM_USB_COM;
+	const uint8_t tf1 = io[0x36] & io[0x6F];
+	if (tf1 & _BV(OCF1A))
+		return SIM_TIMER1_COMPA;
+	if (tf1 & _BV(OCF1B))
+		return SIM_TIMER1_COMPB;
+	if (tf1 & _BV(OCF1C))
+		return SIM_TIMER1_COMPC;
+	if (tf1 & _BV(TOV1))
+		return SIM_TIMER1_OVF;
+	if (io[0x35] & io[0x6E] & _BV(OCF0A))
+		return SIM_TIMER0_COMPA;
+	if ((io[0x4D] & _BV(SPIF)) && (io[0x4C] & _BV(SPIE)))
+		return SIM_SPI_STC;
+	return 0;
+}
+
+static sim_isr_fn on_isr;
+
+static void dispatch(void)
+{
+	int v;
+	while ((v = pending_vector())) {
+		// flags cleared by hardware when the vector is taken
+		switch (v) {
+		case SIM_INT0: case SIM_INT1: case SIM_INT2: case SIM_INT3:
+			io[0x3C] &= ~_BV(v - SIM_INT0);
+			break;
+		case SIM_TIMER1_COMPA: io[0x36] &= ~_BV(OCF1A); break;
+		case SIM_TIMER1_COMPB: io[0x36] &= ~_BV(OCF1B); break;
+		case SIM_TIMER1_COMPC: io[0x36] &= ~_BV(OCF1C); break;
+		case SIM_TIMER1_OVF:   io[0x36] &= ~_BV(TOV1);  break;
+		case SIM_TIMER0_COMPA: io[0x35] &= ~_BV(OCF0A); break;
+		case SIM_SPI_STC:      io[0x4D] &= ~_BV(SPIF);  break;
+		}
+		void (*const isr)(void) = vector(v);
+		if (!isr) {
+			fprintf(stderr, "sim: no handler for enabled vector %d\n", v);
+			abort();
+		}
+		const uint64_t taken = sim_now;
+		const uint64_t compute = sim_compute_cycles;
+		io[0x5F] &= ~_BV(SREG_I);
+		advance(sim_now + SIM_IRQ_CYCLES);
+		isr();
+		compute_flush();
+		advance(sim_now + SIM_RETI_CYCLES);
+		io[0x5F] |= _BV(SREG_I);
+		sim_isr_compute_cycles = sim_compute_cycles - compute;
+		if (on_isr)
+			on_isr(v, taken, sim_now - taken);
+	}
+}
+
+void sim_on_isr(sim_isr_fn fn)
+{
+	on_isr = fn;
+}
+
+static void tick(uint32_t cycles)
+{
+	compute_flush();
+	advance(sim_now + cycles);
+	dispatch();
+}
+
+/**************************************************************************
+ *  pins
+ **************************************************************************/
+
+// external drive of port B, C, D
+static uint8_t pin_driven[3], pin_level[3];
+
+static uint8_t pin_read(int port)
+{
+	const uint8_t ddr = io[0x24 + 3 * port];
+	const uint8_t portx = io[0x25 + 3 * port];
+	const uint8_t in = (pin_level[port] & pin_driven[port])
+		| (portx & ~pin_driven[port]);
+	return (portx & ddr) | (in & ~ddr);
+}
+
+static int port_index(char port)
+{
+	if (port < 'B' || port > 'D') {
+		fprintf(stderr, "sim: no port %c\n", port);
+		abort();
+	}
+	return port - 'B';
+}
+
+static void pin_set(int port, uint8_t driven, uint8_t level)
+{
+	const uint8_t before = pin_read(port);
+	pin_driven[port] = driven;
+	pin_level[port] = level;
+	if (port != 2)
+		return;
+	// external interrupt flags of INT0..INT3 on PD0..PD3, per EICRA
+	const uint8_t changed = before ^ pin_read(port);
+	const uint8_t now = pin_read(port);
+	for (int i = 0; i < 4; i++) {
+		if (!(changed & _BV(i)))
+			continue;
+		const uint8_t sense = (io[0x69] >> (2 * i)) & 3;
+		if (sense == 1 || (sense == 2 && !(now & _BV(i)))
+				|| (sense == 3 && (now & _BV(i))))
+			io[0x3C] |= _BV(i);
+	}
+}
+
+void sim_pin_drive(char port, uint8_t bit, bool level)
+{
+	const int p = port_index(port);
+	pin_set(p, pin_driven[p] | _BV(bit),
+		level ? pin_level[p] | _BV(bit) : pin_level[p] & ~_BV(bit));
+}
+
+void sim_pin_release(char port, uint8_t bit)
+{
+	const int p = port_index(port);
+	pin_set(p, pin_driven[p] & ~_BV(bit), pin_level[p]);
+}
+
+void sim_button(uint8_t n, bool pressed)
+{
+	// bottom contact to ground when pressed, top contact when released
+	sim_pin_drive('D', n ? PD1 : PD0, !pressed);
+	sim_pin_drive('D', n ? PD3 : PD2, pressed);
+}
+
+/**************************************************************************
+ *  eeprom, the EEMEM variables are collected in their own section
+ **************************************************************************/
+
+extern uint8_t __start_sim_eeprom[] __attribute__((weak));
+extern uint8_t __stop_sim_eeprom[] __attribute__((weak));
+
+uint64_t sim_eeprom_writes = 0;
+static uint64_t eeprom_ready_at = 0;
+
+size_t sim_eeprom_size(void)
+{
+	return __start_sim_eeprom ? __stop_sim_eeprom - __start_sim_eeprom : 0;
+}
+
+uint8_t *sim_eeprom_data(void)
+{
+	return __start_sim_eeprom;
+}
+
+bool eeprom_is_ready(void)
+{
+	tick(SIM_READ_CYCLES_IO);
+	return sim_now >= eeprom_ready_at;
+}
+
+void eeprom_busy_wait(void)
+{
+	while (!eeprom_is_ready())
+		;
+}
+
+uint8_t eeprom_read_byte(const uint8_t *p)
+{
+	eeprom_busy_wait();
+	sim_delay_cycles(SIM_EEPROM_READ_CYCLES);
+	return *p;
+}
+
+uint16_t eeprom_read_word(const uint16_t *p)
+{
+	const uint8_t *b = (const uint8_t *)p;
+	return eeprom_read_byte(b) | eeprom_read_byte(b + 1) << 8;
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		((uint8_t *)dst)[i] = eeprom_read_byte((const uint8_t *)src + i);
+}
+
+void eeprom_write_byte(uint8_t *p, uint8_t value)
+{
+	eeprom_busy_wait();
+	*p = value;
+	eeprom_ready_at = sim_now + SIM_EEPROM_WRITE_CYCLES;
+	++sim_eeprom_writes;
+}
+
+void eeprom_write_word(uint16_t *p, uint16_t value)
+{
+	eeprom_write_byte((uint8_t *)p, value & 0xff);
+	eeprom_write_byte((uint8_t *)p + 1, value >> 8);
+}
+
+void eeprom_write_block(const void *src, void *dst, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		eeprom_write_byte((uint8_t *)dst + i, ((const uint8_t *)src)[i]);
+}
+
+void eeprom_update_byte(uint8_t *p, uint8_t value)
+{
+	if (eeprom_read_byte(p) != value)
+		eeprom_write_byte(p, value);
+}
+
+void eeprom_update_word(uint16_t *p, uint16_t value)
+{
+	eeprom_update_byte((uint8_t *)p, value & 0xff);
+	eeprom_update_byte((uint8_t *)p + 1, value >> 8);
+}
+
+void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		eeprom_update_byte((uint8_t *)dst + i, ((const uint8_t *)src)[i]);
+}
+
+/**************************************************************************
+ *  power reduction
+ **************************************************************************/
+
+uint32_t sim_prr_errors = 0;
+
+// bit of the block a register belongs to in PRR0, or 8 + its bit in PRR1;
+// -1 for the registers that are always clocked
+static int prr_bit(uint16_t addr)
+{
+	if (addr >= 0x44 && addr <= 0x48)	// TCCR0A..OCR0B
+		return PRTIM0;
+	if (addr >= 0x4C && addr <= 0x4E)	// SPCR, SPSR, SPDR
+		return PRSPI;
+	if (addr >= 0x80 && addr <= 0x8D)	// TCCR1A..OCR1C
+		return PRTIM1;
+	if (addr >= 0xC8 && addr <= 0xCE)	// UCSR1A..UDR1
+		return 8 + PRUSART1;
+	if (addr >= 0xD8 && addr <= 0xF4)	// USBCON..UEINT
+		return 8 + PRUSB;
+	return -1;
+}
+
+// the block of the register has its clock stopped: it takes no writes and
+// reads as 0. A block stopped while running is not modeled, its timer or
+// transfer goes on.
+static bool prr_stopped(uint16_t addr)
+{
+	const int bit = prr_bit(addr);
+	if (bit < 0 || !(io[bit < 8 ? 0x64 : 0x65] & _BV(bit & 7)))
+		return false;
+	++sim_prr_errors;
+	return true;
+}
+
+/**************************************************************************
+ *  register access
+ **************************************************************************/
+
+uint8_t sim_read(uint16_t addr)
+{
+	tick(addr < 0x60 ? SIM_READ_CYCLES_IO : SIM_READ_CYCLES_EXT);
+	if (prr_stopped(addr))
+		return 0;
+	uint8_t value;
+	for (unsigned i = 0; i < NUM_DEVICES; i++)
+		if (devices[i]->read(addr, &value))
+			return value;
+	switch (addr) {
+	case 0x23: case 0x26: case 0x29: // PINB, PINC, PIND
+		return pin_read((addr - 0x23) / 3);
+	case 0x46: return t0_count();
+	case 0x84: return t1_count() & 0xff;
+	case 0x85: return t1_count() >> 8;
+	}
+	return io[addr];
+}
+
+void sim_write(uint16_t addr, uint8_t value)
+{
+	tick(addr < 0x60 ? SIM_WRITE_CYCLES_IO : SIM_WRITE_CYCLES_EXT);
+	if (prr_stopped(addr))
+		return;
+	for (unsigned i = 0; i < NUM_DEVICES; i++)
+		if (devices[i]->write(addr, value))
+			return;
+	switch (addr) {
+	case 0x35: // TIFR0
+	case 0x36: // TIFR1
+	case 0x3C: // EIFR
+		io[addr] &= ~value; // flags are cleared by writing 1
+		return;
+	case 0xE1: // UDINT, flags are cleared by writing 0
+		io[addr] &= value;
+		return;
+	case 0x43: // GTCCR, PSRSYNC clears itself
+		io[addr] = value & ~_BV(PSRSYNC);
+		return;
+	case 0x44: case 0x45: case 0x47: { // TCCR0A, TCCR0B, OCR0A
+		t0_update();
+		const uint8_t count = t0_count();
+		io[addr] = value;
+		t0_restart(count);
+		return;
+	}
+	case 0x46: // TCNT0
+		t0_restart(value);
+		return;
+	case 0x81: { // TCCR1B
+		t1_update();
+		const uint16_t count = t1_count();
+		io[addr] = value;
+		t1_restart(count);
+		return;
+	}
+	case 0x5F: // SREG
+		io[addr] = value;
+		dispatch();
+		return;
+	}
+	io[addr] = value;
+}
+
+uint16_t sim_timer1(void)
+{
+	compute_flush();
+	return prr_stopped(0x84) ? 0 : t1_count();
+}
+
+uint16_t sim_read16(uint16_t addr)
+{
+	tick(2 * SIM_READ_CYCLES_EXT);
+	if (prr_stopped(addr))
+		return 0;
+	switch (addr) {
+	case 0x84: return t1_count();
+	case 0x88: return t1.ocr[0];
+	case 0x8A: return t1.ocr[1];
+	case 0x8C: return t1.ocr[2];
+	}
+	return io[addr] | (io[addr + 1] << 8);
+}
+
+void sim_write16(uint16_t addr, uint16_t value)
+{
+	tick(2 * SIM_WRITE_CYCLES_EXT);
+	if (prr_stopped(addr))
+		return;
+	switch (addr) {
+	case 0x84:
+		t1_update();
+		t1_restart(value);
+		return;
+	case 0x88: case 0x8A: case 0x8C:
+		t1_update();
+		t1.ocr[(addr - 0x88) / 2] = value;
+		t1_schedule();
+		return;
+	}
+	io[addr] = value & 0xff;
+	io[addr + 1] = value >> 8;
+}
+
+/**************************************************************************
+ *  delays and sleep
+ **************************************************************************/
+
+void sim_delay_cycles(uint32_t cycles)
+{
+	compute_flush();
+	// interrupts taken during the delay lengthen it, as on the real core
+	uint64_t remaining = cycles;
+	while (remaining) {
+		const uint64_t e = next_event();
+		uint64_t step = remaining;
+		if (e > sim_now && e - sim_now < remaining)
+			step = e - sim_now;
+		advance(sim_now + step);
+		remaining -= step;
+		dispatch();
+	}
+}
+
+// The hooks of cost.cpp call this from code that cannot unwind (see
+// sim_stop), so the cycles are taken by the next access, delay, sleep or
+// return from interrupt instead, as if the computation came right before.
+void sim_compute(uint32_t cycles)
+{
+	sim_compute_cycles += cycles;
+	compute_pending += cycles;
+}
+
+static void compute_flush(void)
+{
+	const uint32_t cycles = compute_pending;
+	if (!cycles)
+		return;
+	compute_pending = 0;
+	sim_delay_cycles(cycles);
+}
+
+// in power-down only the external interrupts and the USB wakeup run
+// without a clock; the timers are not stopped, the firmware disables them
+static bool power_down_wake(void)
+{
+	return (io[0x5F] & _BV(SREG_I))
+		&& ((io[0x3C] & io[0x3D] & 0x0f)
+		    || (io[0xE1] & io[0xE2] & _BV(WAKEUPI)));
+}
+
+void sim_sleep(void)
+{
+	compute_flush();
+	if (!(io[0x53] & _BV(SE)))
+		return;
+	if (!(io[0x5F] & _BV(SREG_I))) {
+		fprintf(stderr, "sim: sleeping with interrupts disabled\n");
+		abort();
+	}
+	const uint64_t start = sim_now;
+	if ((io[0x53] & (_BV(SM0) | _BV(SM1) | _BV(SM2))) == _BV(SM1)) {
+		while (!power_down_wake())
+			advance(next_event());
+		sim_power_down_cycles += sim_now - start;
+	} else {
+		while (!pending_vector())
+			advance(next_event());
+	}
+	sim_sleep_cycles += sim_now - start;
+	++sim_wake_count;
+	advance(sim_now + SIM_IRQ_WAKE_CYCLES);
+	dispatch();
+}
+
+/**************************************************************************
+ *  scenario control
+ **************************************************************************/
+
+void run_bootloader(void)
+{
+	sim_bootloader_entered = true;
+	throw sim_stop();
+}
+
+void sim_reset(void)
+{
+	for (unsigned i = 0; i < sizeof(io); i++)
+		io[i] = 0;
+	for (int i = 0; i < 3; i++)
+		pin_driven[i] = pin_level[i] = 0;
+	sim_now = 0;
+	eeprom_ready_at = 0;
+	sim_bootloader_entered = false;
+	timed = std::priority_queue<timed_event>();
+	on_isr = nullptr;
+	t0.next = t1.next = NEVER;
+	t0.stopped_count = 0;
+	t1.stopped_count = 0;
+	sim_sof_stop();
+	sim_sof_miss_every = 0;
+	stop_at = NEVER;
+	sim_sleep_cycles = 0;
+	sim_power_down_cycles = 0;
+	sim_compute_cycles = 0;
+	compute_pending = 0;
+	sim_prr_errors = 0;
+	sim_wake_count = 0;
+	for (unsigned i = 0; i < NUM_DEVICES; i++)
+		devices[i]->reset();
+}
+
+void sim_run(void (*entry)(void), uint64_t cycles)
+{
+	stop_at = sim_now + cycles;
+	try {
+		entry();
+	} catch (sim_stop &) {
+	}
+	stop_at = NEVER;
+}
@@ -0,0 +1,268 @@
+/* Host-side emulation of the ATmega32U2 peripherals used by the firmware.
+ *
+ * The firmware sources are compiled as C++ against the headers in sim/avr,
+ * which turn every register into a sim_reg object. Each access is routed
+ * through sim_read/sim_write, which advance a virtual cycle counter, update
+ * the emulated peripherals and dispatch pending interrupts.
+ *
+ * Timing is approximate: I/O accesses, delays and interrupt entry/exit cost
+ * cycles, and so does the computation between accesses: cost.cpp charges
+ * an estimate for each firmware function it lists, not a measurement. The
+ * computation of other functions is free, and so is the slot side of the
+ * trace (see ../trace.h).
+ */
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <vector>
+
+#ifndef F_CPU
+#define F_CPU 8000000UL
+#endif
+
+#define SIM_CYCLES_PER_US (F_CPU / 1000000)
+
+/* cost of an I/O access, including the test/branch/store around it */
+#define SIM_READ_CYCLES_IO	3
+#define SIM_READ_CYCLES_EXT	4
+#define SIM_WRITE_CYCLES_IO	1
+#define SIM_WRITE_CYCLES_EXT	2
+/* interrupt response (4) + vector jump (3), extra 4 when waking from sleep */
+#define SIM_IRQ_CYCLES		7
+#define SIM_IRQ_WAKE_CYCLES	4
+#define SIM_RETI_CYCLES		4
+/* lpm with the pointer increment */
+#define SIM_LPM_CYCLES		3
+/* eeprom: cpu halted on read, programming time of a write */
+#define SIM_EEPROM_READ_CYCLES	4
+#define SIM_EEPROM_WRITE_CYCLES	(34 * SIM_CYCLES_PER_US * 100)
+
+/* interrupt vector numbers, lower is higher priority */
+enum sim_vector {
+	SIM_INT0 = 1, SIM_INT1, SIM_INT2, SIM_INT3,
+	SIM_USB_GEN = 11, SIM_USB_COM,
+	SIM_TIMER1_COMPA = 15, SIM_TIMER1_COMPB, SIM_TIMER1_COMPC, SIM_TIMER1_OVF,
+	SIM_TIMER0_COMPA, SIM_TIMER0_COMPB, SIM_TIMER0_OVF,
+	SIM_SPI_STC,
+	SIM_NUM_VECTORS = 29
+};
+
+/* thrown out of the firmware when the run deadline is reached */
+struct sim_stop {};
+
+/* virtual time in CPU cycles since reset */
+extern uint64_t sim_now;
+
+uint8_t sim_read(uint16_t addr);
+void sim_write(uint16_t addr, uint8_t value);
+uint16_t sim_read16(uint16_t addr);
+void sim_write16(uint16_t addr, uint16_t value);
+
+void sim_delay_cycles(uint32_t cycles);
+void sim_sleep(void);
+/* computation of the firmware, like sim_delay_cycles, see cost.cpp */
+void sim_compute(uint32_t cycles);
+extern uint64_t sim_compute_cycles;
+/* TCNT1 without the cycles of the access, for the marks of ../trace.h;
+ * after the computation before it, see sim_compute */
+uint16_t sim_timer1(void);
+
+/* scenario control
+ *
+ * The firmware's RAM is plain host memory and is not touched by sim_reset,
+ * so a program boots the firmware (its main) at most once. */
+void sim_reset(void);
+void sim_run(void (*entry)(void), uint64_t cycles);
+/* calls fn at cycle when, from inside the emulation; fn must only change
+ * emulated state (pins, sensor, host), never call into the firmware */
+void sim_at(uint64_t when, std::function<void()> fn);
+/* called after every interrupt handler returns, with its vector, the cycle
+ * it was taken at and the cycles from there to the end of its reti */
+typedef std::function<void(int vector, uint64_t taken, uint64_t cycles)>
+	sim_isr_fn;
+void sim_on_isr(sim_isr_fn fn);
+/* the part of those cycles that is computation, see sim_compute */
+extern uint64_t sim_isr_compute_cycles;
+/* the firmware jumped to the bootloader; stops the run */
+void run_bootloader(void);
+extern bool sim_bootloader_entered;
+
+/* start-of-frame generator: period in cycles (nominally 8000, fractional
+ * to model crystal drift), first SOF, peak-to-peak random jitter in cycles */
+void sim_sof_start(double period, uint64_t first, uint32_t jitter);
+void sim_sof_stop(void);
+extern uint64_t sim_last_sof;
+/* its frame number, as in UDFNUM */
+extern uint16_t sim_last_frame;
+/* drop every n-th SOF as if it was corrupted on the bus, 0 = never */
+extern uint32_t sim_sof_miss_every;
+
+/* external pin levels. Port is 'B', 'C' or 'D'. Pins not driven from the
+ * outside read as their pull-up (PORTx bit) when configured as input.
+ * Changes on PD0..PD3 set the EIFR flags according to EICRA. */
+void sim_pin_drive(char port, uint8_t bit, bool level);
+void sim_pin_release(char port, uint8_t bit);
+/* M1K switches: button 0 is PD0 (bottom contact) / PD2 (top contact),
+ * button 1 is PD1 / PD3; pressed closes the bottom contact */
+void sim_button(uint8_t n, bool pressed);
+
+/* accesses to the registers of a block whose clock PRR0/PRR1 stops */
+extern uint32_t sim_prr_errors;
+
+/* eeprom contents, the EEMEM variables of the firmware */
+size_t sim_eeprom_size(void);
+uint8_t *sim_eeprom_data(void);
+extern uint64_t sim_eeprom_writes;
+
+/* cycle of the most recent timer0 compare match */
+extern uint64_t sim_t0_last_match;
+
+/* cycles spent asleep / in interrupt handlers since reset */
+extern uint64_t sim_sleep_cycles;
+/* the part of sim_sleep_cycles in power-down */
+extern uint64_t sim_power_down_cycles;
+extern uint64_t sim_wake_count;
+
+/**************************************************************************
+ *  virtual USB host, see usb.cpp
+ **************************************************************************/
+
+struct sim_usb_host_config {
+	/* from attach to the start of the bus reset */
+	uint32_t connect_debounce_us = 100000;
+	uint32_t reset_us = 10000;
+	/* from the end of the reset and after SET_ADDRESS to the next request */
+	uint32_t reset_recovery_us = 10000;
+	uint32_t set_address_recovery_us = 2000;
+	/* gap between control transactions and retry interval after a NAK */
+	uint32_t control_gap_cycles = 80;
+	uint32_t control_retry_cycles = 160;
+	/* interrupt IN polls at SOF + poll_delay + random(poll_jitter) */
+	uint32_t poll_delay_cycles = 16;
+	uint32_t poll_jitter_cycles = 80;
+	/* interrupt IN polls left out, in percent, like a busy bus would */
+	uint32_t poll_skip_percent = 0;
+	/* SOF period in cycles, fractional to model host/device drift */
+	double sof_period = 8000;
+	uint32_t sof_jitter = 2;
+	/* enable remote wakeup before a suspend, if the device has it */
+	bool remote_wakeup = false;
+};
+
+enum sim_usb_status {
+	SIM_USB_OK = 0,
+	SIM_USB_STALL = -1,
+	SIM_USB_TIMEOUT = -2,
+};
+
+struct sim_usb_stats {
+	uint64_t polls;		/* interrupt and bulk IN tokens */
+	uint64_t reports;	/* interrupt and bulk IN data packets */
+	uint64_t poll_naks;
+	uint64_t control_transfers;
+	uint64_t control_naks;
+	uint64_t control_stalls;
+	uint64_t no_response;	/* tokens the device did not answer */
+	uint64_t configured_at;	/* cycle of the SET_CONFIGURATION status */
+	uint64_t first_report_at;
+	uint64_t suspended_at;	/* last suspend and end of the last resume */
+	uint64_t resumed_at;
+	uint32_t remote_wakeups;
+	uint32_t wakeup_errors;	/* RMWKUP not allowed: too early, frozen clock,
+				   not enabled or not suspended */
+};
+
+typedef std::function<void(uint8_t ep, const uint8_t *data, uint8_t len)>
+	sim_usb_report_fn;
+typedef std::function<void(int status, const uint8_t *data, uint16_t len)>
+	sim_usb_control_fn;
+
+/* starts the host: it waits for the device to attach, resets it, runs the
+ * SOFs, enumerates it and polls its interrupt and bulk IN endpoints, the
+ * bulk ones for up to 8 packets per frame; the packets of all go to the
+ * report callback */
+void sim_usb_host_start(const sim_usb_host_config &config);
+/* leaves out the interrupt and bulk IN polls until resumed, like a host
+ * busy elsewhere */
+void sim_usb_host_pause_polls(bool paused);
+/* leaves out only the bulk IN polls until resumed, like a program that
+ * stops reading its endpoint */
+void sim_usb_host_pause_bulk(bool paused);
+/* suspends the bus: the SOFs stop, the device sees SUSPI 3ms later. Resume
+ * sets WAKEUPI, then the SOFs start again after 20ms of resume signaling.
+ * The device may signal resume itself with RMWKUP, if the host has enabled
+ * remote wakeup and the bus has been idle for 5ms. */
+void sim_usb_host_suspend(void);
+void sim_usb_host_resume(void);
+bool sim_usb_host_configured(void);
+void sim_usb_on_report(sim_usb_report_fn fn);
+/* queues a control transfer, done is called with the IN data, if any */
+void sim_usb_control(uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue,
+		uint16_t wIndex, uint16_t wLength, const uint8_t *out,
+		sim_usb_control_fn done);
+/* the same, with an OUT data stage of out_len bytes whatever wLength says,
+ * like a broken host */
+void sim_usb_control_out(uint8_t bmRequestType, uint8_t bRequest,
+		uint16_t wValue, uint16_t wIndex, uint16_t wLength,
+		const uint8_t *out, uint16_t out_len, sim_usb_control_fn done);
+const std::vector<uint8_t> &sim_usb_config_descriptor(void);
+extern sim_usb_stats sim_usb;
+
+/**************************************************************************
+ *  PMW3366 sensor on the SPI bus, NCS on PB6, see pmw3366.cpp
+ **************************************************************************/
+
+struct sim_sensor_stats {
+	int64_t latched_x, latched_y;	/* counts moved into Delta_X/Y */
+	uint64_t saturated;		/* counts lost to Delta_X/Y clipping */
+	uint64_t bursts, reads, writes, bytes;
+	/* datasheet timing violations */
+	uint32_t t_srad, t_srad_motbr, t_sww, t_swr, t_srw, t_srom;
+	uint32_t t_raw;			/* raw data burst: 20ms after the frame
+					   capture, 15us between pixels */
+	uint32_t burst_unarmed;		/* burst reads without a 0x50 write */
+	uint32_t wcol;			/* SPDR writes during a transfer, UDR1
+					   writes with its buffer full */
+	uint64_t burst_read_cycles;	/* first burst data byte to NCS high, */
+	uint32_t burst_read_max;	/* summed over the bursts and worst */
+	uint64_t srom_start_at;		/* first byte of the last SROM download */
+	uint16_t srom_bytes;		/* size of the last SROM download */
+	uint32_t srom_hash;		/* FNV-1a of the last SROM download */
+	uint64_t srom_done_at;
+	uint32_t frames;		/* raw data bursts read to the end */
+};
+
+/* surface motion in inches per second, and an instant displacement */
+void sim_sensor_velocity(double x_ips, double y_ips);
+void sim_sensor_move(double x_in, double y_in);
+void sim_sensor_lift(bool lifted);
+uint16_t sim_sensor_cpi(void);
+uint8_t sim_sensor_reg(uint8_t addr);
+/* pixel i of the frames the sensor captures */
+uint8_t sim_sensor_pixel(uint16_t i);
+extern sim_sensor_stats sim_sensor;
+
+class sim_reg {
+	const uint16_t addr;
+public:
+	explicit sim_reg(uint16_t a) : addr(a) {}
+	operator uint8_t() const { return sim_read(addr); }
+	const sim_reg &operator=(uint8_t v) const { sim_write(addr, v); return *this; }
+	const sim_reg &operator|=(int v) const { sim_write(addr, sim_read(addr) | v); return *this; }
+	const sim_reg &operator&=(int v) const { sim_write(addr, sim_read(addr) & v); return *this; }
+	const sim_reg &operator^=(int v) const { sim_write(addr, sim_read(addr) ^ v); return *this; }
+};
+
+class sim_reg16 {
+	const uint16_t addr;
+public:
+	explicit sim_reg16(uint16_t a) : addr(a) {}
+	operator uint16_t() const { return sim_read16(addr); }
+	const sim_reg16 &operator=(uint16_t v) const { sim_write16(addr, v); return *this; }
+	const sim_reg16 &operator+=(uint16_t v) const { sim_write16(addr, sim_read16(addr) + v); return *this; }
+};
+
+#endif
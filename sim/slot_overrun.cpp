@@ -0,0 +1,84 @@
+/* Overrun of slot 7 past the SOF in the interrupt-driven scheduler (sched.c).
+ *
+ * Every OVERRUN_EVERY frames, slot 7 defers its work and ends it OVERRUN_US
+ * later from timer1 compare B, after the SOF of the next frame. Slot 0 of
+ * that frame is lost, slots 1..7 must still run. Exits non-zero if any other
+ * slot is lost or the overruns are not counted.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "sched.h"
+#include "test.h"
+
+// not a multiple of OVERRUN_EVERY: the slot 7 of the last frame ends in time
+#define FRAMES 2005
+#define OVERRUN_EVERY 10
+// from the start of slot 7 past the SOF at 125us, before slot 1 at 250us
+#define OVERRUN_US 185
+
+static uint64_t slots[SCHED_SLOTS];
+static uint32_t frames_seen, deferred;
+
+void slot_task(uint8_t slot)
+{
+	++slots[slot];
+	// slot 0 is the one that gets lost
+	if (slot == 1)
+		++frames_seen;
+	if (slot != SCHED_SLOTS - 1 || frames_seen % OVERRUN_EVERY)
+		return;
+	sched_slot_defer();
+	++deferred;
+	const uint16_t now = TCNT1;
+	OCR1B = now + OVERRUN_US * (F_CPU / 1000000);
+	TIFR1 = (1<<OCF1B);
+	TIMSK1 |= (1<<OCIE1B);
+}
+
+ISR(TIMER1_COMPB_vect)
+{
+	TIMSK1 &= ~(1<<OCIE1B);
+	sched_slot_done();
+}
+
+ISR(USB_GEN_vect)
+{
+	const uint8_t intbits = UDINT;
+	UDINT = 0;
+	if (intbits & (1<<SOFI))
+		sched_sof();
+}
+
+static void sched_main(void)
+{
+	sched_init();
+	while (1)
+		sched_idle();
+}
+
+int main(void)
+{
+	sim_reset();
+	sim_sof_start(8000, 8000, 0);
+	// up to just before the SOF after the last frame
+	sim_run(sched_main, (uint64_t)(FRAMES + 1) * 8000 - US(10));
+
+	printf("%u slots 7 deferred past the SOF, %u overruns\n", deferred,
+	       sched_overruns);
+	for (int i = 0; i < SCHED_SLOTS; i++)
+		printf("slot %d: %llu\n", i, (unsigned long long)slots[i]);
+	printf("\n");
+
+	int failed = 0;
+	failed += check(deferred > 0 && sched_overruns == deferred,
+			"overruns counted");
+	failed += check(slots[0] == FRAMES - deferred, "slot 0 lost");
+	bool others = true;
+	for (int i = 1; i < SCHED_SLOTS; i++)
+		others = others && slots[i] == FRAMES;
+	failed += check(others, "slots 1..7 after the overrun");
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
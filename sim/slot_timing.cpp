@@ -0,0 +1,158 @@
+/* Slot start timing of the interrupt-driven scheduler (sched.c), compared with
+ * the busy-polling main loop it replaced.
+ *
+ * Latency is measured from the event that starts a slot (SOF for slot 0,
+ * timer0 compare match for slots 1..7) to the first instruction of the slot
+ * work. The scheduler runs twice: sleeping in idle between the slots, as
+ * the firmware does, and spinning awake. The difference in latency is the
+ * wake-up from the idle sleep as the sim models it (SIM_IRQ_WAKE_CYCLES),
+ * not a measurement of the chip. Exits non-zero if the scheduler misses
+ * slots, is not strictly better in jitter than the polling loop or the
+ * sleep adds jitter.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "sched.h"
+
+#define FRAMES 20000
+#define SLOT_WORK_CYCLES 600
+#define SOF_JITTER 3
+
+struct latency {
+	uint64_t n;
+	uint64_t min, max, sum;
+};
+
+// [0]: slot 0, started by SOF; [1]: slots 1..7, started by timer0
+static struct latency lat[2];
+
+static void record(uint8_t slot)
+{
+	const uint64_t event = slot == 0 ? sim_last_sof : sim_t0_last_match;
+	struct latency *const l = &lat[slot != 0];
+	const uint64_t d = sim_now - event;
+	if (!l->n || d < l->min)
+		l->min = d;
+	if (!l->n || d > l->max)
+		l->max = d;
+	l->sum += d;
+	++l->n;
+}
+
+void slot_task(uint8_t slot)
+{
+	record(slot);
+	sim_delay_cycles(SLOT_WORK_CYCLES);
+}
+
+ISR(USB_GEN_vect)
+{
+	const uint8_t intbits = UDINT;
+	UDINT = 0;
+	if (intbits & (1<<SOFI))
+		sched_sof();
+}
+
+static void sched_main(void)
+{
+	sched_init();
+	while (1)
+		sched_idle();
+}
+
+// the same without the sleep, the interrupts come between the loads of
+// a spinning loop
+static void sched_spin_main(void)
+{
+	sched_init();
+	sei();
+	while (1)
+		(void)(uint8_t)SREG;
+}
+
+// the main loop of the firmware before sched.c, minus the slot work
+static void polling_main(void)
+{
+	TCCR0A = 0x02;
+	TCCR0B = 0x02;
+	OCR0A = 124;
+	sei();
+	while (1) {
+		for (uint8_t i = 0; i < 8; i++) {
+			if (i == 0) {
+				UDINT &= ~(1<<SOFI);
+				while (!(UDINT & (1<<SOFI)));
+				GTCCR |= (1<<PSRSYNC);
+				TCNT0 = 0;
+			} else {
+				while (!(TIFR0 & (1<<OCF0A)));
+			}
+			TIFR0 |= (1<<OCF0A);
+			const uint8_t intr_state = SREG;
+			cli();
+			slot_task(i);
+			SREG = intr_state;
+		}
+	}
+}
+
+static bool run(const char *name, void (*entry)(void), struct latency out[2])
+{
+	for (int i = 0; i < 2; i++)
+		lat[i] = (struct latency){0, 0, 0, 0};
+	sim_reset();
+	sim_sof_start(8000, 8000, SOF_JITTER);
+	sim_run(entry, (uint64_t)(FRAMES + 1) * 8000);
+
+	printf("%-8s", name);
+	for (int i = 0; i < 2; i++) {
+		printf("  %7llu slots  latency %3llu..%3llu avg %6.2f  jitter %3llu",
+		       (unsigned long long)lat[i].n,
+		       (unsigned long long)lat[i].min, (unsigned long long)lat[i].max,
+		       lat[i].n ? (double)lat[i].sum / lat[i].n : 0.0,
+		       (unsigned long long)(lat[i].max - lat[i].min));
+		out[i] = lat[i];
+	}
+	printf("\n");
+	return lat[0].n >= FRAMES && lat[1].n >= 7 * (uint64_t)FRAMES;
+}
+
+int main(void)
+{
+	struct latency poll[2], sched[2], spin[2];
+
+	printf("slot start latency in cycles, [SOF slots] [timer0 slots]\n");
+	bool ok = run("polling", polling_main, poll);
+	ok = run("spinning", sched_spin_main, spin) && ok;
+	const unsigned spin_overruns = sched_overruns;
+	ok = run("sched", sched_main, sched) && ok;
+	printf("sched: %u overruns, %.1f%% of the time asleep, wake-up from "
+	       "idle %+.2f / %+.2f cycles (model: SIM_IRQ_WAKE_CYCLES %d)\n",
+	       sched_overruns - spin_overruns,
+	       100.0 * sim_sleep_cycles / sim_now,
+	       (double)sched[0].sum / sched[0].n - (double)spin[0].sum / spin[0].n,
+	       (double)sched[1].sum / sched[1].n - (double)spin[1].sum / spin[1].n,
+	       SIM_IRQ_WAKE_CYCLES);
+
+	for (int i = 0; i < 2; i++) {
+		if (sched[i].max - sched[i].min >= poll[i].max - poll[i].min) {
+			printf("FAIL: scheduler jitter not below polling jitter\n");
+			ok = false;
+		}
+		if (sched[i].max - sched[i].min > spin[i].max - spin[i].min) {
+			printf("FAIL: the idle sleep adds jitter\n");
+			ok = false;
+		}
+	}
+	if (sched_overruns) {
+		printf("FAIL: slot overruns\n");
+		ok = false;
+	}
+	if (!ok)
+		return EXIT_FAILURE;
+	printf("OK\n");
+	return EXIT_SUCCESS;
+}
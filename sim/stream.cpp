@@ -0,0 +1,149 @@
+/* Sample stream (see stream.h) of the virtual M1K.
+ *
+ * Built twice: stream with the default host, which polls every frame right
+ * after the SOF, and stream_busy with a host that leaves a quarter of the
+ * polls out. The mouse moves at a changing speed while the buttons are
+ * clicked. Once the firmware has settled, every packet must hold all 8
+ * slots, each read by a burst, and count the frames lost since the packet
+ * before. stream also checks that each packet is taken by the poll of the
+ * next frame, so that slot 7 commits it in its own slot, and that the
+ * samples add up to the motion of the sensor and have the clicks;
+ * stream_busy that frames are lost to the skipped polls. Both check that
+ * the mouse report has all the motion and that no slot overruns.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/io.h>
+#include "usb_mouse.h"
+#include "stream.h"
+#include "sched.h"
+#include "test.h"
+
+// the first slots, while the settings go to the sensor, read nothing
+#define SETTLE MS(500)
+#define MOVE_FROM MS(1000)
+#define MOVE_TO MS(2000)
+#define END MS(2100)
+
+static struct {
+	int64_t x, y;
+} mouse;
+
+static struct {
+	uint32_t packets, bad, lost, lost_wrong, missing, unread, presses;
+	// taken by a poll later than that of the next frame
+	uint32_t late;
+	int64_t x, y;
+	uint16_t frame;
+	uint8_t buttons;
+} stream;
+
+static uint32_t clicks;
+
+static void on_stream(const uint8_t *data, uint8_t len)
+{
+	struct stream_packet p;
+	if (len != sizeof(p)) {
+		++stream.bad;
+		return;
+	}
+	memcpy(&p, data, sizeof(p));
+	if (p.samples != SCHED_SLOTS || p.frame > 0x7ff) {
+		++stream.bad;
+		return;
+	}
+	// each packet is of the frame after the one before and those lost
+	const bool settled = sim_now >= SETTLE;
+	if (stream.packets && ((p.frame - stream.frame) & 0x7ff) != p.lost + 1u)
+		++stream.lost_wrong;
+	stream.frame = p.frame;
+	if (settled && ((sim_last_frame - p.frame) & 0x7ff) != 1)
+		++stream.late;
+	stream.lost += stream.packets && settled ? p.lost : 0;
+	++stream.packets;
+	for (const stream_sample &s : p.sample) {
+		if (!(s.flags & STREAM_SLOT)) {
+			stream.missing += settled;
+			continue;
+		}
+		if (!(s.flags & STREAM_BURST))
+			stream.unread += settled;
+		stream.x += s.dx;
+		stream.y += s.dy;
+		const uint8_t buttons = s.flags & STREAM_BUTTONS;
+		if ((buttons & 1) && !(stream.buttons & 1))
+			++stream.presses;
+		stream.buttons = buttons;
+	}
+}
+
+static void on_report(uint8_t ep, const uint8_t *data, uint8_t len)
+{
+	if (ep == STREAM_ENDPOINT) {
+		on_stream(data, len);
+		return;
+	}
+	if (ep != MOUSE_ENDPOINT || len != MOUSE_REPORT_SIZE)
+		return;
+	mouse.x += (int16_t)(data[1] | data[2] << 8);
+	mouse.y += (int16_t)(data[3] | data[4] << 8);
+}
+
+int main(void)
+{
+	sim_reset();
+	sim_usb_on_report(on_report);
+	sim_usb_host_config config;
+#ifdef STREAM_BUSY
+	config.poll_skip_percent = 25;
+#endif
+	sim_usb_host_start(config);
+
+	static const double speeds[][2] = {
+		{2, -1}, {-30, 12}, {0.2, 0.1}, {45, 40}, {-3, -8}
+	};
+	for (unsigned i = 0; i < 5; i++) {
+		const double *v = speeds[i];
+		sim_at(MOVE_FROM + i * MS(200),
+		       [v] { sim_sensor_velocity(v[0], v[1]); });
+	}
+	sim_at(MOVE_TO, [] { sim_sensor_velocity(0, 0); });
+	for (uint64_t t = MOVE_FROM; t < MOVE_TO; t += MS(50)) {
+		sim_at(t, [] { sim_button(0, true); ++clicks; });
+		sim_at(t + MS(20), [] { sim_button(0, false); });
+	}
+	sim_run(entry, END);
+
+	printf("%u packets, %u frames lost, %u bad, %u slots missing, "
+	       "%u not read, %u late\n", stream.packets, stream.lost, stream.bad,
+	       stream.missing, stream.unread, stream.late);
+	printf("motion: sensor %lld,%lld stream %lld,%lld mouse %lld,%lld\n",
+	       (long long)sim_sensor.latched_x, (long long)sim_sensor.latched_y,
+	       (long long)stream.x, (long long)stream.y,
+	       (long long)mouse.x, (long long)mouse.y);
+	printf("clicks %u, in the stream %u\n\n", clicks, stream.presses);
+
+	int failed = 0;
+	failed += check(stream.packets > 1000 && !stream.bad, "packets");
+	failed += check(!stream.missing && !stream.unread, "all slots");
+	failed += check(!stream.lost_wrong, "lost frames counted");
+#ifdef STREAM_BUSY
+	// the samples of the lost frames are gone, the mouse report has them
+	failed += check(stream.lost > 0, "frames lost to skipped polls");
+#else
+	failed += check(!stream.lost && stream.x == sim_sensor.latched_x
+			&& stream.y == sim_sensor.latched_y, "all samples");
+	failed += check(stream.presses == clicks, "clicks");
+	failed += check(!stream.late, "packets with the next poll");
+#endif
+	failed += check(sim_sensor.latched_x && mouse.x == sim_sensor.latched_x
+			&& mouse.y == sim_sensor.latched_y, "mouse report");
+	failed += check(!sim_sensor.t_srad && !sim_sensor.t_srad_motbr
+			&& !sim_sensor.t_sww && !sim_sensor.t_swr
+			&& !sim_sensor.t_srw && !sim_sensor.t_srom,
+			"sensor timing");
+	failed += check(!sched_overruns, "slot overruns");
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
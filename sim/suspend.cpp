@@ -0,0 +1,168 @@
+/* USB suspend and resume of the virtual M1K.
+ *
+ * The mouse moves, then the host suspends the bus twice. The mouse moves a
+ * little while suspended the first time, which the host ends; the second
+ * time the left button is pressed. Built twice: suspend with a host that
+ * does not enable remote wakeup, so the press is lost and the host ends
+ * the suspend later, and suspend_wakeup with one that does, so the press
+ * wakes it. Exits non-zero if the sensor is read or not resting while
+ * suspended, the cpu is not in power-down, the sensor config or the SROM
+ * is not the same after the resume, the first motion after the resume is
+ * late, the press wakes the host or not as it should, motion is lost or a
+ * slot overruns.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <avr/io.h>
+#include "usb_mouse.h"
+#include "sched.h"
+#include "test.h"
+
+#define MOVE_FROM MS(1000)
+#define MOVE_TO MS(1100)
+#define SUSPEND1 MS(1200)
+#define RESUME1 MS(1500)
+#define SUSPEND2 MS(1700)
+#define PRESS MS(1800)
+#define RELEASE MS(1900)
+#define RESUME2 MS(1950)
+#define END MS(2100)
+// from the end of the resume: the first SOF comes a ms later, the report
+// of its frame goes with the poll of the next
+#define FIRST_MOTION_MAX (MS(2) + US(100))
+
+static struct {
+	int64_t x, y;
+	uint64_t first_motion_at;
+	uint32_t presses_after_resume;
+	uint8_t buttons;
+} host;
+
+static struct {
+	uint8_t config2, run_downshift, rest1_downshift;
+} before, suspended;
+
+static uint64_t bursts_from, bursts_to, power_down_from, power_down_to;
+static uint64_t srom_done_at, resumed_at;
+
+static void on_report(uint8_t ep, const uint8_t *data, uint8_t len)
+{
+	if (ep != MOUSE_ENDPOINT || len != MOUSE_REPORT_SIZE)
+		return;
+	const int16_t dx = data[1] | data[2] << 8;
+	const int16_t dy = data[3] | data[4] << 8;
+	host.x += dx;
+	host.y += dy;
+	if (sim_now > RESUME1 && !host.first_motion_at && (dx || dy))
+		host.first_motion_at = sim_now;
+	if (sim_now > SUSPEND2 && (data[0] & 1) && !(host.buttons & 1))
+		++host.presses_after_resume;
+	host.buttons = data[0];
+}
+
+static void sensor_config(void)
+{
+	before.config2 = sim_sensor_reg(0x10);
+	before.run_downshift = sim_sensor_reg(0x14);
+	before.rest1_downshift = sim_sensor_reg(0x17);
+	srom_done_at = sim_sensor.srom_done_at;
+}
+
+int main(void)
+{
+	sim_reset();
+	sim_usb_on_report(on_report);
+	sim_usb_host_config config;
+#ifdef REMOTE_WAKEUP
+	config.remote_wakeup = true;
+#endif
+	sim_usb_host_start(config);
+
+	sim_at(MOVE_FROM, [] { sim_sensor_velocity(2, -1); });
+	sim_at(MOVE_TO, [] { sim_sensor_velocity(0, 0); });
+	sim_at(MOVE_TO + MS(50), sensor_config);
+
+	// the cpu sleeps in power-down from a few ms after the suspend; the
+	// cycles are counted when it wakes up
+	sim_at(SUSPEND1, [] {
+		power_down_from = sim_power_down_cycles;
+		sim_usb_host_suspend();
+	});
+	// the sensor keeps the motion of the suspend for after it
+	sim_at(SUSPEND1 + MS(20), [] {
+		suspended.config2 = sim_sensor_reg(0x10);
+		suspended.run_downshift = sim_sensor_reg(0x14);
+		suspended.rest1_downshift = sim_sensor_reg(0x17);
+		bursts_from = sim_sensor.bursts;
+		sim_sensor_velocity(0.5, 0.2);
+	});
+	sim_at(SUSPEND1 + MS(40), [] { sim_sensor_velocity(0, 0); });
+	sim_at(RESUME1, [] {
+		bursts_to = sim_sensor.bursts;
+		sim_usb_host_resume();
+	});
+	sim_at(RESUME1 + MS(5), [] {
+		power_down_to = sim_power_down_cycles;
+		sim_sensor_velocity(1, 1);
+	});
+	sim_at(RESUME1 + MS(50), [] { resumed_at = sim_usb.resumed_at; });
+	sim_at(RESUME1 + MS(100), [] { sim_sensor_velocity(0, 0); });
+
+	sim_at(SUSPEND2, sim_usb_host_suspend);
+	sim_at(PRESS, [] { sim_button(0, true); });
+	sim_at(RELEASE, [] { sim_button(0, false); });
+	sim_at(RESUME2, sim_usb_host_resume);
+	sim_run(entry, END);
+
+	const double power_down = (double)(power_down_to - power_down_from)
+		/ (RESUME1 - SUSPEND1);
+	printf("suspended: Config2 %02x Run_Downshift %02x Rest1_Downshift %02x, "
+	       "%.1f%% in power-down\n", suspended.config2,
+	       suspended.run_downshift, suspended.rest1_downshift,
+	       power_down * 100);
+	printf("first motion %.2f ms after the resume\n",
+	       ((double)host.first_motion_at - resumed_at) / MS(1));
+	printf("%u remote wakeups, %u refused, last resume at %.1f ms\n",
+	       sim_usb.remote_wakeups, sim_usb.wakeup_errors,
+	       (double)sim_usb.resumed_at / MS(1));
+	printf("motion: sensor %lld,%lld host %lld,%lld\n\n",
+	       (long long)sim_sensor.latched_x, (long long)sim_sensor.latched_y,
+	       (long long)host.x, (long long)host.y);
+
+	int failed = 0;
+	failed += check((suspended.config2 & 0x20)
+			&& suspended.run_downshift == 1
+			&& suspended.rest1_downshift == 1, "sensor resting");
+	failed += check(bursts_to == bursts_from, "no bursts while suspended");
+	failed += check(power_down > 0.95, "power-down");
+	failed += check(sim_sensor_reg(0x10) == before.config2
+			&& sim_sensor_reg(0x14) == before.run_downshift
+			&& sim_sensor_reg(0x17) == before.rest1_downshift,
+			"sensor config after the resume");
+	failed += check(srom_done_at && sim_sensor.srom_done_at == srom_done_at,
+			"no SROM download");
+	failed += check(host.first_motion_at
+			&& host.first_motion_at - resumed_at <= FIRST_MOTION_MAX,
+			"first motion");
+#ifdef REMOTE_WAKEUP
+	failed += check(sim_usb.remote_wakeups == 1
+			&& sim_usb.resumed_at < RELEASE
+			&& host.presses_after_resume == 1, "remote wakeup");
+#else
+	failed += check(!sim_usb.remote_wakeups
+			&& sim_usb.resumed_at > RESUME2
+			&& !host.presses_after_resume, "no remote wakeup");
+#endif
+	failed += check(!sim_usb.wakeup_errors, "remote wakeup timing");
+	failed += check(!(host.buttons & 1), "buttons released");
+	failed += check(sim_sensor.latched_x && host.x == sim_sensor.latched_x
+			&& host.y == sim_sensor.latched_y, "all motion reported");
+	failed += check(!sim_sensor.t_srad && !sim_sensor.t_srad_motbr
+			&& !sim_sensor.t_sww && !sim_sensor.t_swr
+			&& !sim_sensor.t_srw && !sim_sensor.t_srom,
+			"sensor timing");
+	failed += check(!sim_usb.control_stalls, "control transfers");
+	failed += check(!sched_overruns, "slot overruns");
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
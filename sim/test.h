@@ -0,0 +1,28 @@
+/* Helpers of the scenario programs: virtual time in us and ms, the entry
+ * that boots the firmware for sim_run and the result lines of the checks.
+ */
+#ifndef SIM_TEST_H
+#define SIM_TEST_H
+
+#include <stdio.h>
+#include "sim.h"
+
+#define US(t) ((uint64_t)(t) * SIM_CYCLES_PER_US)
+#define MS(t) (US(t) * 1000)
+
+/* main of the firmware, renamed by the build (-Dmain=firmware_main) */
+int firmware_main(void);
+
+static inline void entry(void)
+{
+	firmware_main();
+}
+
+/* prints the result of a check, returns 1 if it failed */
+static inline int check(bool ok, const char *what)
+{
+	printf("%-40s %s\n", what, ok ? "ok" : "FAIL");
+	return !ok;
+}
+
+#endif
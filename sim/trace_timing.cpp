@@ -0,0 +1,128 @@
+/* Per-stage slot timing trace (trace.c built with TRACE).
+ *
+ * Runs the scheduler with a slot whose stages take a known number of cycles
+ * and checks that the on-device stats and the ring report them. Dumps the
+ * trace buffer every 1000 frames to the file given as argument, which can be
+ * fed to tools/trace_decode.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "sched.h"
+#include "trace.h"
+
+#define FRAMES 20000
+#define DUMP_FRAMES 1000
+#define TOLERANCE 4
+// the marks take no cycles in the sim, see trace.h
+#define MARK_CYCLES 0
+// slot 0 starts from the SOF interrupt, 20 cycles later than the timer0 slots
+#define SLOT_JITTER 20
+
+// cycles of each stage after the previous one; input varies with the slot,
+// the report is sent every other slot. The rest of the slot is left to
+// trace_task in the main loop, which must get to every slot
+#define BURST_CMD_CYCLES 40
+#define INPUT_CYCLES 200
+#define INPUT_PER_SLOT_CYCLES 8
+#define BURST_READ_CYCLES 150
+#define REPORT_CYCLES 50
+
+static FILE *dump_file = NULL;
+static uint64_t frames = 0;
+
+void slot_task(uint8_t slot)
+{
+	TRACE_MARK(TRACE_SLOT);
+	sim_delay_cycles(BURST_CMD_CYCLES);
+	TRACE_MARK(TRACE_BURST_CMD);
+	sim_delay_cycles(INPUT_CYCLES + slot * INPUT_PER_SLOT_CYCLES);
+	TRACE_MARK(TRACE_INPUT);
+	sim_delay_cycles(BURST_READ_CYCLES);
+	TRACE_MARK(TRACE_BURST_READ);
+	if (slot & 1) {
+		sim_delay_cycles(REPORT_CYCLES);
+		TRACE_MARK(TRACE_REPORT);
+	}
+	TRACE_SLOT_DONE();
+
+	if (slot == 0 && ++frames % DUMP_FRAMES == 0 && dump_file)
+		fwrite(&trace, sizeof(trace), 1, dump_file);
+}
+
+ISR(USB_GEN_vect)
+{
+	const uint8_t intbits = UDINT;
+	UDINT = 0;
+	if (intbits & (1<<SOFI))
+		sched_sof();
+}
+
+static void sched_main(void)
+{
+	TRACE_INIT();
+	sched_init();
+	while (1) {
+		TRACE_TASK();
+		sched_idle();
+	}
+}
+
+static bool check(enum trace_stage stage, const char *name,
+		unsigned lo, unsigned hi)
+{
+	const struct trace_stat *s = &trace.stat[stage];
+	printf("%-11s %8u  %5u %8.1f %5u  (expected %u..%u)\n", name, s->count,
+	       s->min, s->count ? (double)s->sum / s->count : 0.0, s->max,
+	       lo, hi);
+	return s->count && s->min + TOLERANCE >= (int)lo && s->max <= (int)hi + TOLERANCE;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && !(dump_file = fopen(argv[1], "wb"))) {
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	sim_reset();
+	sim_sof_start(8000, 8000, 0);
+	sim_run(sched_main, (uint64_t)FRAMES * 8000);
+	if (dump_file)
+		fclose(dump_file);
+
+	const unsigned cmd = BURST_CMD_CYCLES + MARK_CYCLES;
+	const unsigned input = cmd + INPUT_CYCLES + MARK_CYCLES;
+	const unsigned read = input + BURST_READ_CYCLES + MARK_CYCLES;
+	const unsigned report = read + REPORT_CYCLES + MARK_CYCLES;
+	const unsigned last = 7 * INPUT_PER_SLOT_CYCLES;
+
+	printf("stage          count    min      avg   max\n");
+	bool ok = check(TRACE_SLOT, "slot", 1000 - SLOT_JITTER / 2,
+	                1000 + SLOT_JITTER / 2);
+	ok &= check(TRACE_BURST_CMD, "burst_cmd", cmd, cmd);
+	ok &= check(TRACE_INPUT, "input", input, input + last);
+	ok &= check(TRACE_BURST_READ, "burst_read", read, read + last);
+	ok &= check(TRACE_REPORT, "report", report + INPUT_PER_SLOT_CYCLES,
+	            report + last);
+	// the even slots end after the burst, the odd ones after the report
+	ok &= check(TRACE_DONE, "done", read + MARK_CYCLES,
+	            report + last + MARK_CYCLES);
+	if (trace.stat[TRACE_REPORT].count * 2 != trace.stat[TRACE_BURST_CMD].count
+	    && trace.stat[TRACE_REPORT].count * 2 + 1 != trace.stat[TRACE_BURST_CMD].count)
+		ok = false;
+
+	// the ring holds the last entries in stage order
+	const struct trace_entry *e = &trace.ring[(trace.head - 1) & (TRACE_RING_SIZE - 1)];
+	if (e->stage != TRACE_DONE)
+		ok = false;
+
+	if (!ok) {
+		printf("FAIL: traced stage timing does not match the slot\n");
+		return EXIT_FAILURE;
+	}
+	printf("OK\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,47 @@
+/* Time on the wire of the sensor transport (see spi.h), on the virtual M1K.
+ *
+ * Boots the whole firmware and tracks for a second, then reports how long
+ * the SROM upload took, from its first data byte to NCS going high, and the
+ * data phase of the motion bursts, from the first data byte to NCS high.
+ * Built once per transport (transport_spi, transport_usart), make bench
+ * runs both.
+ * Exits non-zero if the firmware violates a sensor timing or the upload is
+ * incomplete, so that a faster transport can not cheat.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <avr/io.h>
+#include "test.h"
+
+#ifdef SPI_USART
+#define TRANSPORT "usart1 mspim"
+#else
+#define TRANSPORT "spi"
+#endif
+
+int main(void)
+{
+	sim_reset();
+	sim_usb_host_start(sim_usb_host_config());
+	sim_at(MS(1000), [] { sim_sensor_velocity(12.5, -4); });
+	sim_run(entry, MS(2000));
+
+	const uint64_t srom = sim_sensor.srom_done_at - sim_sensor.srom_start_at;
+	const uint64_t bursts = sim_sensor.bursts ? sim_sensor.bursts : 1;
+	printf("%-13s srom %5.2f ms (%.2f us/byte), burst read %5.1f cycles "
+	       "(max %u)\n", TRANSPORT,
+	       (double)srom / MS(1),
+	       (double)srom / US(1) / (sim_sensor.srom_bytes ? sim_sensor.srom_bytes : 1),
+	       (double)sim_sensor.burst_read_cycles / bursts,
+	       sim_sensor.burst_read_max);
+
+	const bool ok = sim_sensor.srom_bytes == 4094 && sim_sensor.bursts
+		&& !sim_sensor.t_srad && !sim_sensor.t_srad_motbr
+		&& !sim_sensor.t_sww && !sim_sensor.t_swr
+		&& !sim_sensor.t_srw && !sim_sensor.t_srom
+		&& !sim_sensor.burst_unarmed && !sim_sensor.wcol;
+	if (!ok)
+		printf("FAIL: sensor timing or protocol\n");
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,903 @@
+/* USB device controller of the ATmega32U2 and a virtual host driving it.
+ *
+ * The device side implements the endpoint registers (UENUM, UECONX, UECFGnX,
+ * UESTAnX, UEINTX, UEDATX, UEBCLX, UEINT, UERST) with FIFO banks, the
+ * attach/reset logic and UDADDR. The host side turns a transaction
+ * schedule into tokens against it: a bus reset after attach, control
+ * transfers for enumeration and on request, and interrupt and bulk IN
+ * polls after each SOF. The host sees what a real one would: ACK with
+ * data, NAK, STALL or no answer.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+
+#define SIM_REG(addr) (addr)
+#define SIM_REG16(addr) (addr)
+#include <avr/io.h>
+#include "periph.h"
+
+sim_usb_stats sim_usb;
+
+/* DPRAM of the 32u2 shared by all endpoints */
+#define DPRAM_SIZE 176
+#define NUM_ENDPOINTS 5
+
+#define FLAG_BITS (_BV(TXINI) | _BV(STALLEDI) | _BV(RXOUTI) | _BV(RXSTPI) \
+		| _BV(NAKOUTI) | _BV(NAKINI))
+
+/**************************************************************************
+ *  device: endpoints
+ **************************************************************************/
+
+typedef std::vector<uint8_t> packet;
+
+struct endpoint {
+	uint8_t conx, cfg0, cfg1, ienx;
+	uint8_t flags;		// UEINTX interrupt flags
+	bool cfgok;
+	packet fill;		// bank the cpu is writing (IN)
+	std::deque<packet> banks; // IN banks handed to the host
+	packet rx;		// SETUP/OUT data the cpu is reading
+	size_t rx_pos;
+	bool rx_full;
+};
+
+static struct {
+	endpoint ep[NUM_ENDPOINTS];
+	uint8_t uenum;
+	bool in_reset;		// host is driving a bus reset
+	uint64_t pll_lock_at;
+} dev;
+
+static bool is_control(const endpoint &e)
+{
+	return (e.cfg0 >> 6) == 0;
+}
+
+static bool is_in(const endpoint &e)
+{
+	return e.cfg0 & 1;
+}
+
+static unsigned ep_size(const endpoint &e)
+{
+	return 8 << ((e.cfg1 >> 4) & 7);
+}
+
+static unsigned ep_banks(const endpoint &e)
+{
+	return ((e.cfg1 >> 2) & 3) ? 2 : 1;
+}
+
+static void ep_flush(endpoint &e)
+{
+	e.fill.clear();
+	e.banks.clear();
+	e.rx.clear();
+	e.rx_pos = 0;
+	e.rx_full = false;
+}
+
+static void ep_reset(endpoint &e)
+{
+	e.conx = e.cfg0 = e.cfg1 = e.ienx = e.flags = 0;
+	e.cfgok = false;
+	ep_flush(e);
+}
+
+// endpoint memory is allocated in endpoint order, the 32u2 fails the
+// configuration of an endpoint that does not fit anymore
+static void ep_allocate(void)
+{
+	unsigned used = 0;
+	for (int i = 0; i < NUM_ENDPOINTS; i++) {
+		endpoint &e = dev.ep[i];
+		if (!(e.conx & _BV(EPEN)) || !(e.cfg1 & 0x02)) {
+			e.cfgok = false;
+			continue;
+		}
+		used += ep_size(e) * ep_banks(e);
+		e.cfgok = used <= DPRAM_SIZE;
+	}
+}
+
+static bool attached(void)
+{
+	const uint8_t usbcon = sim_io[0xD8];
+	return (usbcon & _BV(USBE)) && !(usbcon & _BV(FRZCLK))
+		&& !(sim_io[0xE0] & _BV(DETACH));
+}
+
+static uint8_t ueintx(const endpoint &e)
+{
+	uint8_t v = e.flags;
+	if (!is_control(e)) {
+		const bool free_bank = e.banks.size() < ep_banks(e);
+		if (is_in(e)) {
+			if (free_bank)
+				v |= _BV(FIFOCON);
+			if (free_bank && e.fill.size() < ep_size(e))
+				v |= _BV(RWAL);
+		} else if (e.rx_full) {
+			v |= _BV(FIFOCON);
+			if (e.rx_pos < e.rx.size())
+				v |= _BV(RWAL);
+		}
+	}
+	return v;
+}
+
+bool sim_usb_com_pending(void)
+{
+	for (int i = 0; i < NUM_ENDPOINTS; i++) {
+		const endpoint &e = dev.ep[i];
+		if (e.ienx & e.flags & FLAG_BITS)
+			return true;
+	}
+	return false;
+}
+
+static void write_ueintx(endpoint &e, uint8_t value)
+{
+	const uint8_t old = e.flags;
+	e.flags &= value | ~FLAG_BITS;
+	if (is_control(e)) {
+		if ((old & _BV(RXSTPI)) && !(value & _BV(RXSTPI)))
+			e.rx.clear(), e.rx_pos = 0;
+		if ((old & _BV(RXOUTI)) && !(value & _BV(RXOUTI)))
+			e.rx.clear(), e.rx_pos = 0;
+		if ((old & _BV(TXINI)) && !(value & _BV(TXINI))) {
+			if (old & _BV(RXSTPI)) {
+				// acknowledged together with the SETUP, the bank
+				// is still free
+				e.flags |= _BV(TXINI);
+			} else {
+				e.banks.push_back(e.fill);
+				e.fill.clear();
+			}
+		}
+		return;
+	}
+	if (is_in(e)) {
+		const bool free_bank = e.banks.size() < ep_banks(e);
+		if ((value & _BV(KILLBK)) && !e.banks.empty())
+			e.banks.pop_back();
+		if (free_bank && !(value & _BV(FIFOCON))) {
+			e.banks.push_back(e.fill);
+			e.fill.clear();
+		}
+	} else if (e.rx_full && !(value & _BV(FIFOCON))) {
+		e.rx.clear();
+		e.rx_pos = 0;
+		e.rx_full = false;
+	}
+}
+
+static bool usb_read(uint16_t addr, uint8_t *value)
+{
+	endpoint &e = dev.ep[dev.uenum < NUM_ENDPOINTS ? dev.uenum : 0];
+	switch (addr) {
+	case 0x49: { // PLLCSR
+		uint8_t v = sim_io[addr] & ~_BV(PLOCK);
+		if ((v & _BV(PLLE)) && sim_now >= dev.pll_lock_at)
+			v |= _BV(PLOCK);
+		*value = v;
+		return true;
+	}
+	case 0xE8: *value = ueintx(e); return true;
+	case 0xE9: *value = dev.uenum; return true;
+	case 0xEB: *value = e.conx; return true;
+	case 0xEC: *value = e.cfg0; return true;
+	case 0xED: *value = e.cfg1; return true;
+	case 0xEE: // UESTA0X
+		*value = (e.cfgok ? _BV(CFGOK) : 0)
+			| (is_in(e) ? e.banks.size() : e.rx_full);
+		return true;
+	case 0xEF: *value = 0; return true;
+	case 0xF0: *value = e.ienx; return true;
+	case 0xF1: // UEDATX
+		*value = e.rx_pos < e.rx.size() ? e.rx[e.rx_pos++] : 0;
+		return true;
+	case 0xF2: { // UEBCLX, bytes in the bank the cpu is on
+		const bool receiving = is_control(e)
+			? e.flags & (_BV(RXSTPI) | _BV(RXOUTI)) : !is_in(e);
+		*value = receiving ? e.rx.size() - e.rx_pos : e.fill.size();
+		return true;
+	}
+	case 0xF4: { // UEINT
+		uint8_t v = 0;
+		for (int i = 0; i < NUM_ENDPOINTS; i++)
+			if (dev.ep[i].ienx & dev.ep[i].flags & FLAG_BITS)
+				v |= _BV(i);
+		*value = v;
+		return true;
+	}
+	}
+	return false;
+}
+
+static void host_device_attached(void);
+static bool host_remote_wakeup(void);
+
+static bool usb_write(uint16_t addr, uint8_t value)
+{
+	endpoint &e = dev.ep[dev.uenum < NUM_ENDPOINTS ? dev.uenum : 0];
+	switch (addr) {
+	case 0x49: // PLLCSR
+		if ((value & _BV(PLLE)) && !(sim_io[addr] & _BV(PLLE)))
+			dev.pll_lock_at = sim_now + 100 * SIM_CYCLES_PER_US;
+		sim_io[addr] = value & ~_BV(PLOCK);
+		return true;
+	case 0xE0: // UDCON
+		// RMWKUP stays set until the end of the resume signaling
+		if ((value & _BV(RMWKUP)) && !(sim_io[addr] & _BV(RMWKUP))
+		    && !host_remote_wakeup())
+			value &= ~_BV(RMWKUP);
+		// fall through
+	case 0xD8: { // USBCON
+		const bool was = attached();
+		sim_io[addr] = value;
+		if (!was && attached())
+			host_device_attached();
+		return true;
+	}
+	case 0xE8: write_ueintx(e, value); return true;
+	case 0xE9: dev.uenum = value & 7; return true;
+	case 0xEA: // UERST
+		for (int i = 1; i < NUM_ENDPOINTS; i++)
+			if (value & _BV(i))
+				ep_flush(dev.ep[i]);
+		return true;
+	case 0xEB: // UECONX
+		if (value & _BV(STALLRQC))
+			e.conx &= ~_BV(STALLRQ);
+		if (value & _BV(STALLRQ))
+			e.conx |= _BV(STALLRQ);
+		if (!(value & _BV(EPEN)))
+			ep_reset(e);
+		else
+			e.conx |= _BV(EPEN);
+		ep_allocate();
+		return true;
+	case 0xEC: e.cfg0 = value; return true;
+	case 0xED: e.cfg1 = value; ep_allocate(); return true;
+	case 0xF0: e.ienx = value; return true;
+	case 0xF1: // UEDATX
+		if (e.fill.size() < ep_size(e))
+			e.fill.push_back(value);
+		return true;
+	}
+	return false;
+}
+
+/**************************************************************************
+ *  device: bus side
+ **************************************************************************/
+
+enum response { ACK, NAK, STALL, NO_RESPONSE };
+
+static endpoint *addressed(uint8_t address, uint8_t epn)
+{
+	const uint8_t udaddr = sim_io[0xE3];
+	const uint8_t own = (udaddr & _BV(ADDEN)) ? udaddr & 0x7f : 0;
+	if (!attached() || dev.in_reset || address != own || epn >= NUM_ENDPOINTS)
+		return NULL;
+	endpoint &e = dev.ep[epn];
+	if (!(e.conx & _BV(EPEN)) || !e.cfgok)
+		return NULL;
+	return &e;
+}
+
+static response dev_setup(uint8_t address, const uint8_t setup[8])
+{
+	endpoint *e = addressed(address, 0);
+	if (!e)
+		return NO_RESPONSE;
+	e->rx.assign(setup, setup + 8);
+	e->rx_pos = 0;
+	e->fill.clear();
+	e->banks.clear();
+	e->conx &= ~_BV(STALLRQ);
+	e->flags &= ~(_BV(RXOUTI) | _BV(STALLEDI));
+	e->flags |= _BV(RXSTPI) | _BV(TXINI);
+	return ACK;
+}
+
+static response dev_in(uint8_t address, uint8_t epn, packet &data)
+{
+	endpoint *e = addressed(address, epn);
+	if (!e)
+		return NO_RESPONSE;
+	if (e->conx & _BV(STALLRQ)) {
+		e->flags |= _BV(STALLEDI);
+		return STALL;
+	}
+	if (e->banks.empty()) {
+		e->flags |= _BV(NAKINI);
+		return NAK;
+	}
+	data = e->banks.front();
+	e->banks.pop_front();
+	e->flags |= _BV(TXINI);
+	return ACK;
+}
+
+static response dev_out(uint8_t address, uint8_t epn, const packet &data)
+{
+	endpoint *e = addressed(address, epn);
+	if (!e)
+		return NO_RESPONSE;
+	if (e->conx & _BV(STALLRQ)) {
+		e->flags |= _BV(STALLEDI);
+		return STALL;
+	}
+	if (e->flags & (_BV(RXOUTI) | _BV(RXSTPI)) || e->rx_full) {
+		e->flags |= _BV(NAKOUTI);
+		return NAK;
+	}
+	e->rx = data;
+	e->rx_pos = 0;
+	e->rx_full = !is_control(*e);
+	e->flags |= _BV(RXOUTI);
+	return ACK;
+}
+
+static void dev_bus_reset(void)
+{
+	for (int i = 0; i < NUM_ENDPOINTS; i++)
+		ep_reset(dev.ep[i]);
+	sim_io[0xE3] = 0; // UDADDR
+	sim_io[0xE1] |= _BV(EORSTI);
+}
+
+/**************************************************************************
+ *  host
+ **************************************************************************/
+
+enum host_state { DETACHED, DEBOUNCE, RESET, RUNNING };
+
+struct control_transfer {
+	uint8_t setup[8];
+	packet out;
+	packet in;
+	uint16_t length;
+	size_t out_pos;
+	enum { SETUP, DATA_IN, DATA_OUT, STATUS_IN, STATUS_OUT } stage;
+	uint64_t deadline;
+	sim_usb_control_fn done;
+};
+
+struct in_endpoint {
+	uint8_t ep;
+	uint8_t interval;
+	bool bulk;
+};
+
+static struct {
+	bool started;
+	sim_usb_host_config config;
+	host_state state;
+	uint8_t address;	// address the host talks to
+	uint8_t ep0_size;
+	bool configured;
+	bool polls_paused;
+	bool bulk_paused;
+	bool suspended;		// no SOFs, from the suspend to the end of the resume
+	bool resuming;
+	bool wakeup_enabled;	// SET_FEATURE(DEVICE_REMOTE_WAKEUP) before it
+	uint64_t idle_since;
+	uint32_t suspends;	// invalidates events of a suspend before
+	std::deque<control_transfer> control;
+	bool control_scheduled;
+	uint64_t control_not_before;
+	std::vector<uint8_t> config_desc;
+	std::vector<in_endpoint> polled;
+	sim_usb_report_fn on_report;
+	uint64_t generation;	// invalidates events scheduled before a reset
+} host;
+
+#define US(t) ((uint64_t)(t) * SIM_CYCLES_PER_US)
+// USB_CTRL_GET_TIMEOUT of linux
+#define CONTROL_TIMEOUT US(5000000)
+
+static void control_schedule(uint64_t when);
+
+static void control_finish(int status)
+{
+	control_transfer t = host.control.front();
+	host.control.pop_front();
+	if (status == SIM_USB_OK)
+		++sim_usb.control_transfers;
+	else if (status == SIM_USB_STALL)
+		++sim_usb.control_stalls;
+	if (t.done)
+		t.done(status, t.in.data(), t.in.size());
+	if (!host.control.empty())
+		control_schedule(sim_now + host.config.control_gap_cycles);
+}
+
+static void control_step(uint64_t generation)
+{
+	host.control_scheduled = false;
+	// the suspend holds the transfers back, the resume schedules them
+	if (generation != host.generation || host.control.empty()
+	    || host.suspended)
+		return;
+	if (sim_now < host.control_not_before) {
+		control_schedule(host.control_not_before);
+		return;
+	}
+	control_transfer &t = host.control.front();
+	if (!t.deadline)
+		t.deadline = sim_now + CONTROL_TIMEOUT;
+	if (sim_now > t.deadline) {
+		control_finish(SIM_USB_TIMEOUT);
+		return;
+	}
+
+	const bool dir_in = t.setup[0] & 0x80;
+	response r = NO_RESPONSE;
+	packet data;
+	switch (t.stage) {
+	case control_transfer::SETUP:
+		r = dev_setup(host.address, t.setup);
+		if (r == ACK)
+			t.stage = !t.length ? control_transfer::STATUS_IN
+				: dir_in ? control_transfer::DATA_IN
+				: control_transfer::DATA_OUT;
+		break;
+	case control_transfer::DATA_IN:
+		r = dev_in(host.address, 0, data);
+		if (r == ACK) {
+			t.in.insert(t.in.end(), data.begin(), data.end());
+			if (data.size() < host.ep0_size || t.in.size() >= t.length) {
+				if (t.in.size() > t.length)
+					t.in.resize(t.length);
+				t.stage = control_transfer::STATUS_OUT;
+			}
+		}
+		break;
+	case control_transfer::DATA_OUT: {
+		const size_t n = t.out.size() - t.out_pos < host.ep0_size
+			? t.out.size() - t.out_pos : host.ep0_size;
+		r = dev_out(host.address, 0, packet(t.out.begin() + t.out_pos,
+			t.out.begin() + t.out_pos + n));
+		if (r == ACK) {
+			t.out_pos += n;
+			if (t.out_pos >= t.out.size())
+				t.stage = control_transfer::STATUS_IN;
+		}
+		break;
+	}
+	case control_transfer::STATUS_IN:
+		r = dev_in(host.address, 0, data);
+		if (r == ACK) {
+			control_finish(SIM_USB_OK);
+			return;
+		}
+		break;
+	case control_transfer::STATUS_OUT:
+		r = dev_out(host.address, 0, packet());
+		if (r == ACK) {
+			control_finish(SIM_USB_OK);
+			return;
+		}
+		break;
+	}
+
+	switch (r) {
+	case ACK:
+		control_schedule(sim_now + host.config.control_gap_cycles);
+		break;
+	case NAK:
+		++sim_usb.control_naks;
+		control_schedule(sim_now + host.config.control_retry_cycles);
+		break;
+	case STALL:
+		control_finish(SIM_USB_STALL);
+		break;
+	case NO_RESPONSE:
+		++sim_usb.no_response;
+		control_schedule(sim_now + host.config.control_retry_cycles);
+		break;
+	}
+}
+
+static void control_schedule(uint64_t when)
+{
+	if (host.control_scheduled || host.state != RUNNING)
+		return;
+	host.control_scheduled = true;
+	const uint64_t generation = host.generation;
+	sim_at(when, [generation] { control_step(generation); });
+}
+
+void sim_usb_control_out(uint8_t bmRequestType, uint8_t bRequest,
+		uint16_t wValue, uint16_t wIndex, uint16_t wLength,
+		const uint8_t *out, uint16_t out_len, sim_usb_control_fn done)
+{
+	control_transfer t;
+	const uint8_t setup[8] = {bmRequestType, bRequest,
+		(uint8_t)wValue, (uint8_t)(wValue >> 8),
+		(uint8_t)wIndex, (uint8_t)(wIndex >> 8),
+		(uint8_t)wLength, (uint8_t)(wLength >> 8)};
+	memcpy(t.setup, setup, sizeof(setup));
+	if (!(bmRequestType & 0x80) && out)
+		t.out.assign(out, out + out_len);
+	t.length = wLength;
+	t.out_pos = 0;
+	t.stage = control_transfer::SETUP;
+	t.deadline = 0;
+	t.done = done;
+	host.control.push_back(t);
+	control_schedule(sim_now + host.config.control_gap_cycles);
+}
+
+void sim_usb_control(uint8_t bmRequestType, uint8_t bRequest, uint16_t wValue,
+		uint16_t wIndex, uint16_t wLength, const uint8_t *out,
+		sim_usb_control_fn done)
+{
+	sim_usb_control_out(bmRequestType, bRequest, wValue, wIndex, wLength,
+			out, wLength, done);
+}
+
+static void enumeration_failed(const char *what, int status)
+{
+	fprintf(stderr, "sim: usb enumeration failed at %s (%d)\n", what, status);
+	abort();
+}
+
+// the interrupt and bulk IN endpoints from the configuration descriptor
+static void find_in_endpoints(void)
+{
+	host.polled.clear();
+	const std::vector<uint8_t> &d = host.config_desc;
+	for (size_t i = 0; i + 1 < d.size() && d[i]; i += d[i]) {
+		if (d[i + 1] != 5 || i + 7 > d.size() || !(d[i + 2] & 0x80))
+			continue;
+		const uint8_t type = d[i + 3] & 3;
+		if (type == 3)
+			host.polled.push_back({(uint8_t)(d[i + 2] & 0x7f),
+				(uint8_t)(d[i + 6] ? d[i + 6] : 1), false});
+		else if (type == 2)
+			host.polled.push_back({(uint8_t)(d[i + 2] & 0x7f), 1, true});
+	}
+}
+
+static void enumerate(void)
+{
+	// the sequence of linux: device descriptor at address 0, address,
+	// descriptors, configuration, then the HID driver's requests
+	sim_usb_control(0x80, 6, 0x0100, 0, 64, NULL,
+			[](int status, const uint8_t *data, uint16_t len) {
+		if (status || len < 8)
+			enumeration_failed("device descriptor", status);
+		host.ep0_size = data[7];
+	});
+	sim_usb_control(0x00, 5, 1, 0, 0, NULL,
+			[](int status, const uint8_t *, uint16_t) {
+		if (status)
+			enumeration_failed("set address", status);
+		host.address = 1;
+		host.control_not_before = sim_now
+			+ US(host.config.set_address_recovery_us);
+	});
+	sim_usb_control(0x80, 6, 0x0100, 0, 18, NULL,
+			[](int status, const uint8_t *, uint16_t len) {
+		if (status || len != 18)
+			enumeration_failed("device descriptor", status);
+	});
+	sim_usb_control(0x80, 6, 0x0200, 0, 9, NULL,
+			[](int status, const uint8_t *data, uint16_t len) {
+		if (status || len != 9)
+			enumeration_failed("configuration descriptor", status);
+		const uint16_t total = data[2] | data[3] << 8;
+		sim_usb_control(0x80, 6, 0x0200, 0, total, NULL,
+				[total](int status, const uint8_t *data, uint16_t len) {
+			if (status || len != total)
+				enumeration_failed("configuration descriptor", status);
+			host.config_desc.assign(data, data + len);
+			find_in_endpoints();
+			sim_usb_control(0x80, 6, 0x0300, 0, 255, NULL, NULL);
+			sim_usb_control(0x80, 6, 0x0302, 0x0409, 255, NULL, NULL);
+			sim_usb_control(0x80, 6, 0x0301, 0x0409, 255, NULL, NULL);
+			sim_usb_control(0x00, 9, 1, 0, 0, NULL,
+					[](int status, const uint8_t *, uint16_t) {
+				if (status)
+					enumeration_failed("set configuration", status);
+				host.configured = true;
+				sim_usb.configured_at = sim_now;
+			});
+			// usbhid: SET_IDLE(0) may be stalled, then the report
+			// descriptor of every HID interface
+			const std::vector<uint8_t> &d = host.config_desc;
+			for (size_t i = 0; i + 1 < d.size() && d[i]; i += d[i]) {
+				if (d[i + 1] != 4 || d[i + 5] != 3)
+					continue;
+				const uint8_t intf = d[i + 2];
+				sim_usb_control(0x21, 10, 0, intf, 0, NULL, NULL);
+				// HID descriptor follows the interface descriptor
+				const size_t h = i + d[i];
+				if (h + 9 <= d.size() && d[h + 1] == 0x21) {
+					const uint16_t rlen = d[h + 7] | d[h + 8] << 8;
+					sim_usb_control(0x81, 6, 0x2200, intf, rlen,
+							NULL, NULL);
+				}
+			}
+		});
+	});
+}
+
+// a full speed transaction with up to 64 bytes takes ~50us
+#define TRANSACTION_CYCLES (50 * SIM_CYCLES_PER_US)
+// bulk packets per frame, the bus time left by the other endpoints
+#define BULK_PER_FRAME 8
+
+static void poll(uint64_t generation, uint8_t ep, unsigned bulk)
+{
+	if (generation != host.generation)
+		return;
+	++sim_usb.polls;
+	packet data;
+	switch (dev_in(host.address, ep, data)) {
+	case ACK:
+		++sim_usb.reports;
+		if (!sim_usb.first_report_at)
+			sim_usb.first_report_at = sim_now;
+		if (host.on_report)
+			host.on_report(ep, data.data(), data.size());
+		// bulk goes on within the frame as long as there is data
+		if (bulk && bulk < BULK_PER_FRAME)
+			sim_at(sim_now + TRANSACTION_CYCLES,
+			       [generation, ep, bulk] { poll(generation, ep, bulk + 1); });
+		break;
+	case NAK:
+		++sim_usb.poll_naks;
+		break;
+	case STALL:
+		break;
+	case NO_RESPONSE:
+		++sim_usb.no_response;
+		break;
+	}
+}
+
+void sim_usb_sof(uint64_t when, uint16_t frame)
+{
+	if (!host.started || host.state != RUNNING || !host.configured
+	    || host.polls_paused)
+		return;
+	const uint64_t generation = host.generation;
+	uint64_t t = when + host.config.poll_delay_cycles;
+	if (host.config.poll_jitter_cycles)
+		t += sim_rand() % host.config.poll_jitter_cycles;
+	// interrupt endpoints first, they have their bandwidth reserved
+	for (const in_endpoint &p : host.polled) {
+		if (p.bulk || frame % p.interval)
+			continue;
+		if (host.config.poll_skip_percent
+		    && sim_rand() % 100 < host.config.poll_skip_percent)
+			continue;
+		const uint8_t ep = p.ep;
+		sim_at(t, [generation, ep] { poll(generation, ep, 0); });
+		t += TRANSACTION_CYCLES;
+	}
+	for (const in_endpoint &p : host.polled) {
+		if (!p.bulk || host.bulk_paused)
+			continue;
+		const uint8_t ep = p.ep;
+		sim_at(t, [generation, ep] { poll(generation, ep, 1); });
+		t += TRANSACTION_CYCLES;
+	}
+}
+
+static void host_device_attached(void)
+{
+	if (!host.started || host.state != DETACHED)
+		return;
+	host.state = DEBOUNCE;
+	const uint64_t generation = ++host.generation;
+	sim_at(sim_now + US(host.config.connect_debounce_us), [generation] {
+		if (generation != host.generation)
+			return;
+		host.state = RESET;
+		dev.in_reset = true;
+		sim_at(sim_now + US(host.config.reset_us), [generation] {
+			if (generation != host.generation)
+				return;
+			dev.in_reset = false;
+			dev_bus_reset();
+			host.state = RUNNING;
+			host.address = 0;
+			host.ep0_size = 64;
+			host.control_not_before = sim_now
+				+ US(host.config.reset_recovery_us);
+			sim_sof_start(host.config.sof_period,
+				sim_now + (uint64_t)host.config.sof_period,
+				host.config.sof_jitter);
+			enumerate();
+		});
+	});
+}
+
+void sim_usb_host_start(const sim_usb_host_config &config)
+{
+	host.started = true;
+	host.config = config;
+	if (attached())
+		host_device_attached();
+}
+
+void sim_usb_host_pause_polls(bool paused)
+{
+	host.polls_paused = paused;
+}
+
+void sim_usb_host_pause_bulk(bool paused)
+{
+	host.bulk_paused = paused;
+}
+
+// the device detects the suspend after 3ms of idle bus
+#define SUSPEND_DETECT US(3000)
+// the bus must be idle that long before the device signals resume
+#define REMOTE_WAKEUP_IDLE US(5000)
+// resume signaling of the device; the host takes it over after 1ms
+#define REMOTE_WAKEUP_SIGNAL US(2000)
+// the host drives resume for 20ms, then the SOFs start again and the
+// transfers wait another 10ms of resume recovery
+#define RESUME US(20000)
+#define RESUME_RECOVERY US(10000)
+
+static void host_suspend_now(void)
+{
+	host.suspended = true;
+	host.idle_since = sim_now;
+	sim_sof_stop();
+	sim_usb.suspended_at = sim_now;
+	const uint64_t generation = host.generation;
+	const uint32_t suspends = ++host.suspends;
+	sim_at(sim_now + SUSPEND_DETECT, [generation, suspends] {
+		if (generation == host.generation && suspends == host.suspends
+		    && host.suspended)
+			sim_io[0xE1] |= _BV(SUSPI);
+	});
+}
+
+static void host_resume(void)
+{
+	host.resuming = true;
+	// any activity on the idle bus sets WAKEUPI, even with the clock
+	// frozen
+	sim_io[0xE1] |= _BV(WAKEUPI);
+	const uint64_t generation = host.generation;
+	const uint32_t suspends = host.suspends;
+	sim_at(sim_now + RESUME, [generation, suspends] {
+		if (generation != host.generation || suspends != host.suspends)
+			return;
+		host.suspended = false;
+		host.resuming = false;
+		sim_io[0xE1] |= _BV(EORSMI);
+		sim_usb.resumed_at = sim_now;
+		sim_sof_start(host.config.sof_period,
+			sim_now + (uint64_t)host.config.sof_period,
+			host.config.sof_jitter);
+		host.control_not_before = sim_now + RESUME_RECOVERY;
+		if (host.wakeup_enabled) {
+			host.wakeup_enabled = false;
+			sim_usb_control(0x00, 1, 1, 0, 0, NULL, NULL);
+		} else if (!host.control.empty()) {
+			control_schedule(host.control_not_before);
+		}
+	});
+}
+
+// RMWKUP set by the device; false if it must not signal resume now
+static bool host_remote_wakeup(void)
+{
+	const uint8_t usbcon = sim_io[0xD8];
+	if (!host.suspended || host.resuming || !host.wakeup_enabled
+	    || !(usbcon & _BV(USBE)) || (usbcon & _BV(FRZCLK))
+	    || sim_now - host.idle_since < REMOTE_WAKEUP_IDLE) {
+		++sim_usb.wakeup_errors;
+		return false;
+	}
+	++sim_usb.remote_wakeups;
+	const uint64_t generation = host.generation;
+	const uint32_t suspends = host.suspends;
+	sim_at(sim_now + REMOTE_WAKEUP_SIGNAL, [generation, suspends] {
+		sim_io[0xE0] &= ~_BV(RMWKUP);
+		if (generation != host.generation || suspends != host.suspends)
+			return;
+		sim_io[0xE1] |= _BV(UPRSMI);
+		host_resume();
+	});
+	return true;
+}
+
+void sim_usb_host_suspend(void)
+{
+	if (!host.started || host.state != RUNNING || host.suspended)
+		return;
+	const std::vector<uint8_t> &d = host.config_desc;
+	if (!host.config.remote_wakeup || d.size() < 9 || !(d[7] & 0x20)) {
+		host_suspend_now();
+		return;
+	}
+	// like linux, enable remote wakeup right before the suspend
+	sim_usb_control(0x00, 3, 1, 0, 0, NULL,
+			[](int status, const uint8_t *, uint16_t) {
+		host.wakeup_enabled = status == SIM_USB_OK;
+		host_suspend_now();
+	});
+}
+
+void sim_usb_host_resume(void)
+{
+	if (host.suspended && !host.resuming)
+		host_resume();
+}
+
+bool sim_usb_host_configured(void)
+{
+	return host.configured;
+}
+
+void sim_usb_on_report(sim_usb_report_fn fn)
+{
+	host.on_report = fn;
+}
+
+const std::vector<uint8_t> &sim_usb_config_descriptor(void)
+{
+	return host.config_desc;
+}
+
+/**************************************************************************
+ *  emulator interface
+ **************************************************************************/
+
+static void usb_reset(void)
+{
+	for (int i = 0; i < NUM_ENDPOINTS; i++)
+		ep_reset(dev.ep[i]);
+	dev.uenum = 0;
+	dev.in_reset = false;
+	dev.pll_lock_at = 0;
+	sim_io[0xD8] = _BV(FRZCLK);	// USBCON
+	sim_io[0xE0] = _BV(DETACH);	// UDCON
+	++host.generation;
+	host.started = false;
+	host.state = DETACHED;
+	host.configured = false;
+	host.polls_paused = false;
+	host.bulk_paused = false;
+	host.suspended = false;
+	host.resuming = false;
+	host.wakeup_enabled = false;
+	host.idle_since = 0;
+	host.suspends = 0;
+	host.control.clear();
+	host.control_scheduled = false;
+	host.control_not_before = 0;
+	host.config_desc.clear();
+	host.polled.clear();
+	host.on_report = nullptr;
+	sim_usb = sim_usb_stats();
+}
+
+static uint64_t usb_next_event(void)
+{
+	return SIM_NEVER;
+}
+
+static void usb_update(void)
+{
+}
+
+const sim_device sim_usb_device = {
+	usb_reset, usb_next_event, usb_update, usb_read, usb_write
+};
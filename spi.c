@@ -0,0 +1,148 @@
+#include "spi.h"
+
+#include <avr/interrupt.h>
+
+// burst in progress
+static uint8_t *burst_buf;
+static uint8_t burst_len;
+static uint8_t burst_gate;
+static volatile bool burst_busy = false;
+// timer1 at the end of the gap, when the first data byte may start
+static uint16_t burst_due;
+
+// the compare match comes this early, so that the interrupt response and
+// the prologue of the vector are in the gap instead of after it
+#define BURST_ISR_LEAD 40
+// up to this many cycles before the gap ends, waiting for it is cheaper
+// than the interrupt: its response, the save and the restore
+#define BURST_WAIT_MAX 80
+
+#ifndef SPI_USART
+
+void spi_init(void)
+{
+	DDR_SPI |= (1<<DD_MOSI) | (1<<DD_SCK) | (1<<DD_SS); // outputs
+	DDRB |= (1<<0); PORTB |= (1<<0); // set the hardware SS pin to low to enable SPI
+	// MISO pullup input is already done in hardware
+	PRR0 &= ~(1<<PRSPI);
+	// enable spi, master mode, mode 3, clock rate = fck/4 = 2MHz
+	SPCR = (1<<SPE) | (1<<MSTR) | (1<<CPOL) | (1<<CPHA);
+}
+
+#else
+
+void spi_init(void)
+{
+	DDR_SPI |= (1<<DD_SS);
+	PRR1 &= ~(1<<PRUSART1);
+	// the baud rate must be 0 while the mode is set up, XCK1 output
+	// selects master
+	UBRR1 = 0;
+	DDRD |= (1<<DD_XCK1);
+	// master spi, msb first, mode 3
+	UCSR1C = (1<<UMSEL11) | (1<<UMSEL10) | (1<<UCPHA1) | (1<<UCPOL1);
+	UCSR1B = (1<<RXEN1) | (1<<TXEN1);
+	// fck/(2*(UBRR1+1)) = 2MHz
+	UBRR1 = 1;
+}
+
+#endif
+
+void spi_burst_start(const uint8_t cmd, const uint16_t gap, uint8_t *buf,
+		const uint8_t len, const uint8_t gate)
+{
+	SS_LOW;
+#ifndef SPI_USART
+	SPDR = cmd;
+#else
+	// the receiver is off for the command, nothing to read back
+	UCSR1B = (1<<TXEN1);
+	UDR1 = cmd;
+#endif
+	// the command is clocked out without an interrupt, the first data
+	// byte is started by the compare match once the gap is over; the
+	// rest of the setup is done in the gap
+	burst_due = TCNT1 + SPI_BYTE_CYCLES + gap;
+	burst_buf = buf;
+	burst_len = len;
+	burst_gate = gate;
+	burst_busy = true;
+	OCR1B = burst_due - BURST_ISR_LEAD;
+	TIFR1 = (1<<OCF1B);
+	TIMSK1 |= (1<<OCIE1B);
+}
+
+bool spi_burst_busy(void)
+{
+	return burst_busy;
+}
+
+// clocks the data bytes once the gap is over, with the compare interrupt
+// disabled
+static void burst_read(void)
+{
+	while ((int16_t)(TCNT1 - burst_due) < 0);
+	// an interrupt per byte would take longer than the 32 cycle byte
+	// itself, so the data is clocked from here
+	uint8_t *p = burst_buf;
+	uint8_t n = burst_len;
+#ifndef SPI_USART
+	// the command is long done; reading SPSR with its SPIF set and then
+	// writing SPDR clears the flag
+	while (!(SPSR & (1<<SPIF)));
+	if (burst_gate) {
+		*p = spi_recv();
+		n = (*p++ & burst_gate) ? n - 1 : 0;
+	}
+	if (n) {
+		// the received byte stays in SPDR until the next one is done,
+		// so the next one starts before it is read
+		SPDR = 0x00;
+		while (--n) {
+			while (!(SPSR & (1<<SPIF)));
+			SPDR = 0x00;
+			*p++ = SPDR;
+		}
+		while (!(SPSR & (1<<SPIF)));
+		*p++ = SPDR;
+	}
+#else
+	UCSR1B = (1<<RXEN1) | (1<<TXEN1);
+	if (burst_gate) {
+		// the first byte on its own, it decides about the rest
+		*p = spi_xfer(0x00);
+		n = (*p++ & burst_gate) ? n - 1 : 0;
+	}
+	if (n) {
+		// the next byte goes into the transmit buffer while the current
+		// one shifts, so there is no gap between them
+		UDR1 = 0x00;
+		while (--n) {
+			while (!(UCSR1A & (1<<UDRE1)));
+			UDR1 = 0x00;
+			while (!(UCSR1A & (1<<RXC1)));
+			*p++ = UDR1;
+		}
+		while (!(UCSR1A & (1<<RXC1)));
+		*p++ = UDR1;
+	}
+#endif
+	SS_HIGH;
+	burst_busy = false;
+	spi_burst_done(p - burst_buf);
+}
+
+ISR(TIMER1_COMPB_vect)
+{
+	TIMSK1 &= ~(1<<OCIE1B);
+	burst_read();
+}
+
+void spi_burst_wait(const bool block)
+{
+	if (!(TIMSK1 & (1<<OCIE1B)) || (!block
+			&& (int16_t)(burst_due - TCNT1) > BURST_WAIT_MAX))
+		return;
+	TIMSK1 &= ~(1<<OCIE1B);
+	burst_read();
+}
@@ -0,0 +1,159 @@
+#ifndef _SPI_H_INCLUDED_
+#define _SPI_H_INCLUDED_
+
+#include <avr/io.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Two transports to the sensor, both in spi.c, picked at build time:
+ * - the SPI peripheral, default. SPDR is single buffered for sending, the
+ *   next byte can only be written once the previous one is done; the
+ *   received byte can still be read until the next one is done.
+ * - USART1 in master SPI mode with SPI_USART. Its transmit buffer takes
+ *   the next byte while the current one shifts, so bytes go out back to
+ *   back. Uses XCK1/TXD1/RXD1 (PD5/PD3/PD2) instead of SCK/MOSI/MISO, see
+ *   the Makefile. PD2/PD3 are the top contacts of the buttons on the M1K,
+ *   main.c then reads only the bottom ones.
+ */
+
+#define PORT_SPI PORTB
+#define DDR_SPI	DDRB
+
+#define DD_SS	6 // aka NCS
+#define DD_SCK	1
+#define DD_MOSI	2
+#define DD_MISO	3
+
+#define DD_XCK1	5 // on port d
+
+#define SS_LOW	(PORT_SPI &= ~(1<<DD_SS))
+#define SS_HIGH	(PORT_SPI |= (1<<DD_SS))
+
+// cpu cycles per byte at 2MHz
+#define SPI_BYTE_CYCLES 32
+
+/**
+ * Sets up the SPI master: mode 3, 2MHz, NCS high.
+ */
+void spi_init(void);
+
+#ifndef SPI_USART
+
+static inline void spi_send(const uint8_t b)
+{
+	SPDR = b;
+	while (!(SPSR & (1<<SPIF)));
+}
+
+static inline uint8_t spi_recv(void)
+{
+	spi_send(0x00);
+	return SPDR;
+}
+
+// no transmit buffer, each byte is waited for
+static inline void spi_queue(const uint8_t b)
+{
+	spi_send(b);
+}
+
+static inline void spi_flush(void)
+{
+}
+
+#else
+
+static inline uint8_t spi_xfer(const uint8_t b)
+{
+	UDR1 = b;
+	while (!(UCSR1A & (1<<RXC1)));
+	return UDR1;
+}
+
+static inline void spi_send(const uint8_t b)
+{
+	spi_xfer(b);
+}
+
+static inline uint8_t spi_recv(void)
+{
+	return spi_xfer(0x00);
+}
+
+static inline void spi_queue(const uint8_t b)
+{
+	while (!(UCSR1A & (1<<UDRE1)));
+	UDR1 = b;
+	// the byte is not out for another 32 cycles, so TXC1 can be cleared
+	// now without missing its end
+	UCSR1A = (1<<TXC1);
+}
+
+static inline void spi_flush(void)
+{
+	// set once the last queued byte is out
+	while (!(UCSR1A & (1<<TXC1)));
+	// disabling the receiver flushes the bytes it took in meanwhile
+	UCSR1B = (1<<TXEN1);
+	UCSR1B = (1<<RXEN1) | (1<<TXEN1);
+}
+
+#endif
+
+/*
+ * spi_send and spi_recv return once the byte is on the wire. spi_queue
+ * returns as soon as the transmitter has taken the byte, which can be
+ * while it still shifts; received bytes are dropped. spi_flush waits for
+ * the queued bytes to be out. Without a transmit buffer (spi.c) spi_queue
+ * is spi_send.
+ */
+
+/**
+ * Starts a burst transfer that runs from an interrupt: lowers NCS, sends
+ * cmd and returns. gap cycles after the end of cmd, the timer1 compare B
+ * interrupt clocks len bytes into buf, raises NCS and calls
+ * spi_burst_done(). The cpu is free for other work during the gap.
+ *
+ * With a gate, the burst ends after the first data byte unless that has
+ * one of the gate bits set.
+ *
+ * timer1 must be running at the cpu clock (see sched_init). spi_send and
+ * spi_recv must not be used while the burst is running.
+ *
+ * @param cmd first byte, sent right away
+ * @param gap cycles from the end of cmd to the start of the first data byte
+ * @param buf receives the data bytes
+ * @param len number of data bytes, at least 1
+ * @param gate bits of the first data byte that let the burst go on, 0 for
+ *        the whole burst in any case
+ */
+void spi_burst_start(uint8_t cmd, uint16_t gap, uint8_t *buf, uint8_t len,
+		uint8_t gate);
+
+/**
+ * Clocks the burst from here if the gap is over within about the cycles
+ * the timer1 compare B interrupt would take, else leaves it to the
+ * interrupt. For the end of the work done during the gap, in the same
+ * context as spi_burst_start; does nothing if no burst waits for its gap.
+ *
+ * @param block wait for the gap however long it still is
+ */
+void spi_burst_wait(bool block);
+
+/**
+ * @return true from spi_burst_start until the burst is complete
+ */
+bool spi_burst_busy(void);
+
+/**
+ * End of a burst, implemented by the user of spi_burst_start.
+ *
+ * Called from interrupt context (interrupts disabled) after the last byte,
+ * with NCS already high.
+ *
+ * @param len number of data bytes read, 1 if the gate stopped the burst
+ */
+void spi_burst_done(uint8_t len);
+
+#endif /* _SPI_H_INCLUDED_ */
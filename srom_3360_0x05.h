@@ -1,6 +1,6 @@
 #define SROM_LENGTH (4094)
 
-const uint8_t PROGMEM srom[SROM_LENGTH] =
+const uint8_t PROGMEM srom_0x05[SROM_LENGTH] =
 {
 0x01,
 0x05,
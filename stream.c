@@ -0,0 +1,99 @@
+#include "stream.h"
+
+#include <avr/io.h>
+
+// written before the bank is free
+#define NO_BANK 0xff
+// the last slot that may open the packet, as it writes the samples from
+// before at once; a bank free later loses the frame
+#define OPEN_SLOTS_MAX 3
+
+// the samples of this frame, and the next slot expected
+static struct stream_sample samples[SCHED_SLOTS];
+static uint8_t stored = 0;
+// samples of this frame written to the endpoint bank, NO_BANK until the
+// host has taken the packet of the frame before
+static uint8_t written = NO_BANK;
+static uint8_t lost = 0;
+
+static void write_sample(const struct stream_sample *s)
+{
+	UEDATX = s->dx & 0xff;
+	UEDATX = s->dx >> 8;
+	UEDATX = s->dy & 0xff;
+	UEDATX = s->dy >> 8;
+	UEDATX = s->squal;
+	UEDATX = s->flags;
+}
+
+static void clear_sample(struct stream_sample *s)
+{
+	s->dx = 0;
+	s->dy = 0;
+	s->squal = 0;
+	s->flags = 0;
+}
+
+// the packet of the frame goes out with the next poll, or is lost if the
+// bank was not free before its last slot
+static void frame_end(void)
+{
+	if (written == NO_BANK) {
+		if (lost < 0xff)
+			++lost;
+	} else {
+		for (; written < SCHED_SLOTS; written++) {
+			clear_sample(&samples[written]);
+			write_sample(&samples[written]);
+		}
+		UEINTX = 0x3a;
+	}
+	written = NO_BANK;
+	stored = 0;
+}
+
+// The bank is filled as the slots come, a sample per slot; the samples
+// from before it was free are written at once when it is.
+void stream_slot(const uint8_t slot, const int16_t dx, const int16_t dy,
+		const uint8_t squal, const uint8_t flags)
+{
+	UENUM = STREAM_ENDPOINT;
+	// the last slot of the frame before was lost to an overrun
+	if (slot < stored)
+		frame_end();
+	for (; stored < slot; stored++)
+		clear_sample(&samples[stored]);
+
+	if (written == NO_BANK && slot <= OPEN_SLOTS_MAX
+			&& (UEINTX & (1<<RWAL))) {
+		const uint16_t frame = UDFNUM;
+		UEDATX = frame & 0xff;
+		UEDATX = frame >> 8;
+		UEDATX = lost;
+		UEDATX = SCHED_SLOTS;
+		lost = 0;
+		written = 0;
+	}
+	if (written != NO_BANK) {
+		for (; written < stored; written++)
+			write_sample(&samples[written]);
+		// in step with the bank, the sample of the slot goes straight
+		// in, without the copy
+		UEDATX = dx & 0xff;
+		UEDATX = dx >> 8;
+		UEDATX = dy & 0xff;
+		UEDATX = dy >> 8;
+		UEDATX = squal;
+		UEDATX = flags;
+		++written;
+	} else {
+		struct stream_sample *s = &samples[stored];
+		s->dx = dx;
+		s->dy = dy;
+		s->squal = squal;
+		s->flags = flags;
+	}
+	++stored;
+	if (slot == SCHED_SLOTS - 1)
+		frame_end();
+}
@@ -0,0 +1,55 @@
+#ifndef _STREAM_H_INCLUDED_
+#define _STREAM_H_INCLUDED_
+
+#include <stdint.h>
+
+#include "sched.h"
+
+/*
+ * Sample stream: the sensor samples of all 8 slots of a frame, which the
+ * mouse report sums up, for research and tuning tools on the host.
+ *
+ * A vendor interface, STREAM_INTERFACE, with the interrupt IN endpoint
+ * STREAM_ENDPOINT: one struct stream_packet per frame, filled slot by slot
+ * and sent with the first poll of the next frame. The mouse report is not
+ * affected. Nobody polls the endpoint unless a tool claims the interface;
+ * the frames it misses until then are counted in lost. tools/stream prints
+ * the samples.
+ */
+
+#define STREAM_INTERFACE	3
+#define STREAM_ENDPOINT		4
+#define STREAM_SIZE		64
+
+// stream_sample.flags
+#define STREAM_BUTTONS		0x03	// debounced buttons, bit 0 left
+#define STREAM_SLOT		0x40	// the slot ran, else all fields are 0
+#define STREAM_BURST		0x80	// the sensor was read in it
+
+struct stream_sample {
+	int16_t dx;		// motion read in the slot, little endian
+	int16_t dy;
+	uint8_t squal;		// surface quality of the last burst
+	uint8_t flags;		// STREAM_*
+} __attribute__((packed));
+
+struct stream_packet {
+	uint16_t frame;		// UDFNUM of the samples, little endian
+	uint8_t lost;		// frames not sent before this one, up to 255
+	uint8_t samples;	// SCHED_SLOTS
+	struct stream_sample sample[SCHED_SLOTS];
+} __attribute__((packed));
+
+/**
+ * Adds the sample of a slot to the packet of the frame, from the slot.
+ *
+ * @param slot index of the slot in the frame
+ * @param dx x motion of the slot
+ * @param dy y motion of the slot
+ * @param squal surface quality
+ * @param flags STREAM_*
+ */
+void stream_slot(uint8_t slot, int16_t dx, int16_t dy, uint8_t squal,
+		uint8_t flags);
+
+#endif /* _STREAM_H_INCLUDED_ */
@@ -17,6 +17,9 @@ int main ( int argc, char *argv[], char *env[] )
     bool states[] = {0, 0, 0, 0};
     FILE *kbd = fopen(argv[1], "r");
 
+    // the config, as the firmware loads it at power-on
+    mouse_init();
+
     char key_map[KEY_MAX/8 + 1];    //  Create a byte array the size of the number of keys
 
     bool running = true;
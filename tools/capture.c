@@ -0,0 +1,207 @@
+/* Saves sensor frames of the mouse (see capture.h) as PGM images, with
+ * SQUAL and Shutter in their header comment.
+ *
+ * usage: capture [-n frames] [-o prefix] [-d bus/device]
+ *
+ * Takes 1 frame by default, -n 0 until ctrl-c. The frames go to
+ * prefix0000.pgm and so on, prefix is "frame" by default. Talks to the
+ * vendor interface through usbfs (Linux), so it needs write access to the
+ * device node in /dev/bus/usb; the mouse is found by its vendor and
+ * product id unless given with -d. The pixels are scaled from the 7 bit
+ * of the sensor to 8 bit.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/usbdevice_fs.h>
+
+#include "../capture.h"
+
+// of usb_mouse.c
+#define VENDOR_ID 0x04d8
+#define PRODUCT_ID 0xeefc
+
+#define FRAME_BYTES (sizeof(struct capture_header) + CAPTURE_PIXELS)
+// a frame plus room for the short packet that ends it
+#define TRANSFER_BYTES (FRAME_BYTES + CAPTURE_SIZE)
+#define TIMEOUT_MS 1000
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static unsigned read_sysfs(const char *dev, const char *attr, int base)
+{
+    char path[512], buf[32] = "";
+    snprintf(path, sizeof(path), "/sys/bus/usb/devices/%s/%s", dev, attr);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
+    if (!fgets(buf, sizeof(buf), f))
+        buf[0] = 0;
+    fclose(f);
+    return strtoul(buf, NULL, base);
+}
+
+/* bus and device number of the first mouse in sysfs */
+static bool find_mouse(unsigned *bus, unsigned *devnum)
+{
+    DIR *d = opendir("/sys/bus/usb/devices");
+    if (!d)
+        return false;
+    struct dirent *e;
+    bool found = false;
+    while (!found && (e = readdir(d))) {
+        if (e->d_name[0] == '.' || strchr(e->d_name, ':'))
+            continue;
+        if (read_sysfs(e->d_name, "idVendor", 16) != VENDOR_ID
+            || read_sysfs(e->d_name, "idProduct", 16) != PRODUCT_ID)
+            continue;
+        *bus = read_sysfs(e->d_name, "busnum", 10);
+        *devnum = read_sysfs(e->d_name, "devnum", 10);
+        found = true;
+    }
+    closedir(d);
+    return found;
+}
+
+static int request(int fd, uint8_t bRequest, uint16_t frames)
+{
+    struct usbdevfs_ctrltransfer ctrl = {
+        .bRequestType = 0x41,
+        .bRequest = bRequest,
+        .wValue = frames,
+        .wIndex = CAPTURE_INTERFACE,
+        .wLength = 0,
+        .timeout = TIMEOUT_MS,
+        .data = NULL,
+    };
+    return ioctl(fd, USBDEVFS_CONTROL, &ctrl);
+}
+
+static bool save(const char *prefix, unsigned n, const uint8_t *frame)
+{
+    struct capture_header h;
+    memcpy(&h, frame, sizeof(h));
+    char name[512];
+    snprintf(name, sizeof(name), "%s%04u.pgm", prefix, n);
+    FILE *f = fopen(name, "wb");
+    if (!f) {
+        perror(name);
+        return false;
+    }
+    fprintf(f, "P5\n# frame %u squal %u shutter %u\n%u %u\n255\n",
+            h.frame, h.squal, h.shutter, h.width, h.width);
+    const uint8_t *pixels = frame + sizeof(h);
+    for (unsigned i = 0; i < CAPTURE_PIXELS; ++i)
+        fputc(pixels[i] << 1, f);
+    fclose(f);
+    printf("%s: squal %u, shutter %u\n", name, h.squal, h.shutter);
+    return true;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-n frames] [-o prefix] [-d bus/device]\n",
+            argv0);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned frames = 1, bus = 0, devnum = 0;
+    const char *prefix = "frame";
+    int opt;
+    while ((opt = getopt(argc, argv, "n:o:d:")) != -1) {
+        switch (opt) {
+        case 'n':
+            frames = atoi(optarg);
+            break;
+        case 'o':
+            prefix = optarg;
+            break;
+        case 'd':
+            if (sscanf(optarg, "%u/%u", &bus, &devnum) != 2)
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc || frames > 0xffff)
+        usage(argv[0]);
+    if (!bus && !find_mouse(&bus, &devnum)) {
+        fprintf(stderr, "no mouse %04x:%04x found\n", VENDOR_ID, PRODUCT_ID);
+        return EXIT_FAILURE;
+    }
+
+    char node[64];
+    snprintf(node, sizeof(node), "/dev/bus/usb/%03u/%03u", bus, devnum);
+    const int fd = open(node, O_RDWR);
+    if (fd < 0) {
+        perror(node);
+        return EXIT_FAILURE;
+    }
+    unsigned intf = CAPTURE_INTERFACE;
+    if (ioctl(fd, USBDEVFS_CLAIMINTERFACE, &intf) < 0) {
+        perror("claim interface");
+        return EXIT_FAILURE;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    if (request(fd, CAPTURE_START, frames) < 0) {
+        perror("capture start");
+        return EXIT_FAILURE;
+    }
+
+    // each frame takes a sensor restart, a few hundred ms
+    static uint8_t buf[TRANSFER_BYTES];
+    unsigned saved = 0, cut_off = 0;
+    int status = EXIT_SUCCESS;
+    while (!stop && (!frames || saved < frames)) {
+        struct usbdevfs_bulktransfer bulk = {
+            .ep = CAPTURE_ENDPOINT | 0x80,
+            .len = sizeof(buf),
+            .timeout = TIMEOUT_MS,
+            .data = buf,
+        };
+        const int len = ioctl(fd, USBDEVFS_BULK, &bulk);
+        if (len < 0) {
+            if (errno == ETIMEDOUT || errno == EINTR)
+                continue;
+            perror("read frame");
+            status = EXIT_FAILURE;
+            break;
+        }
+        if (len != (int)FRAME_BYTES || buf[0] != CAPTURE_MAGIC) {
+            ++cut_off;
+            continue;
+        }
+        if (!save(prefix, saved, buf)) {
+            status = EXIT_FAILURE;
+            break;
+        }
+        ++saved;
+    }
+
+    // tracks again once the frame in progress is cut off
+    request(fd, CAPTURE_STOP, 0);
+    ioctl(fd, USBDEVFS_RELEASEINTERFACE, &intf);
+    close(fd);
+    if (cut_off)
+        fprintf(stderr, "%u incomplete frames dropped\n", cut_off);
+    return status;
+}
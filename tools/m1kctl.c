@@ -0,0 +1,174 @@
+/* Reads and sets the configuration of the mouse through its settings
+ * interface (see settings.h), no cursor animations involved.
+ *
+ * usage: m1kctl [-c cpi] [-a 0|1] [-l 2|3] [-s 3|5] [-p profile]
+ *               [-d /dev/hidrawN]
+ *
+ * Without options prints the configuration and the firmware info. The
+ * options change the given fields and keep the rest; all of them are set
+ * in one report and stored in the eeprom by the mouse. -s (SROM version)
+ * and -p (power profile: 0 full, 1 balanced, 2 saver) take effect at the
+ * next power-on. Talks to the hidraw node (Linux) of the interface, which
+ * is found by vendor and product id and its report descriptor unless given
+ * with -d; needs read and write access to it.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/hidraw.h>
+
+#include "../settings.h"
+
+// of usb_mouse.c
+#define VENDOR_ID 0x04d8
+#define PRODUCT_ID 0xeefc
+
+static const char *const profiles[] = {"full", "balanced", "saver"};
+
+/* the report descriptor of the settings interface starts with its usage
+ * page, the mouse interface has a hidraw node too */
+static bool is_settings(int fd)
+{
+    struct hidraw_devinfo info;
+    if (ioctl(fd, HIDIOCGRAWINFO, &info) < 0
+        || (uint16_t)info.vendor != VENDOR_ID
+        || (uint16_t)info.product != PRODUCT_ID)
+        return false;
+    struct hidraw_report_descriptor desc = {0};
+    if (ioctl(fd, HIDIOCGRDESCSIZE, &desc.size) < 0
+        || ioctl(fd, HIDIOCGRDESC, &desc) < 0)
+        return false;
+    return desc.size >= 3 && desc.value[0] == 0x06
+        && desc.value[1] == 0x00 && desc.value[2] == 0xff;
+}
+
+static int open_settings(void)
+{
+    DIR *d = opendir("/dev");
+    if (!d)
+        return -1;
+    struct dirent *e;
+    int fd = -1;
+    while (fd < 0 && (e = readdir(d))) {
+        if (strncmp(e->d_name, "hidraw", 6))
+            continue;
+        char node[300];
+        snprintf(node, sizeof(node), "/dev/%s", e->d_name);
+        fd = open(node, O_RDWR);
+        if (fd >= 0 && !is_settings(fd)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    closedir(d);
+    return fd;
+}
+
+static bool get(int fd, uint8_t id, void *report, size_t size)
+{
+    uint8_t buf[SETTINGS_REPORT_SIZE];
+    buf[0] = id;
+    const int len = ioctl(fd, HIDIOCGFEATURE(sizeof(buf)), buf);
+    if (len < (int)size) {
+        fprintf(stderr, "get report %u: %s\n", id,
+                len < 0 ? strerror(errno) : "short");
+        return false;
+    }
+    memcpy(report, buf, size);
+    return true;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-c cpi] [-a 0|1] [-l 2|3] [-s 3|5] "
+            "[-p profile] [-d /dev/hidrawN]\n", argv0);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    // fields to change, -1 keeps them
+    long cpi = -1, as = -1, lod = -1, srom = -1, power = -1;
+    const char *node = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:a:l:s:p:d:")) != -1) {
+        switch (opt) {
+        case 'c':
+            cpi = strtol(optarg, NULL, 10);
+            break;
+        case 'a':
+            as = strtol(optarg, NULL, 10);
+            break;
+        case 'l':
+            lod = strtol(optarg, NULL, 10);
+            break;
+        case 's':
+            srom = strtol(optarg, NULL, 10);
+            break;
+        case 'p':
+            power = strtol(optarg, NULL, 10);
+            break;
+        case 'd':
+            node = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usage(argv[0]);
+
+    const int fd = node ? open(node, O_RDWR) : open_settings();
+    if (fd < 0) {
+        if (node)
+            perror(node);
+        else
+            fprintf(stderr, "no mouse %04x:%04x found\n", VENDOR_ID,
+                    PRODUCT_ID);
+        return EXIT_FAILURE;
+    }
+
+    struct settings_config c;
+    struct settings_info info;
+    if (!get(fd, SETTINGS_REPORT_CONFIG, &c, sizeof(c))
+        || !get(fd, SETTINGS_REPORT_INFO, &info, sizeof(info)))
+        return EXIT_FAILURE;
+
+    if (cpi >= 0 || as >= 0 || lod >= 0 || srom >= 0 || power >= 0) {
+        // the mouse checks the ranges and refuses the whole report
+        if (cpi >= 0)
+            c.cpi = cpi;
+        if (as >= 0)
+            c.angle_snap = as;
+        if (lod >= 0)
+            c.lod = lod;
+        if (srom >= 0)
+            c.srom_version = srom;
+        if (power >= 0)
+            c.power_profile = power;
+        if (ioctl(fd, HIDIOCSFEATURE(sizeof(c)), &c) < 0) {
+            perror("set config (out of range?)");
+            return EXIT_FAILURE;
+        }
+        if (!get(fd, SETTINGS_REPORT_CONFIG, &c, sizeof(c)))
+            return EXIT_FAILURE;
+    }
+    close(fd);
+
+    printf("cpi %u, angle snapping %s, lift off distance %u mm\n", c.cpi,
+           c.angle_snap ? "on" : "off", c.lod);
+    printf("at power-on: srom 0x%02x, power profile %s\n", c.srom_version,
+           c.power_profile < 3 ? profiles[c.power_profile] : "?");
+    printf("firmware %x.%02x, running srom 0x%02x, power profile %s\n",
+           info.version >> 8, info.version & 0xff, info.srom_id,
+           info.power_profile < 3 ? profiles[info.power_profile] : "?");
+    return EXIT_SUCCESS;
+}
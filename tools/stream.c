@@ -0,0 +1,177 @@
+/* Prints the sample stream of the mouse (see stream.h), a line per slot:
+ * frame, slot, dx, dy, SQUAL and the buttons, "-" for a slot that did not
+ * run and "*" for one without a sensor read.
+ *
+ * usage: stream [-n frames] [-d bus/device]
+ *
+ * Runs until ctrl-c by default. Frames the mouse could not send are
+ * reported on stderr. Talks to the vendor interface through usbfs (Linux),
+ * so it needs write access to the device node in /dev/bus/usb; the mouse
+ * is found by its vendor and product id unless given with -d.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/usbdevice_fs.h>
+
+#include "../stream.h"
+
+// of usb_mouse.c
+#define VENDOR_ID 0x04d8
+#define PRODUCT_ID 0xeefc
+
+#define TIMEOUT_MS 1000
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static unsigned read_sysfs(const char *dev, const char *attr, int base)
+{
+    char path[512], buf[32] = "";
+    snprintf(path, sizeof(path), "/sys/bus/usb/devices/%s/%s", dev, attr);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 0;
+    if (!fgets(buf, sizeof(buf), f))
+        buf[0] = 0;
+    fclose(f);
+    return strtoul(buf, NULL, base);
+}
+
+/* bus and device number of the first mouse in sysfs */
+static bool find_mouse(unsigned *bus, unsigned *devnum)
+{
+    DIR *d = opendir("/sys/bus/usb/devices");
+    if (!d)
+        return false;
+    struct dirent *e;
+    bool found = false;
+    while (!found && (e = readdir(d))) {
+        if (e->d_name[0] == '.' || strchr(e->d_name, ':'))
+            continue;
+        if (read_sysfs(e->d_name, "idVendor", 16) != VENDOR_ID
+            || read_sysfs(e->d_name, "idProduct", 16) != PRODUCT_ID)
+            continue;
+        *bus = read_sysfs(e->d_name, "busnum", 10);
+        *devnum = read_sysfs(e->d_name, "devnum", 10);
+        found = true;
+    }
+    closedir(d);
+    return found;
+}
+
+static void print(const struct stream_packet *p)
+{
+    for (unsigned i = 0; i < SCHED_SLOTS; ++i) {
+        const struct stream_sample *s = &p->sample[i];
+        if (!(s->flags & STREAM_SLOT)) {
+            printf("%4u %u -\n", p->frame, i);
+            continue;
+        }
+        printf("%4u %u %6d %6d %3u %u%s\n", p->frame, i, s->dx, s->dy,
+               s->squal, s->flags & STREAM_BUTTONS,
+               s->flags & STREAM_BURST ? "" : " *");
+    }
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-n frames] [-d bus/device]\n", argv0);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned frames = 0, bus = 0, devnum = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:d:")) != -1) {
+        switch (opt) {
+        case 'n':
+            frames = atoi(optarg);
+            break;
+        case 'd':
+            if (sscanf(optarg, "%u/%u", &bus, &devnum) != 2)
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usage(argv[0]);
+    if (!bus && !find_mouse(&bus, &devnum)) {
+        fprintf(stderr, "no mouse %04x:%04x found\n", VENDOR_ID, PRODUCT_ID);
+        return EXIT_FAILURE;
+    }
+
+    char node[64];
+    snprintf(node, sizeof(node), "/dev/bus/usb/%03u/%03u", bus, devnum);
+    const int fd = open(node, O_RDWR);
+    if (fd < 0) {
+        perror(node);
+        return EXIT_FAILURE;
+    }
+    unsigned intf = STREAM_INTERFACE;
+    if (ioctl(fd, USBDEVFS_CLAIMINTERFACE, &intf) < 0) {
+        perror("claim interface");
+        return EXIT_FAILURE;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    // the first packet counts the frames from before the claim as lost
+    unsigned got = 0, lost = 0, bad = 0;
+    int status = EXIT_SUCCESS;
+    while (!stop && (!frames || got < frames)) {
+        static uint8_t buf[STREAM_SIZE];
+        struct usbdevfs_bulktransfer bulk = {
+            .ep = STREAM_ENDPOINT | 0x80,
+            .len = sizeof(buf),
+            .timeout = TIMEOUT_MS,
+            .data = buf,
+        };
+        const int len = ioctl(fd, USBDEVFS_BULK, &bulk);
+        if (len < 0) {
+            if (errno == ETIMEDOUT || errno == EINTR)
+                continue;
+            perror("read stream");
+            status = EXIT_FAILURE;
+            break;
+        }
+        struct stream_packet p;
+        if (len != (int)sizeof(p)) {
+            ++bad;
+            continue;
+        }
+        memcpy(&p, buf, sizeof(p));
+        if (p.samples != SCHED_SLOTS) {
+            ++bad;
+            continue;
+        }
+        if (got && p.lost) {
+            fprintf(stderr, "%u frames lost before %u\n", p.lost, p.frame);
+            lost += p.lost;
+        }
+        print(&p);
+        ++got;
+    }
+
+    ioctl(fd, USBDEVFS_RELEASEINTERFACE, &intf);
+    close(fd);
+    fprintf(stderr, "%u frames, %u lost, %u malformed\n", got, lost, bad);
+    return status;
+}
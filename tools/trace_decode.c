@@ -0,0 +1,178 @@
+/* Decodes dumps of the slot timing trace (see trace.h) into per-stage
+ * statistics and latency histograms.
+ *
+ * usage: trace_decode [-b bin_cycles] dump...
+ *
+ * A dump is a raw copy of the firmware's trace variable, e.g. from gdb over
+ * debugWIRE: dump binary value trace.bin trace
+ * Several dumps of the same run, in one file or several, are merged: the
+ * stats are taken from the last one, the histograms from the ring entries
+ * that are new in each dump.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TRACE_LAYOUT_ONLY
+#include "../trace.h"
+
+#define MAX_CYCLES 65536
+#define BAR_WIDTH 50
+
+static const char *stage_names[TRACE_STAGES] = {
+    "slot", "burst_cmd", "input", "burst_read", "report", "done"
+};
+
+static struct trace_stat stats[TRACE_STAGES];
+static uint32_t *hist[TRACE_STAGES];
+static uint64_t samples[TRACE_STAGES];
+static uint32_t prev_count = 0;
+static unsigned dumps = 0;
+
+static uint16_t get16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* reads one dump, returns false at the end of the file */
+static bool read_dump(FILE *f, const char *name)
+{
+    uint8_t head[4];
+    if (fread(head, 1, sizeof(head), f) != sizeof(head))
+        return false;
+    if (get16(head) != TRACE_MAGIC) {
+        fprintf(stderr, "%s: not a trace dump\n", name);
+        exit(EXIT_FAILURE);
+    }
+    const unsigned ring_size = head[2] ? head[2] : 256;
+    const unsigned dump_head = head[3];
+
+    uint8_t stat_raw[TRACE_STAGES * sizeof(struct trace_stat)];
+    uint8_t ring_raw[256 * sizeof(struct trace_entry)];
+    const size_t ring_bytes = ring_size * sizeof(struct trace_entry);
+    if (fread(stat_raw, 1, sizeof(stat_raw), f) != sizeof(stat_raw)
+            || fread(ring_raw, 1, ring_bytes, f) != ring_bytes) {
+        fprintf(stderr, "%s: truncated dump\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t count = 0;
+    for (int i = 0; i < TRACE_STAGES; ++i) {
+        const uint8_t *p = stat_raw + i * sizeof(struct trace_stat);
+        stats[i].min = get16(p);
+        stats[i].max = get16(p + 2);
+        stats[i].sum = get32(p + 4);
+        stats[i].count = get32(p + 8);
+        count += stats[i].count;
+    }
+
+    /* entries written since the previous dump, newest last */
+    uint32_t fresh = count - prev_count;
+    if (count < prev_count)
+        fresh = count; /* device was reset in between */
+    if (fresh > ring_size)
+        fresh = ring_size;
+    prev_count = count;
+
+    for (unsigned n = 0; n < fresh; ++n) {
+        const unsigned i = (dump_head + ring_size - fresh + n) % ring_size;
+        const uint8_t *e = ring_raw + i * sizeof(struct trace_entry);
+        if (e[0] >= TRACE_STAGES)
+            continue;
+        ++hist[e[0]][get16(e + 1)];
+        ++samples[e[0]];
+    }
+    ++dumps;
+    return true;
+}
+
+static void print_histogram(int stage, unsigned bin)
+{
+    uint32_t bins[MAX_CYCLES];
+    unsigned first = MAX_CYCLES, last = 0;
+    uint32_t peak = 0;
+
+    memset(bins, 0, sizeof(bins));
+    for (unsigned c = 0; c < MAX_CYCLES; ++c) {
+        if (!hist[stage][c])
+            continue;
+        bins[c / bin] += hist[stage][c];
+        if (c / bin < first)
+            first = c / bin;
+        last = c / bin;
+    }
+    if (first > last)
+        return;
+    for (unsigned b = first; b <= last; ++b)
+        if (bins[b] > peak)
+            peak = bins[b];
+
+    printf("\n%s, %llu samples\n", stage_names[stage],
+           (unsigned long long)samples[stage]);
+    for (unsigned b = first; b <= last; ++b) {
+        const int width = (int)((uint64_t)bins[b] * BAR_WIDTH / peak);
+        printf("%6u..%-6u %-*.*s %u\n", b * bin, b * bin + bin - 1,
+               BAR_WIDTH, width,
+               "##################################################", bins[b]);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned bin = 16;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:")) != -1) {
+        if (opt == 'b' && atoi(optarg) > 0) {
+            bin = atoi(optarg);
+        } else {
+            fprintf(stderr, "usage: %s [-b bin_cycles] dump...\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-b bin_cycles] dump...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < TRACE_STAGES; ++i)
+        hist[i] = calloc(MAX_CYCLES, sizeof(uint32_t));
+
+    for (int a = optind; a < argc; ++a) {
+        FILE *f = fopen(argv[a], "rb");
+        if (!f) {
+            perror(argv[a]);
+            return EXIT_FAILURE;
+        }
+        while (read_dump(f, argv[a]))
+            ;
+        fclose(f);
+    }
+    if (!dumps) {
+        fprintf(stderr, "no dumps\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%u dumps, cycles since slot start (slot: since previous slot)\n\n",
+           dumps);
+    printf("%-12s %10s %6s %8s %6s\n", "stage", "count", "min", "avg", "max");
+    for (int i = 0; i < TRACE_STAGES; ++i) {
+        if (!stats[i].count) {
+            printf("%-12s %10u\n", stage_names[i], 0);
+            continue;
+        }
+        printf("%-12s %10u %6u %8.1f %6u\n", stage_names[i], stats[i].count,
+               stats[i].min, (double)stats[i].sum / stats[i].count,
+               stats[i].max);
+    }
+    for (int i = 0; i < TRACE_STAGES; ++i)
+        print_histogram(i, bin);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,94 @@
+#include <avr/interrupt.h>
+#include "trace.h"
+
+#ifdef TRACE
+
+struct trace trace;
+uint16_t trace_stamp[TRACE_STAGES];
+uint8_t trace_reached = 0;
+volatile uint8_t trace_slots = 0;
+
+// stages of the last slot done, until trace_task takes its stamps, and
+// the cycles from the start of the slot before, 0 if either had no start
+static volatile uint8_t done_reached = 0;
+static volatile uint16_t done_period;
+
+// start of the last slot done, valid if it had one
+static uint16_t last_start;
+static uint8_t last_started = 0;
+
+void trace_init(void)
+{
+	trace.magic = TRACE_MAGIC;
+	trace.ring_size = TRACE_RING_SIZE;
+	trace.head = 0;
+	for (uint8_t i = 0; i < TRACE_STAGES; ++i) {
+		trace.stat[i].min = 0xffff;
+		trace.stat[i].max = 0;
+		trace.stat[i].sum = 0;
+		trace.stat[i].count = 0;
+	}
+	trace_reached = 0;
+	done_reached = 0;
+	last_started = 0;
+}
+
+static void record(const uint8_t stage, const uint16_t cycles)
+{
+	struct trace_stat *s = &trace.stat[stage];
+	if (cycles < s->min)
+		s->min = cycles;
+	if (cycles > s->max)
+		s->max = cycles;
+	s->sum += cycles;
+	++s->count;
+
+	struct trace_entry *e = &trace.ring[trace.head];
+	e->stage = stage;
+	e->cycles = cycles;
+	trace.head = (trace.head + 1) & (TRACE_RING_SIZE - 1);
+}
+
+void trace_slot_done(void)
+{
+	trace_mark(TRACE_DONE);
+	const uint8_t reached = trace_reached;
+	trace_reached = 0;
+	// the period here, trace_task may not get to every slot
+	const uint8_t started = reached & (1 << TRACE_SLOT);
+	const uint16_t start = trace_stamp[TRACE_SLOT];
+	done_period = started && last_started ? start - last_start : 0;
+	last_start = start;
+	last_started = started;
+	done_reached = reached;
+	++trace_slots;
+}
+
+void trace_task(void)
+{
+	uint16_t stamp[TRACE_STAGES];
+	cli();
+	const uint8_t reached = done_reached;
+	const uint16_t period = done_period;
+	done_reached = 0;
+	done_period = 0;
+	// the stamps are left in place for this; once the next slot started
+	// they are its own
+	const bool taken = !(trace_reached & (1 << TRACE_SLOT));
+	if (taken)
+		for (uint8_t i = 0; i < TRACE_STAGES; ++i)
+			stamp[i] = trace_stamp[i];
+	sei();
+	if (period)
+		record(TRACE_SLOT, period);
+	if (!taken || !(reached & (1 << TRACE_SLOT)))
+		return;
+
+	const uint16_t start = stamp[TRACE_SLOT];
+
+	for (uint8_t i = TRACE_SLOT + 1; i < TRACE_STAGES; ++i)
+		if (reached & (1 << i))
+			record(i, stamp[i] - start);
+}
+
+#endif /* TRACE */
@@ -0,0 +1,119 @@
+#ifndef _TRACE_H_INCLUDED_
+#define _TRACE_H_INCLUDED_
+
+#include <stdint.h>
+
+/*
+ * Cycle-stamped per-stage timing of the slot work, enabled with -DTRACE.
+ *
+ * Each stage of a slot is stamped with timer1, which runs free at the cpu
+ * clock (see sched.c). Once the slot is done, trace_task turns the stamps
+ * into cycles since the start of the slot from the main loop, so that the
+ * bookkeeping shows up neither in the measured stages nor in the slot. Per
+ * stage, min/max/sum/count are kept for the whole run and the last
+ * TRACE_RING_SIZE values go into a ring. The stages of a slot are left out
+ * if the next one starts before trace_task got to them, its period is not.
+ *
+ * In the sim the marks and trace_slot_done take no cycles, so that the
+ * slots are timed as built without TRACE (see sim/bench.cpp); on the AVR
+ * a mark takes ~8 cycles, trace_slot_done ~40.
+ *
+ * struct trace is the dump format: it is packed and little endian, so a raw
+ * copy of the trace variable (through debugWIRE or from the sim) can be fed
+ * to tools/trace_decode.
+ */
+
+enum trace_stage {
+	TRACE_SLOT,		// slot start, value is cycles since the previous slot start
+	TRACE_BURST_CMD,	// after starting the burst read
+	TRACE_INPUT,		// after BUTTONS_task/mouse_step
+	TRACE_BURST_READ,	// after the burst bytes
+	TRACE_REPORT,		// after the endpoint write
+	TRACE_DONE,		// end of the slot work, stamped by trace_slot_done
+	TRACE_STAGES
+};
+
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 64 // power of 2, at most 256
+#endif
+
+#define TRACE_MAGIC 0x5254 // "TR"
+
+struct trace_stat {
+	uint16_t min;
+	uint16_t max;
+	uint32_t sum;
+	uint32_t count;
+} __attribute__((packed));
+
+struct trace_entry {
+	uint8_t stage;
+	uint16_t cycles;
+} __attribute__((packed));
+
+struct trace {
+	uint16_t magic;
+	uint8_t ring_size;
+	uint8_t head; // next entry to be written
+	struct trace_stat stat[TRACE_STAGES];
+	struct trace_entry ring[TRACE_RING_SIZE];
+} __attribute__((packed));
+
+#if defined(TRACE) && !defined(TRACE_LAYOUT_ONLY)
+#include <avr/io.h>
+#ifdef SIM
+#include "sim.h"
+#endif
+
+extern struct trace trace;
+// timer1 stamps of the current slot, and which stages were reached
+extern uint16_t trace_stamp[TRACE_STAGES];
+extern uint8_t trace_reached;
+// slots done, wrapping; for a debugger or the sim to see the slot end
+extern volatile uint8_t trace_slots;
+
+/**
+ * Stamps a stage of the current slot. Cheap enough to leave in the hot path:
+ * a timer read and two stores.
+ *
+ * @param stage the stage that was just reached
+ */
+static inline void trace_mark(const enum trace_stage stage)
+{
+#ifdef SIM
+	trace_stamp[stage] = sim_timer1();
+#else
+	trace_stamp[stage] = TCNT1;
+#endif
+	trace_reached |= 1 << stage;
+}
+
+/**
+ * Sets up the trace buffer, call once before the first slot.
+ */
+void trace_init(void);
+
+/**
+ * Stamps the end of the slot and leaves its stamps to trace_task. Call at
+ * the end of every slot.
+ */
+void trace_slot_done(void);
+
+/**
+ * Turns the stamps of the last slot done into per-stage cycles and updates
+ * the stats and the ring. Call from the main loop.
+ */
+void trace_task(void);
+
+#define TRACE_MARK(stage) trace_mark(stage)
+#define TRACE_INIT() trace_init()
+#define TRACE_SLOT_DONE() trace_slot_done()
+#define TRACE_TASK() trace_task()
+#else
+#define TRACE_MARK(stage)
+#define TRACE_INIT()
+#define TRACE_SLOT_DONE()
+#define TRACE_TASK()
+#endif
+
+#endif /* _TRACE_H_INCLUDED_ */
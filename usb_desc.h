@@ -0,0 +1,150 @@
+#ifndef _USB_DESC_H_INCLUDED_
+#define _USB_DESC_H_INCLUDED_
+
+/*
+ * USB descriptors and HID report descriptors from macros, for the PROGMEM
+ * tables of usb_mouse.c. Each descriptor macro expands to its bytes, its
+ * _SIZE to their number, so that wTotalLength, the offsets of the HID
+ * descriptors and the report sizes follow from the specification instead
+ * of being counted by hand. USB_DESC_CHECK verifies them at compile time.
+ */
+
+// a 16 bit field, little endian
+#define USB_WORD(n)	((n) & 255), (((n) >> 8) & 255)
+
+#ifdef __cplusplus
+#define USB_DESC_CHECK(cond, msg) static_assert(cond, msg)
+#else
+#define USB_DESC_CHECK(cond, msg) _Static_assert(cond, msg)
+#endif
+
+/**************************************************************************
+ *  standard descriptors, USB spec 9.6
+ **************************************************************************/
+
+// device descriptor, 9.6.1; the strings are indices, 0 for none
+#define USB_DEVICE_DESC_SIZE	18
+#define USB_DEVICE_DESC(ep0_size, vendor, product, version,		\
+		manufacturer_str, product_str, serial_str)		\
+	USB_DEVICE_DESC_SIZE, 1, USB_WORD(0x0200), 0, 0, 0, (ep0_size),	\
+	USB_WORD(vendor), USB_WORD(product), USB_WORD(version),		\
+	(manufacturer_str), (product_str), (serial_str), 1
+
+// configuration descriptor, 9.6.3
+#define USB_CONFIG_DESC_SIZE	9
+#define USB_CONFIG_DESC(total, interfaces, attributes, max_power_ma)	\
+	USB_CONFIG_DESC_SIZE, 2, USB_WORD(total), (interfaces), 1, 0,	\
+	(attributes), (max_power_ma) / 2
+
+// interface descriptor, 9.6.5
+#define USB_INTERFACE_DESC_SIZE	9
+#define USB_INTERFACE_DESC(number, endpoints, class, subclass, protocol) \
+	USB_INTERFACE_DESC_SIZE, 4, (number), 0, (endpoints), (class),	\
+	(subclass), (protocol), 0
+
+// endpoint descriptor, 9.6.6
+#define USB_ENDPOINT_DESC_SIZE	7
+#define USB_ENDPOINT_INTERRUPT	0x03
+#define USB_ENDPOINT_BULK	0x02
+#define USB_ENDPOINT_DESC(address, type, size, interval)		\
+	USB_ENDPOINT_DESC_SIZE, 5, (address), (type), USB_WORD(size),	\
+	(interval)
+
+// HID descriptor, HID 1.11 spec, section 6.2.1
+#define USB_HID_DESC_SIZE	9
+#define USB_HID_DESC(report_desc_size)					\
+	USB_HID_DESC_SIZE, 0x21, USB_WORD(0x0111), 0, 1, 0x22,		\
+	USB_WORD(report_desc_size)
+
+/**************************************************************************
+ *  interfaces with their endpoint
+ **************************************************************************/
+
+#define USB_CLASS_HID		0x03
+#define USB_CLASS_VENDOR	0xFF
+
+// HID interface with one interrupt IN endpoint
+#define USB_HID_INTERFACE_SIZE						\
+	(USB_INTERFACE_DESC_SIZE + USB_HID_DESC_SIZE + USB_ENDPOINT_DESC_SIZE)
+// offset of its HID descriptor, for GET_DESCRIPTOR(HID)
+#define USB_HID_INTERFACE_HID_OFFSET USB_INTERFACE_DESC_SIZE
+#define USB_HID_INTERFACE(number, subclass, protocol, report_desc_size,	\
+		endpoint, size, interval)				\
+	USB_INTERFACE_DESC(number, 1, USB_CLASS_HID, subclass, protocol), \
+	USB_HID_DESC(report_desc_size),					\
+	USB_ENDPOINT_DESC((endpoint) | 0x80, USB_ENDPOINT_INTERRUPT,	\
+		size, interval)
+
+// vendor interface with one bulk IN endpoint
+#define USB_BULK_INTERFACE_SIZE						\
+	(USB_INTERFACE_DESC_SIZE + USB_ENDPOINT_DESC_SIZE)
+#define USB_BULK_INTERFACE(number, endpoint, size)			\
+	USB_INTERFACE_DESC(number, 1, USB_CLASS_VENDOR, 0, 0),		\
+	USB_ENDPOINT_DESC((endpoint) | 0x80, USB_ENDPOINT_BULK, size, 0)
+
+// vendor interface with one interrupt IN endpoint
+#define USB_INTERRUPT_INTERFACE_SIZE					\
+	(USB_INTERFACE_DESC_SIZE + USB_ENDPOINT_DESC_SIZE)
+#define USB_INTERRUPT_INTERFACE(number, endpoint, size, interval)	\
+	USB_INTERFACE_DESC(number, 1, USB_CLASS_VENDOR, 0, 0),		\
+	USB_ENDPOINT_DESC((endpoint) | 0x80, USB_ENDPOINT_INTERRUPT,	\
+		size, interval)
+
+/**************************************************************************
+ *  HID report descriptor items, HID 1.11 spec, section 6.2.2
+ **************************************************************************/
+
+// main items
+#define HID_INPUT(flags)		0x81, (flags)
+#define HID_FEATURE(flags)		0xB1, (flags)
+#define HID_COLLECTION(type)		0xA1, (type)
+#define HID_END_COLLECTION		0xC0
+// flags of the main items
+#define HID_DATA_VAR_ABS		0x02
+#define HID_CONSTANT			0x03
+#define HID_DATA_VAR_REL		0x06
+// collection types
+#define HID_APPLICATION			0x01
+
+// global items; the 16 bit forms take signed values in -32767..32767
+#define HID_USAGE_PAGE(page)		0x05, (page)
+#define HID_USAGE_PAGE_VENDOR		0x06, USB_WORD(0xFF00)
+#define HID_LOGICAL_MIN(n)		0x15, ((n) & 255)
+#define HID_LOGICAL_MAX(n)		0x25, ((n) & 255)
+#define HID_LOGICAL_MIN16(n)		0x16, USB_WORD(n)
+#define HID_LOGICAL_MAX16(n)		0x26, USB_WORD(n)
+#define HID_PHYSICAL_MIN(n)		0x35, ((n) & 255)
+#define HID_PHYSICAL_MAX(n)		0x45, ((n) & 255)
+#define HID_PHYSICAL_MIN16(n)		0x36, USB_WORD(n)
+#define HID_PHYSICAL_MAX16(n)		0x46, USB_WORD(n)
+#define HID_REPORT_SIZE(bits)		0x75, (bits)
+#define HID_REPORT_ID(id)		0x85, (id)
+#define HID_REPORT_COUNT(n)		0x95, (n)
+
+// local items
+#define HID_USAGE(usage)		0x09, (usage)
+#define HID_USAGE_MIN(usage)		0x19, (usage)
+#define HID_USAGE_MAX(usage)		0x29, (usage)
+
+// usage pages and usages
+#define HID_PAGE_GENERIC_DESKTOP	0x01
+#define HID_PAGE_BUTTON			0x09
+#define HID_USAGE_MOUSE			0x02
+#define HID_USAGE_X			0x30
+#define HID_USAGE_Y			0x31
+#define HID_USAGE_WHEEL			0x38
+
+/**
+ * A field of count values of bits each, with the given logical (and
+ * physical) range and main item flags; usages come before it.
+ */
+#define HID_FIELD(bits, count, min, max, flags)				\
+	HID_LOGICAL_MIN16(min), HID_LOGICAL_MAX16(max),			\
+	HID_PHYSICAL_MIN16(min), HID_PHYSICAL_MAX16(max),		\
+	HID_REPORT_SIZE(bits), HID_REPORT_COUNT(count), HID_INPUT(flags)
+
+// padding to the next byte after bits of data
+#define HID_PADDING(bits)						\
+	HID_REPORT_COUNT(1), HID_REPORT_SIZE(bits), HID_INPUT(HID_CONSTANT)
+
+#endif /* _USB_DESC_H_INCLUDED_ */
@@ -29,6 +29,19 @@
 
 #define USB_SERIAL_PRIVATE_INCLUDE
 #include "usb_mouse.h"
+#include "sched.h"
+#include "capture.h"
+#include "settings.h"
+#include "stream.h"
+#include "usb_desc.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// older avr-libc lacks it, flash pointers are 16 bit there
+#ifndef pgm_read_ptr
+#define pgm_read_ptr(addr) ((const void *)pgm_read_word(addr))
+#endif
 
 /**************************************************************************
  *
@@ -64,18 +77,44 @@
  *
  **************************************************************************/
 
-#define ENDPOINT0_SIZE		32
-
-#define MOUSE_INTERFACE		0
-//#define MOUSE_ENDPOINT	3 // moved to usb_mouse.h for use in main
-#define MOUSE_SIZE		8
-#define MOUSE_BUFFER		EP_SINGLE_BUFFER
+// the DPRAM of the 32u2 takes 176 bytes of endpoint banks, see the check
+// below; the longer mouse report of MOUSE_TIMESTAMP leaves 8 for endpoint 0
+#if MOUSE_REPORT_SIZE > 8
+#define ENDPOINT0_SIZE		8
+#else
+#define ENDPOINT0_SIZE		16
+#endif
+
+//#define MOUSE_INTERFACE	0 // moved to usb_mouse.h, with the endpoint
+//#define MOUSE_ENDPOINT	3
+#define MOUSE_SIZE		(MOUSE_REPORT_SIZE > 8 ? 16 : 8)
+#define MOUSE_BUFFER		EP_DOUBLE_BUFFER
+
+//#define CAPTURE_INTERFACE	1 // in capture.h, shared with tools/capture
+//#define CAPTURE_ENDPOINT	1
+//#define CAPTURE_SIZE		64
+#define CAPTURE_BUFFER		EP_SINGLE_BUFFER
+
+//#define SETTINGS_INTERFACE	2 // in settings.h, shared with tools/m1kctl
+//#define SETTINGS_ENDPOINT	2
+//#define SETTINGS_SIZE		8
+#define SETTINGS_BUFFER		EP_SINGLE_BUFFER
+
+//#define STREAM_INTERFACE	3 // in stream.h, shared with tools/stream
+//#define STREAM_ENDPOINT	4
+//#define STREAM_SIZE		64
+#define STREAM_BUFFER		EP_SINGLE_BUFFER
+
+USB_DESC_CHECK(ENDPOINT0_SIZE + CAPTURE_SIZE + SETTINGS_SIZE
+	+ 2 * MOUSE_SIZE + STREAM_SIZE <= 176, "endpoints fit the DPRAM");
+USB_DESC_CHECK(sizeof(struct stream_packet) <= STREAM_SIZE,
+	"stream packet fits the endpoint");
 
 static const uint8_t PROGMEM endpoint_config_table[] = {
-	0,
-	0,
+	1, EP_TYPE_BULK_IN,       EP_SIZE(CAPTURE_SIZE) | CAPTURE_BUFFER,
+	1, EP_TYPE_INTERRUPT_IN,  EP_SIZE(SETTINGS_SIZE) | SETTINGS_BUFFER,
 	1, EP_TYPE_INTERRUPT_IN,  EP_SIZE(MOUSE_SIZE) | MOUSE_BUFFER,
-	0
+	1, EP_TYPE_INTERRUPT_IN,  EP_SIZE(STREAM_SIZE) | STREAM_BUFFER
 };
 
 
@@ -93,21 +132,11 @@ static const uint8_t PROGMEM endpoint_config_table[] = {
 
 
 static const uint8_t PROGMEM device_descriptor[] = {
-	18,					// bLength
-	1,					// bDescriptorType
-	0x00, 0x02,				// bcdUSB
-	0,					// bDeviceClass
-	0,					// bDeviceSubClass
-	0,					// bDeviceProtocol
-	ENDPOINT0_SIZE,				// bMaxPacketSize0
-	LSB(VENDOR_ID), MSB(VENDOR_ID),		// idVendor
-	LSB(PRODUCT_ID), MSB(PRODUCT_ID),	// idProduct
-	0x00, 0x01,				// bcdDevice
-	1,					// iManufacturer
-	2,					// iProduct
-	0,					// iSerialNumber
-	1					// bNumConfigurations
+	USB_DEVICE_DESC(ENDPOINT0_SIZE, VENDOR_ID, PRODUCT_ID, DEVICE_VERSION,
+		1, 2, 0)
 };
+USB_DESC_CHECK(sizeof(device_descriptor) == USB_DEVICE_DESC_SIZE,
+	"device descriptor");
 
 // Mouse Protocol 1, HID 1.11 spec, Appendix B, page 59-60, with wheel extension
 /*
@@ -141,81 +170,100 @@ static uint8_t PROGMEM mouse_hid_report_desc[] = {
 };
 */
 static const uint8_t PROGMEM mouse_hid_report_desc[] = {
-	0x05, 0x01,		// Usage Page (Generic Desktop)
-	0x09, 0x02,		// Usage (Mouse)
-	0xA1, 0x01,		// Collection (Application)
-	0x05, 0x09,		//   Usage Page (Button)
-	0x19, 0x01,		//   Usage Minimum (Button #1)
-	0x29, 0x03,		//   Usage Maximum (Button #3)
-	0x15, 0x00,		//   Logical Minimum (0)
-	0x25, 0x01,		//   Logical Maximum (1)
-	0x95, 0x03,		//   Report Count (3)
-	0x75, 0x01,		//   Report Size (1)
-	0x81, 0x02,		//   Input (Data, Variable, Absolute)
-	0x95, 0x01,		//   Report Count (1)
-	0x75, 0x05,		//   Report Size (5)
-	0x81, 0x03,		//   Input (Constant) // Byte 1
-	0x05, 0x01,		//   Usage Page (Generic Desktop)
-	0x09, 0x30,		//   Usage (X)
-	0x09, 0x31,		//   Usage (Y)
-	0x16, 0x01, 0x80,	//   Logical Minimum (-32,767)
-	0x26, 0xFF, 0x7F,	//   Logical Maximum (32,767)
-	0x36, 0x01, 0x80,	//   Physical Minimum (-32,767)
-	0x46, 0xFF, 0x7F,	//   Physical Maxiumum (32,767)
-	0x75, 0x10,		//   Report Size (16),
-	0x95, 0x02,		//   Report Count (2),
-	0x81, 0x06,		//   Input (Data, Variable, Relative) // Byte 3, 5
-	0x09, 0x38,		//   Usage (Wheel)
-	0x15, 0x81,		//   Logical Minimum (-127)
-	0x25, 0x7F,		//   Logical Maximum (127)
-	0x35, 0x81,		//   Phyiscal Minimum (-127)
-	0x45, 0x7F,		//   Physical Maxiumum (127)
-	0x75, 0x08,		//   Report Size (8)
-	0x95, 0x01,		//   Report Count (1)
-	0x81, 0x06,		//   Input (Data, Variable, Relative) // Byte 6
-	0xC0			// End Collection
+	HID_USAGE_PAGE(HID_PAGE_GENERIC_DESKTOP),
+	HID_USAGE(HID_USAGE_MOUSE),
+	HID_COLLECTION(HID_APPLICATION),
+	HID_USAGE_PAGE(HID_PAGE_BUTTON),
+	HID_USAGE_MIN(1),		// Button #1
+	HID_USAGE_MAX(3),		// Button #3
+	HID_LOGICAL_MIN(0),
+	HID_LOGICAL_MAX(1),
+	HID_REPORT_COUNT(3),
+	HID_REPORT_SIZE(1),
+	HID_INPUT(HID_DATA_VAR_ABS),
+	HID_PADDING(5),			// Byte 1
+	HID_USAGE_PAGE(HID_PAGE_GENERIC_DESKTOP),
+	HID_USAGE(HID_USAGE_X),
+	HID_USAGE(HID_USAGE_Y),
+	HID_FIELD(MOUSE_XY_BITS, 2, -MOUSE_XY_MAX, MOUSE_XY_MAX,
+		HID_DATA_VAR_REL),
+#if MOUSE_WHEEL
+	HID_USAGE(HID_USAGE_WHEEL),
+	HID_LOGICAL_MIN(-127),
+	HID_LOGICAL_MAX(127),
+	HID_PHYSICAL_MIN(-127),
+	HID_PHYSICAL_MAX(127),
+	HID_REPORT_SIZE(8),
+	HID_REPORT_COUNT(1),
+	HID_INPUT(HID_DATA_VAR_REL),	// Byte 6
+#endif
+#ifdef MOUSE_TIMESTAMP
+	HID_USAGE_PAGE_VENDOR,
+	HID_USAGE(0x01),		// frame number
+	HID_FIELD(16, 1, 0, 2047, HID_DATA_VAR_ABS),
+	HID_USAGE(0x02),		// slot weights
+	HID_FIELD(2, 8, 0, 3, HID_DATA_VAR_ABS),
+#endif
+	HID_END_COLLECTION
 };
-
-#define CONFIG1_DESC_SIZE        (9+9+9+7)
-#define MOUSE_HID_DESC_OFFSET    (9+9)
-static const uint8_t PROGMEM config1_descriptor[CONFIG1_DESC_SIZE] = {
-	// configuration descriptor, USB spec 9.6.3, page 264-266, Table 9-10
-	9, 					// bLength;
-	2,					// bDescriptorType;
-	LSB(CONFIG1_DESC_SIZE),			// wTotalLength
-	MSB(CONFIG1_DESC_SIZE),
-	1,					// bNumInterfaces
-	1,					// bConfigurationValue
-	0,					// iConfiguration
-	0xC0,					// bmAttributes
-	50,					// bMaxPower
-	// interface descriptor, USB spec 9.6.5, page 267-269, Table 9-12
-	9,					// bLength
-	4,					// bDescriptorType
-	MOUSE_INTERFACE,			// bInterfaceNumber
-	0,					// bAlternateSetting
-	1,					// bNumEndpoints
-	0x03,					// bInterfaceClass (0x03 = HID)
-	0x01,					// bInterfaceSubClass (0x01 = Boot)
-	0x02,					// bInterfaceProtocol (0x02 = Mouse)
-	0,					// iInterface
-	// HID interface descriptor, HID 1.11 spec, section 6.2.1
-	9,					// bLength
-	0x21,					// bDescriptorType
-	0x11, 0x01,				// bcdHID
-	0,					// bCountryCode
-	1,					// bNumDescriptors
-	0x22,					// bDescriptorType
-	sizeof(mouse_hid_report_desc),		// wDescriptorLength
-	0,
-	// endpoint descriptor, USB spec 9.6.6, page 269-271, Table 9-13
-	7,					// bLength
-	5,					// bDescriptorType
-	MOUSE_ENDPOINT | 0x80,			// bEndpointAddress
-	0x03,					// bmAttributes (0x03=intr)
-	6, 0,					// wMaxPacketSize
-	1					// bInterval
+USB_DESC_CHECK((8 + 2 * MOUSE_XY_BITS + 8 * MOUSE_WHEEL
+	+ 8 * MOUSE_TIMESTAMP_SIZE) == 8 * MOUSE_REPORT_SIZE,
+	"mouse report size");
+USB_DESC_CHECK(MOUSE_REPORT_SIZE <= MOUSE_SIZE, "mouse report fits a bank");
+
+// feature reports of settings.h
+static const uint8_t PROGMEM settings_hid_report_desc[] = {
+	HID_USAGE_PAGE_VENDOR,
+	HID_USAGE(0x01),
+	HID_COLLECTION(HID_APPLICATION),
+	HID_LOGICAL_MIN(0),
+	HID_LOGICAL_MAX16(255),
+	HID_REPORT_SIZE(8),
+	HID_REPORT_ID(SETTINGS_REPORT_CONFIG),
+	HID_USAGE(0x02),
+	HID_REPORT_COUNT(sizeof(struct settings_config) - 1),
+	HID_FEATURE(HID_DATA_VAR_ABS),
+	HID_REPORT_ID(SETTINGS_REPORT_INFO),
+	HID_USAGE(0x03),
+	HID_REPORT_COUNT(sizeof(struct settings_info) - 1),
+	HID_FEATURE(HID_CONSTANT),
+	HID_END_COLLECTION
 };
+USB_DESC_CHECK(SETTINGS_REPORT_SIZE <= ENDPOINT0_SIZE,
+	"settings reports fit one control packet");
+
+// the interfaces in the order of their numbers
+#define MOUSE_DESC_OFFSET	USB_CONFIG_DESC_SIZE
+#define CAPTURE_DESC_OFFSET	(MOUSE_DESC_OFFSET + USB_HID_INTERFACE_SIZE)
+#define SETTINGS_DESC_OFFSET	(CAPTURE_DESC_OFFSET + USB_BULK_INTERFACE_SIZE)
+#define STREAM_DESC_OFFSET	(SETTINGS_DESC_OFFSET + USB_HID_INTERFACE_SIZE)
+#define CONFIG1_DESC_SIZE	(STREAM_DESC_OFFSET + USB_INTERRUPT_INTERFACE_SIZE)
+#define CONFIG1_INTERFACES	4
+#define MOUSE_HID_DESC_OFFSET	(MOUSE_DESC_OFFSET + USB_HID_INTERFACE_HID_OFFSET)
+#define SETTINGS_HID_DESC_OFFSET (SETTINGS_DESC_OFFSET + USB_HID_INTERFACE_HID_OFFSET)
+USB_DESC_CHECK(MOUSE_INTERFACE == 0 && CAPTURE_INTERFACE == 1
+	&& SETTINGS_INTERFACE == 2 && STREAM_INTERFACE == 3, "interface order");
+
+static const uint8_t PROGMEM config1_descriptor[] = {
+	USB_CONFIG_DESC(CONFIG1_DESC_SIZE, CONFIG1_INTERFACES,
+		0xE0,				// bmAttributes, remote wakeup
+		100),				// mA
+	USB_HID_INTERFACE(MOUSE_INTERFACE,
+		0x01,				// bInterfaceSubClass (Boot)
+		0x02,				// bInterfaceProtocol (Mouse)
+		sizeof(mouse_hid_report_desc),
+		MOUSE_ENDPOINT, MOUSE_REPORT_SIZE,
+		1),				// bInterval
+	USB_BULK_INTERFACE(CAPTURE_INTERFACE, CAPTURE_ENDPOINT, CAPTURE_SIZE),
+	USB_HID_INTERFACE(SETTINGS_INTERFACE, 0, 0,
+		sizeof(settings_hid_report_desc),
+		SETTINGS_ENDPOINT, SETTINGS_SIZE,
+		255),				// bInterval, never sends
+	USB_INTERRUPT_INTERFACE(STREAM_INTERFACE, STREAM_ENDPOINT, STREAM_SIZE,
+		1)				// bInterval
+};
+USB_DESC_CHECK(sizeof(config1_descriptor) == CONFIG1_DESC_SIZE,
+	"configuration descriptor");
 
 // If you're desperate for a little extra code memory, these strings
 // can be completely removed if iManufacturer, iProduct, iSerialNumber
@@ -223,7 +271,7 @@ static const uint8_t PROGMEM config1_descriptor[CONFIG1_DESC_SIZE] = {
 struct usb_string_descriptor_struct {
 	uint8_t bLength;
 	uint8_t bDescriptorType;
-	int16_t wString[];
+	wchar_t wString[];
 };
 static const struct usb_string_descriptor_struct PROGMEM string0 = {
 	4,
@@ -252,7 +300,9 @@ static const struct descriptor_list_struct {
 	{0x0100, 0x0000, device_descriptor, sizeof(device_descriptor)},
 	{0x0200, 0x0000, config1_descriptor, sizeof(config1_descriptor)},
 	{0x2200, MOUSE_INTERFACE, mouse_hid_report_desc, sizeof(mouse_hid_report_desc)},
-	{0x2100, MOUSE_INTERFACE, config1_descriptor+MOUSE_HID_DESC_OFFSET, 9},
+	{0x2100, MOUSE_INTERFACE, config1_descriptor+MOUSE_HID_DESC_OFFSET, USB_HID_DESC_SIZE},
+	{0x2200, SETTINGS_INTERFACE, settings_hid_report_desc, sizeof(settings_hid_report_desc)},
+	{0x2100, SETTINGS_INTERFACE, config1_descriptor+SETTINGS_HID_DESC_OFFSET, USB_HID_DESC_SIZE},
 	{0x0300, 0x0000, (const uint8_t *)&string0, 4},
 	{0x0301, 0x0409, (const uint8_t *)&string1, sizeof(STR_MANUFACTURER)},
 	{0x0302, 0x0409, (const uint8_t *)&string2, sizeof(STR_PRODUCT)}
@@ -274,6 +324,37 @@ static volatile uint8_t usb_configuration=0;
 // are required to be able to report which setting is in use.
 static uint8_t mouse_protocol=1;
 
+// idle rate of the mouse interface from SET_IDLE in 4 ms, 0 for infinite
+static uint8_t mouse_idle=0;
+
+// the bus is suspended, from SUSPI to WAKEUPI
+static volatile bool suspended=false;
+
+// SET_FEATURE(DEVICE_REMOTE_WAKEUP) from the host, until CLEAR_FEATURE or
+// a bus reset
+static bool remote_wakeup_enabled=false;
+
+// endpoint 0: the stage of the control transfer in progress
+#define EP0_IDLE		0	// waiting for a SETUP
+#define EP0_DATA_IN		1	// sending ep0_data, a packet per TXINI
+#define EP0_DATA_OUT		2	// waiting for the data of SET_REPORT
+#define EP0_ADDRESS		3	// waiting for the status of SET_ADDRESS
+static uint8_t ep0_state=EP0_IDLE;
+
+// EP0_DATA_IN: what is left to send, from flash or ep0_buf, and whether
+// a zero length packet ends it
+static const uint8_t *ep0_data;
+static uint8_t ep0_left;
+static bool ep0_flash, ep0_zlp;
+
+// EP0_DATA_OUT: report id and length of SET_REPORT; EP0_ADDRESS: the
+// address
+static uint8_t ep0_value, ep0_length;
+
+// replies that are not in flash, and the data of SET_REPORT
+static uint8_t ep0_buf[SETTINGS_REPORT_SIZE > MOUSE_REPORT_SIZE
+	? SETTINGS_REPORT_SIZE : MOUSE_REPORT_SIZE];
+
 
 /**************************************************************************
  *
@@ -303,6 +384,33 @@ uint8_t usb_configured(void)
 	return usb_configuration;
 }
 
+uint16_t usb_mouse_idle_frames(void)
+{
+	return mouse_idle * 4;
+}
+
+bool usb_suspended(void)
+{
+	return suspended;
+}
+
+// the USB clock, stopped for a suspend
+static void usb_clock_start(void)
+{
+	PLL_CONFIG();
+	while (!(PLLCSR & (1<<PLOCK))) ;
+	USB_CONFIG();
+}
+
+bool usb_remote_wakeup(void)
+{
+	if (!suspended || !remote_wakeup_enabled)
+		return false;
+	usb_clock_start();
+	UDCON |= (1<<RMWKUP);
+	return true;
+}
+
 
 /*
 void usb_mouse_update(const uint8_t button_mask, // 0th (least significant) bit = left, 1th bit = right, 2nd bit = middle
@@ -350,7 +458,8 @@ void usb_mouse_update(const uint8_t button_mask, // 0th (least significant) bit
 
 
 // USB Device Interrupt - handle all device-level events
-// the transmit buffer flushing is triggered by the start of frame
+// the start of frame starts slot 0 of the sensor/report schedule, a
+// suspend stops the USB clock until the bus wakes up
 //
 ISR(USB_GEN_vect)
 {
@@ -358,31 +467,46 @@ ISR(USB_GEN_vect)
 
         intbits = UDINT;
         UDINT = 0;
+	if ((intbits & (1<<WAKEUPI)) && suspended) {
+		// resume or reset by the host; the flag only clears with the
+		// clock running
+		usb_clock_start();
+		UDINT = ~(1<<WAKEUPI);
+		UDIEN = (UDIEN & ~(1<<WAKEUPE)) | (1<<SUSPE);
+		suspended = false;
+	}
         if (intbits & (1<<EORSTI)) {
 		UENUM = 0;
 		UECONX = 1;
 		UECFG0X = EP_TYPE_CONTROL;
 		UECFG1X = EP_SIZE(ENDPOINT0_SIZE) | EP_SINGLE_BUFFER;
 		UEIENX = (1<<RXSTPE);
+		ep0_state = EP0_IDLE;
 		usb_configuration = 0;
+		mouse_idle = 0;
+		remote_wakeup_enabled = false;
+		UDIEN |= (1<<SUSPE);
         }
+	if ((intbits & (1<<SUSPI)) && !suspended) {
+		// the bus is idle: the USB clock and the PLL stop until it is
+		// not, which sets WAKEUPI
+		UDIEN = (UDIEN & ~(1<<SUSPE)) | (1<<WAKEUPE);
+		USB_FREEZE();
+		PLLCSR = 0;
+		suspended = true;
+	}
+	if (intbits & (1<<SOFI)) {
+		sched_sof();
+	}
 }
 
 
 
-// Misc functions to wait for ready and send/receive packets
-static inline void usb_wait_in_ready(void)
-{
-	while (!(UEINTX & (1<<TXINI))) ;
-}
+// Misc functions to send/receive packets
 static inline void usb_send_in(void)
 {
 	UEINTX = ~(1<<TXINI);
 }
-static inline void usb_wait_receive_out(void)
-{
-	while (!(UEINTX & (1<<RXOUTI))) ;
-}
 static inline void usb_ack_out(void)
 {
 	UEINTX = ~(1<<RXOUTI);
@@ -390,172 +514,312 @@ static inline void usb_ack_out(void)
 
 
 
-// USB Endpoint Interrupt - endpoint 0 is handled here.  The
-// other endpoints are manipulated by the user-callable
-// functions, and the start-of-frame interrupt.
-//
-ISR(USB_COM_vect)
+// Endpoint 0 state machine: every step of a control transfer is taken
+// from its own interrupt, the next one is enabled instead of waited for.
+// A host that spreads the transactions of a transfer over frames can
+// then not hold off the sensor slots.
+
+// back to waiting for the next SETUP
+static void ep0_idle(void)
 {
-        uint8_t intbits;
-	const uint8_t *list;
+	ep0_state = EP0_IDLE;
+	UEIENX = (1<<RXSTPE);
+}
+
+static void ep0_stall(void)
+{
+	UECONX = (1<<STALLRQ) | (1<<EPEN);
+	ep0_idle();
+}
+
+// starts the data stage of an IN request, the TXINI interrupt sends the
+// packets; a short reply ends it, or a zero length packet if the data is a
+// multiple of the packet size and less than the host asked for
+static void ep0_send(const uint8_t *data, uint8_t len, const bool flash,
+		const uint16_t wLength)
+{
+	if (len > wLength) len = wLength;
+	ep0_data = data;
+	ep0_left = len;
+	ep0_flash = flash;
+	ep0_zlp = len < wLength && len % ENDPOINT0_SIZE == 0;
+	ep0_state = EP0_DATA_IN;
+	// an OUT here is the status stage of a host that wants no more
+	UEIENX = (1<<RXSTPE) | (1<<RXOUTE) | (1<<TXINE);
+}
+
+// one packet of the data stage, the bank is free
+static void ep0_send_packet(void)
+{
+	uint8_t n = ep0_left < ENDPOINT0_SIZE ? ep0_left : ENDPOINT0_SIZE;
+	const uint8_t sent = n;
+	ep0_left -= n;
+	if (ep0_flash) {
+		for (; n; n--) UEDATX = pgm_read_byte(ep0_data++);
+	} else {
+		for (; n; n--) UEDATX = *ep0_data++;
+	}
+	usb_send_in();
+	if (!ep0_left && (sent < ENDPOINT0_SIZE || !ep0_zlp)) {
+		// the status OUT is left to the next SETUP
+		ep0_idle();
+	}
+}
+
+// the data of SET_REPORT, a single packet
+static void ep0_receive(void)
+{
+	// the data stage is this one packet: shorter, it ended early, longer,
+	// it is not what the setup announced
+	const bool whole = UEBCLX == ep0_length;
+	uint8_t i;
+	if (whole) {
+		for (i = 0; i < ep0_length; i++) {
+			ep0_buf[i] = UEDATX;
+		}
+	}
+	usb_ack_out();
+	if (whole && settings_set_report(ep0_value, ep0_buf, ep0_length)) {
+		usb_send_in();
+		ep0_idle();
+		return;
+	}
+	// the status stage stalls
+	ep0_stall();
+}
+
+static void ep0_setup(void)
+{
+	const struct descriptor_list_struct *list;
         const uint8_t *cfg;
-	uint8_t i, n, len, en;
+	uint8_t i, len, en;
 	uint8_t bmRequestType;
 	uint8_t bRequest;
 	uint16_t wValue;
 	uint16_t wIndex;
 	uint16_t wLength;
 	uint16_t desc_val;
-	const uint8_t *desc_addr;
-	uint8_t	desc_length;
 
-        UENUM = 0;
-	intbits = UEINTX;
-        if (intbits & (1<<RXSTPI)) {
-                bmRequestType = UEDATX;
-                bRequest = UEDATX;
-                wValue = UEDATX;
-                wValue |= (UEDATX << 8);
-                wIndex = UEDATX;
-                wIndex |= (UEDATX << 8);
-                wLength = UEDATX;
-                wLength |= (UEDATX << 8);
-                UEINTX = ~((1<<RXSTPI) | (1<<RXOUTI) | (1<<TXINI));
-                if (bRequest == GET_DESCRIPTOR) {
-			list = (const uint8_t *)descriptor_list;
-			for (i=0; ; i++) {
-				if (i >= NUM_DESC_LIST) {
-					UECONX = (1<<STALLRQ)|(1<<EPEN);  //stall
-					return;
-				}
-				desc_val = pgm_read_word(list);
-				if (desc_val != wValue) {
-					list += sizeof(struct descriptor_list_struct);
-					continue;
-				}
-				list += 2;
-				desc_val = pgm_read_word(list);
-				if (desc_val != wIndex) {
-					list += sizeof(struct descriptor_list_struct)-2;
-					continue;
-				}
-				list += 2;
-				desc_addr = (const uint8_t *)pgm_read_word(list);
-				list += 2;
-				desc_length = pgm_read_byte(list);
-				break;
+        bmRequestType = UEDATX;
+        bRequest = UEDATX;
+        wValue = UEDATX;
+        wValue |= (UEDATX << 8);
+        wIndex = UEDATX;
+        wIndex |= (UEDATX << 8);
+        wLength = UEDATX;
+        wLength |= (UEDATX << 8);
+        UEINTX = ~((1<<RXSTPI) | (1<<RXOUTI) | (1<<TXINI));
+        if (bRequest == GET_DESCRIPTOR) {
+		list = descriptor_list;
+		for (i=0; ; i++, list++) {
+			if (i >= NUM_DESC_LIST) {
+				ep0_stall();
+				return;
 			}
-			len = (wLength < 256) ? wLength : 255;
-			if (len > desc_length) len = desc_length;
-			do {
-				// wait for host ready for IN packet
-				do {
-					i = UEINTX;
-				} while (!(i & ((1<<TXINI)|(1<<RXOUTI))));
-				if (i & (1<<RXOUTI)) return;	// abort
-				// send IN packet
-				n = len < ENDPOINT0_SIZE ? len : ENDPOINT0_SIZE;
-				for (i = n; i; i--) {
-					UEDATX = pgm_read_byte(desc_addr++);
-				}
-				len -= n;
-				usb_send_in();
-			} while (len || n == ENDPOINT0_SIZE);
-			return;
-                }
-		if (bRequest == SET_ADDRESS) {
+			desc_val = pgm_read_word(&list->wValue);
+			if (desc_val != wValue) {
+				continue;
+			}
+			desc_val = pgm_read_word(&list->wIndex);
+			if (desc_val != wIndex) {
+				continue;
+			}
+			break;
+		}
+		ep0_send((const uint8_t *)pgm_read_ptr(&list->addr),
+			pgm_read_byte(&list->length), true, wLength);
+		return;
+        }
+	if (bRequest == SET_ADDRESS) {
+		// the address applies after the status stage
+		usb_send_in();
+		ep0_value = wValue;
+		ep0_state = EP0_ADDRESS;
+		UEIENX = (1<<RXSTPE) | (1<<TXINE);
+		return;
+	}
+	if (bRequest == SET_CONFIGURATION && bmRequestType == 0) {
+		usb_configuration = wValue;
+		usb_send_in();
+		cfg = endpoint_config_table;
+		for (i=1; i<5; i++) {
+			UENUM = i;
+			en = pgm_read_byte(cfg++);
+			UECONX = en;
+			if (en) {
+				UECFG0X = pgm_read_byte(cfg++);
+				UECFG1X = pgm_read_byte(cfg++);
+			}
+		}
+        	UERST = 0x1E;
+        	UERST = 0;
+		return;
+	}
+	if (bRequest == GET_CONFIGURATION && bmRequestType == 0x80) {
+		ep0_buf[0] = usb_configuration;
+		ep0_send(ep0_buf, 1, false, wLength);
+		return;
+	}
+
+	if (bRequest == GET_STATUS) {
+		i = 0;
+		#ifdef SUPPORT_ENDPOINT_HALT
+		if (bmRequestType == 0x82) {
+			UENUM = wIndex;
+			if (UECONX & (1<<STALLRQ)) i = 1;
+			UENUM = 0;
+		}
+		#endif
+		if (bmRequestType == 0x80 && remote_wakeup_enabled)
+			i = 2;
+		ep0_buf[0] = i;
+		ep0_buf[1] = 0;
+		ep0_send(ep0_buf, 2, false, wLength);
+		return;
+	}
+	if ((bRequest == CLEAR_FEATURE || bRequest == SET_FEATURE)
+	  && bmRequestType == 0x00 && wValue == DEVICE_REMOTE_WAKEUP) {
+		remote_wakeup_enabled = bRequest == SET_FEATURE;
+		usb_send_in();
+		return;
+	}
+	#ifdef SUPPORT_ENDPOINT_HALT
+	if ((bRequest == CLEAR_FEATURE || bRequest == SET_FEATURE)
+	  && bmRequestType == 0x02 && wValue == 0) {
+		i = wIndex & 0x7F;
+		if (i >= 1 && i <= MAX_ENDPOINT) {
 			usb_send_in();
-			usb_wait_in_ready();
-			UDADDR = wValue | (1<<ADDEN);
+			UENUM = i;
+			if (bRequest == SET_FEATURE) {
+				UECONX = (1<<STALLRQ)|(1<<EPEN);
+			} else {
+				UECONX = (1<<STALLRQC)|(1<<RSTDT)|(1<<EPEN);
+				UERST = (1 << i);
+				UERST = 0;
+			}
 			return;
 		}
-		if (bRequest == SET_CONFIGURATION && bmRequestType == 0) {
-			usb_configuration = wValue;
+	}
+	#endif
+	if (wIndex == MOUSE_INTERFACE) {
+		if (bmRequestType == 0xA1) {
+			if (bRequest == HID_GET_REPORT
+			  && wValue == (HID_REPORT_INPUT << 8)) {
+				// takes what it reports from the next
+				// report of the endpoint
+				usb_mouse_get_report(ep0_buf);
+				ep0_send(ep0_buf, MOUSE_REPORT_SIZE, false, wLength);
+				return;
+			}
+			if (bRequest == HID_GET_IDLE && LSB(wValue) == 0) {
+				ep0_buf[0] = mouse_idle;
+				ep0_send(ep0_buf, 1, false, wLength);
+				return;
+			}
+			if (bRequest == HID_GET_PROTOCOL) {
+				ep0_buf[0] = mouse_protocol;
+				ep0_send(ep0_buf, 1, false, wLength);
+				return;
+			}
+		}
+		if (bmRequestType == 0x21) {
+			if (bRequest == HID_SET_PROTOCOL) {
+				mouse_protocol = wValue;
+				usb_send_in();
+				return;
+			}
+			if (bRequest == HID_SET_IDLE && LSB(wValue) == 0) {
+				mouse_idle = MSB(wValue);
+				usb_send_in();
+				return;
+			}
+		}
+	}
+	if (wIndex == SETTINGS_INTERFACE) {
+		// feature reports only, so the idle rate stays infinite
+		if (bmRequestType == 0x21 && bRequest == HID_SET_IDLE
+		  && wValue == 0) {
 			usb_send_in();
-			cfg = endpoint_config_table;
-			for (i=1; i<5; i++) {
-				UENUM = i;
-				en = pgm_read_byte(cfg++);
-				UECONX = en;
-				if (en) {
-					UECFG0X = pgm_read_byte(cfg++);
-					UECFG1X = pgm_read_byte(cfg++);
-				}
+			return;
+		}
+		if (bmRequestType == 0xA1 && bRequest == HID_GET_IDLE
+		  && wValue == 0) {
+			ep0_buf[0] = 0;
+			ep0_send(ep0_buf, 1, false, wLength);
+			return;
+		}
+		if (bmRequestType == 0xA1 && bRequest == HID_GET_REPORT
+		  && MSB(wValue) == HID_REPORT_FEATURE) {
+			len = settings_get_report(LSB(wValue), ep0_buf);
+			if (len) {
+				ep0_send(ep0_buf, len, false, wLength);
+				return;
 			}
-        		UERST = 0x1E;
-        		UERST = 0;
+		}
+		if (bmRequestType == 0x21 && bRequest == HID_SET_REPORT
+		  && MSB(wValue) == HID_REPORT_FEATURE
+		  && wLength && wLength <= SETTINGS_REPORT_SIZE) {
+			// fits one packet, ep0_receive takes it
+			ep0_value = LSB(wValue);
+			ep0_length = wLength;
+			ep0_state = EP0_DATA_OUT;
+			UEIENX = (1<<RXSTPE) | (1<<RXOUTE);
 			return;
 		}
-		if (bRequest == GET_CONFIGURATION && bmRequestType == 0x80) {
-			usb_wait_in_ready();
-			UEDATX = usb_configuration;
+	}
+	if (wIndex == CAPTURE_INTERFACE && bmRequestType == 0x41) {
+		if (bRequest == CAPTURE_START) {
+			capture_start(wValue);
 			usb_send_in();
 			return;
 		}
-
-		if (bRequest == GET_STATUS) {
-			usb_wait_in_ready();
-			i = 0;
-			#ifdef SUPPORT_ENDPOINT_HALT
-			if (bmRequestType == 0x82) {
-				UENUM = wIndex;
-				if (UECONX & (1<<STALLRQ)) i = 1;
-				UENUM = 0;
-			}
-			#endif
-			UEDATX = i;
-			UEDATX = 0;
+		if (bRequest == CAPTURE_STOP) {
+			capture_stop();
 			usb_send_in();
 			return;
 		}
-		#ifdef SUPPORT_ENDPOINT_HALT
-		if ((bRequest == CLEAR_FEATURE || bRequest == SET_FEATURE)
-		  && bmRequestType == 0x02 && wValue == 0) {
-			i = wIndex & 0x7F;
-			if (i >= 1 && i <= MAX_ENDPOINT) {
-				usb_send_in();
-				UENUM = i;
-				if (bRequest == SET_FEATURE) {
-					UECONX = (1<<STALLRQ)|(1<<EPEN);
-				} else {
-					UECONX = (1<<STALLRQC)|(1<<RSTDT)|(1<<EPEN);
-					UERST = (1 << i);
-					UERST = 0;
-				}
-				return;
-			}
+	}
+	ep0_stall();
+}
+
+
+
+// USB Endpoint Interrupt - endpoint 0 is handled here, one step of the
+// control transfer at a time.  The other endpoints are manipulated by
+// the slots and the capture.
+//
+ISR(USB_COM_vect)
+{
+        uint8_t intbits;
+
+        UENUM = 0;
+	intbits = UEINTX;
+	// a SETUP ends whatever transfer was going on
+        if (intbits & (1<<RXSTPI)) {
+		ep0_idle();
+		ep0_setup();
+		return;
+	}
+	switch (ep0_state) {
+	case EP0_DATA_IN:
+		if (intbits & (1<<RXOUTI)) {
+			ep0_idle();	// abort
+		} else if (intbits & (1<<TXINI)) {
+			ep0_send_packet();
 		}
-		#endif
-		if (wIndex == MOUSE_INTERFACE) {
-			if (bmRequestType == 0xA1) {
-				if (bRequest == HID_GET_REPORT) {
-					usb_wait_in_ready();
-					UEDATX = 0;
-					UEDATX = 0;
-					UEDATX = 0;
-					UEDATX = 0;
-					UEDATX = 0;
-					UEDATX = 0;
-					usb_send_in();
-					return;
-				}
-				if (bRequest == HID_GET_PROTOCOL) {
-					usb_wait_in_ready();
-					UEDATX = mouse_protocol;
-					usb_send_in();
-					return;
-				}
-			}
-			if (bmRequestType == 0x21) {
-				if (bRequest == HID_SET_PROTOCOL) {
-					mouse_protocol = wValue;
-					usb_send_in();
-					return;
-				}
-			}
+		break;
+	case EP0_DATA_OUT:
+		if (intbits & (1<<RXOUTI)) {
+			ep0_receive();
+		}
+		break;
+	case EP0_ADDRESS:
+		if (intbits & (1<<TXINI)) {
+			UDADDR = ep0_value | (1<<ADDEN);
+			ep0_idle();
 		}
+		break;
 	}
-	UECONX = (1<<STALLRQ) | (1<<EPEN);	// stall
 }
 
 
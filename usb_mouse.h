@@ -1,17 +1,76 @@
 #ifndef usb_serial_h__
 #define usb_serial_h__
 
+#include <stdbool.h>
 #include <stdint.h>
 
 void usb_init(void);			// initialize everything
 uint8_t usb_configured(void);		// is the USB port configured
+
+/**
+ * @return true while the host keeps the bus suspended; the USB clock and
+ *         the PLL are stopped meanwhile
+ */
+bool usb_suspended(void);
+
+/**
+ * Signals resume to the host during a suspend, if it has enabled remote
+ * wakeup; the host then resumes the bus, which ends the suspend. Starts
+ * the USB clock again. The bus must have been idle for 5ms, 2ms more
+ * than it takes to suspend. Call with interrupts disabled.
+ *
+ * @return true if resume was signaled
+ */
+bool usb_remote_wakeup(void);
+
+/**
+ * @return the idle rate of the mouse interface set by the host, in
+ *         frames: the last report is sent again when there has been no
+ *         other for this long; 0 for never
+ */
+uint16_t usb_mouse_idle_frames(void);
+
+/**
+ * Fills report with the mouse report of what came since the last one, as
+ * for the endpoint, and takes it: the next report of the endpoint only
+ * has what comes after. Defined by the application, called from the USB
+ * interrupt for HID GET_REPORT.
+ *
+ * @param report MOUSE_REPORT_SIZE bytes
+ */
+void usb_mouse_get_report(uint8_t *report);
 /*
 void usb_mouse_update(const uint8_t button_mask,
 		const uint8_t x_lo, const uint8_t x_hi,
 		const uint8_t y_lo, const uint8_t y_hi,
 		const int8_t wheel);
 */
+#define MOUSE_INTERFACE		0
 #define MOUSE_ENDPOINT		3
+// mouse report: buttons, then X and Y of MOUSE_XY_BITS each, little endian
+// and packed; with 16 bit X/Y a wheel byte (always 0) follows, the layout
+// of the original firmware. 12 bit X/Y packs it into 4 bytes instead of 6,
+// +-2047 counts per report
+#ifndef MOUSE_XY_BITS
+#define MOUSE_XY_BITS		16
+#endif
+#if MOUSE_XY_BITS != 16 && MOUSE_XY_BITS != 12
+#error MOUSE_XY_BITS must be 16 or 12
+#endif
+#define MOUSE_XY_MAX		((1L << (MOUSE_XY_BITS - 1)) - 1)
+#define MOUSE_WHEEL		(MOUSE_XY_BITS == 16)
+// MOUSE_TIMESTAMP appends, in vendor page fields the mouse drivers ignore,
+// the frame number (UDFNUM) the report was filled in and a 2 bit weight of
+// the motion in each of its 8 slots, slot 0 in the low bits: 0 none,
+// 1 up to 3 counts, 2 up to 15, 3 more
+#ifdef MOUSE_TIMESTAMP
+#define MOUSE_TIMESTAMP_SIZE	4
+#else
+#define MOUSE_TIMESTAMP_SIZE	0
+#endif
+#define MOUSE_REPORT_SIZE	(1 + MOUSE_XY_BITS * 2 / 8 + MOUSE_WHEEL \
+				+ MOUSE_TIMESTAMP_SIZE)
+#define DEVICE_VERSION		0x0100	// bcdDevice
 // This file does not include the HID debug functions, so these empty
 // macros replace them with nothing, so users can compile code that
 // has calls to these functions.
@@ -80,6 +139,8 @@ void usb_mouse_update(const uint8_t button_mask,
 #define SET_CONFIGURATION		9
 #define GET_INTERFACE			10
 #define SET_INTERFACE			11
+// standard feature selectors
+#define DEVICE_REMOTE_WAKEUP		1
 // HID (human interface device)
 #define HID_GET_REPORT			1
 #define HID_GET_IDLE			2
@@ -87,6 +148,8 @@ void usb_mouse_update(const uint8_t button_mask,
 #define HID_SET_REPORT			9
 #define HID_SET_IDLE			10
 #define HID_SET_PROTOCOL		11
+#define HID_REPORT_INPUT		1	// report type, MSB of wValue
+#define HID_REPORT_FEATURE		3
 // CDC (communication class device)
 #define CDC_SET_LINE_CODING		0x20
 #define CDC_GET_LINE_CODING		0x21